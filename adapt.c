@@ -0,0 +1,160 @@
+/*
+ * Adaptive compression policy for the TM-C6xx filter.
+ *
+ * CompressData() only sends PackBits data when it is smaller than the raw
+ * pass, so on photos many passes are compressed for nothing.  Each plane
+ * keeps a little state across bands:
+ *
+ *   - While compression keeps paying off the plane is always compressed,
+ *     so sparse label content loses nothing.
+ *   - Once a pass fails to compress, the following passes are sampled
+ *     first: runs of three or more equal bytes in small windows spread over
+ *     an eighth of the pass estimate what PackBits would save.  If the
+ *     estimate says "compress" the pass is compressed (a probe) and a
+ *     smaller result puts the plane back to always compressing; otherwise
+ *     the pass is sent raw.
+ *   - Every eighth "raw" sample is compressed anyway to check it, and the
+ *     result is used if it is smaller.
+ *
+ * Sampling is cheap enough to do for every pass, so a plane that goes from
+ * a photo back to text or white space is compressed again straight away.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "adapt.h"
+#include <string.h>
+
+
+/*
+ * Constants...
+ */
+
+#define ADAPT_MIN_LENGTH	1024	/* Always compress shorter passes */
+#define ADAPT_WINDOW		64	/* Bytes in each sample window */
+#define ADAPT_STRIDE		512	/* Bytes between sample windows */
+#define ADAPT_CHECK_EVERY	8	/* Check one in this many "raw" samples */
+
+
+/*
+ * Local functions...
+ */
+
+static int	sample(const unsigned char *data, int length);
+
+
+/*
+ * 'tmcAdaptDecide()' - Decide how to send the next pass of a plane.
+ */
+
+int					/* O - TMC_ADAPT_ decision */
+tmcAdaptDecide(tmc_adapt_t         *a,	/* I - Plane state */
+               const unsigned char *data,
+					/* I - Pass data */
+	       int                 length)
+					/* I - Number of bytes */
+{
+  if (!a->fails || length < ADAPT_MIN_LENGTH)
+    return (TMC_ADAPT_COMPRESS);
+
+  if (sample(data, length))
+    return (TMC_ADAPT_PROBE);
+
+  if (++ a->samples >= ADAPT_CHECK_EVERY)
+  {
+    a->samples = 0;
+
+    return (TMC_ADAPT_CHECK);
+  }
+
+  a->stats.raw ++;
+
+  return (TMC_ADAPT_RAW);
+}
+
+
+/*
+ * 'tmcAdaptReset()' - Start a plane with no history.
+ */
+
+void
+tmcAdaptReset(tmc_adapt_t *a)		/* I - Plane state */
+{
+  memset(a, 0, sizeof(tmc_adapt_t));
+}
+
+
+/*
+ * 'tmcAdaptResult()' - Learn from a pass that was compressed.
+ */
+
+void
+tmcAdaptResult(tmc_adapt_t *a,		/* I - Plane state */
+               int         decision,	/* I - Decision for the pass */
+	       int         compressed)	/* I - 1 if PackBits was smaller */
+{
+  if (decision == TMC_ADAPT_RAW)
+    return;
+
+  a->stats.compressed ++;
+
+  if (decision == TMC_ADAPT_PROBE)
+  {
+    a->stats.probes ++;
+    a->stats.probe_hits += compressed;
+  }
+  else if (decision == TMC_ADAPT_CHECK)
+  {
+    a->stats.checks ++;
+    a->stats.check_hits += !compressed;
+  }
+
+  if (compressed)
+    a->fails = 0;
+  else
+    a->fails ++;
+}
+
+
+/*
+ * 'sample()' - Estimate whether PackBits will make a pass smaller.
+ *
+ * Each run of r >= 3 equal bytes saves about r - 2 bytes, and every 128
+ * bytes of literals cost one more; the pass is worth compressing when the
+ * windows save more than 1/32 of their size.
+ */
+
+static int				/* O - 1 to compress, 0 to send raw */
+sample(const unsigned char *data,	/* I - Pass data */
+       int                 length)	/* I - Number of bytes */
+{
+  int			start,		/* Start of window */
+			saved = 0,	/* Estimated bytes saved */
+			sampled = 0;	/* Bytes sampled */
+  const unsigned char	*p,		/* Current byte */
+			*end,		/* End of window */
+			*run;		/* Start of run */
+
+
+  for (start = 0; start + ADAPT_WINDOW <= length; start += ADAPT_STRIDE)
+  {
+    p       = data + start;
+    end     = p + ADAPT_WINDOW;
+    sampled += ADAPT_WINDOW;
+
+    while (p < end)
+    {
+      for (run = p ++; p < end && *p == *run; p ++);
+
+      if (p - run >= 3)
+        saved += (int)(p - run) - 2;
+    }
+  }
+
+  return (saved - sampled / 128 > sampled / 32);
+}
@@ -0,0 +1,55 @@
+/*
+ * Adaptive compression policy for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_ADAPT_H_
+#  define _TMC6XX_ADAPT_H_
+
+/*
+ * Decisions...
+ */
+
+enum
+{
+  TMC_ADAPT_COMPRESS,			/* Compress, the plane has been */
+  TMC_ADAPT_PROBE,			/* Compress, the sample says it will */
+  TMC_ADAPT_CHECK,			/* Compress, to check a "raw" sample */
+  TMC_ADAPT_RAW				/* Send uncompressed */
+};
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_adapt_stats_s	/**** Policy counters ****/
+{
+  unsigned long		compressed,	/* Passes compressed */
+			raw,		/* Passes sent without compressing */
+			probes,		/* Samples that said "compress" */
+			probe_hits,	/* ... and were right */
+			checks,		/* Samples that said "raw" and were checked */
+			check_hits;	/* ... and were right */
+} tmc_adapt_stats_t;
+
+typedef struct tmc_adapt_s		/**** Policy state for a plane ****/
+{
+  int			fails,		/* Compressions in a row that failed */
+			samples;	/* "Raw" samples since the last check */
+  tmc_adapt_stats_t	stats;		/* Counters */
+} tmc_adapt_t;
+
+
+/*
+ * Prototypes...
+ */
+
+extern int	tmcAdaptDecide(tmc_adapt_t *a, const unsigned char *data,
+		               int length);
+extern void	tmcAdaptReset(tmc_adapt_t *a);
+extern void	tmcAdaptResult(tmc_adapt_t *a, int decision, int compressed);
+
+#endif /* !_TMC6XX_ADAPT_H_ */
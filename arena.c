@@ -0,0 +1,98 @@
+/*
+ * Job-lifetime buffer arena for the TM-C6xx filter.
+ *
+ * The page buffers are carved out of one block that is only replaced when
+ * a page needs more memory than any page before it, so a job allocates
+ * (and faults in) its buffers once instead of on every page.  Buffers are
+ * not cleared; each one is written before it is read.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "arena.h"
+#include <stdlib.h>
+
+
+/*
+ * 'tmcArenaRound()' - Round a buffer size up to the arena alignment.
+ */
+
+size_t					/* O - Rounded size */
+tmcArenaRound(size_t size)		/* I - Buffer size */
+{
+  return ((size + TMC_ARENA_ALIGN - 1) & ~(size_t)(TMC_ARENA_ALIGN - 1));
+}
+
+
+/*
+ * 'tmcArenaReserve()' - Make room for a new set of buffers.
+ *
+ * "size" is the sum of the rounded sizes of the buffers; any buffers
+ * handed out before are released.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcArenaReserve(tmc_arena_t *a,		/* I - Arena */
+                size_t      size)	/* I - Bytes needed */
+{
+  void	*data;				/* New arena memory */
+
+
+  a->used = 0;
+
+  if (size <= a->size)
+    return (0);
+
+  if (posix_memalign(&data, TMC_ARENA_ALIGN, size))
+    return (-1);
+
+  free(a->data);
+
+  a->data = data;
+  a->size = size;
+
+  return (0);
+}
+
+
+/*
+ * 'tmcArenaAlloc()' - Hand out a buffer from the arena.
+ */
+
+void *					/* O - Buffer or NULL */
+tmcArenaAlloc(tmc_arena_t *a,		/* I - Arena */
+              size_t      size)		/* I - Size of buffer */
+{
+  void	*ptr;				/* Buffer */
+
+
+  size = tmcArenaRound(size);
+
+  if (size > a->size - a->used)
+    return (NULL);
+
+  ptr     = a->data + a->used;
+  a->used += size;
+
+  return (ptr);
+}
+
+
+/*
+ * 'tmcArenaFree()' - Free the arena memory.
+ */
+
+void
+tmcArenaFree(tmc_arena_t *a)		/* I - Arena */
+{
+  free(a->data);
+
+  a->data = NULL;
+  a->size = 0;
+  a->used = 0;
+}
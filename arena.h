@@ -0,0 +1,46 @@
+/*
+ * Job-lifetime buffer arena for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_ARENA_H_
+#  define _TMC6XX_ARENA_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+
+
+/*
+ * Constants...
+ */
+
+#  define TMC_ARENA_ALIGN	64	/* Alignment of each buffer */
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_arena_s		/**** Buffer arena ****/
+{
+  unsigned char	*data;			/* Arena memory */
+  size_t	size,			/* Size of arena */
+		used;			/* Bytes handed out */
+} tmc_arena_t;
+
+
+/*
+ * Prototypes...
+ */
+
+extern size_t		tmcArenaRound(size_t size);
+extern int		tmcArenaReserve(tmc_arena_t *a, size_t size);
+extern void		*tmcArenaAlloc(tmc_arena_t *a, size_t size);
+extern void		tmcArenaFree(tmc_arena_t *a);
+
+#endif /* !_TMC6XX_ARENA_H_ */
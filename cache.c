@@ -0,0 +1,579 @@
+/*
+ * Compressed band cache for the TM-C6xx filter.
+ *
+ * Labels repeat most of their artwork from page to page, so the same
+ * dithered band often has to be packed and compressed again and again.
+ * The cache maps a 128-bit hash of a plane's dithered band to the two
+ * compressed microweave passes made from it, keeping the most recently
+ * used bands up to a size limit.  With a cache directory the bands are
+ * also saved as files, one per hash, so later jobs can use them.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+
+/*
+ * Constants...
+ */
+
+#define CACHE_BUCKETS	4096		/* Hash table size (power of 2) */
+#define CACHE_MAGIC	0x42434d54	/* "TMCB" */
+#define CACHE_VERSION	1		/* Cache file version */
+
+#define HASH_K0		0xa0761d6478bd642fULL
+#define HASH_K1		0xe7037ed1a0b428dbULL
+#define HASH_K2		0x8ebc6af09c88c6e3ULL
+#define HASH_K3		0x589965cc75374cc3ULL
+
+
+/*
+ * Types...
+ */
+
+typedef struct cache_entry_s		/**** Cached band ****/
+{
+  tmc_hash_t		key;		/* Hash of dithered band */
+  struct cache_entry_s	*prev,		/* More recently used entry */
+			*next,		/* Less recently used entry */
+			*chain;		/* Next entry in bucket */
+  size_t		size;		/* Size of entry */
+  int			type[2],	/* Compression type of each pass */
+			length[2];	/* Length of each pass */
+  unsigned char		data[1];	/* Pass data */
+} cache_entry_t;
+
+typedef struct cache_file_s		/**** Cache file header ****/
+{
+  uint32_t		magic,		/* CACHE_MAGIC */
+			version;	/* CACHE_VERSION */
+  tmc_hash_t		key;		/* Hash of dithered band */
+  int32_t		type[2],	/* Compression type of each pass */
+			length[2];	/* Length of each pass */
+} cache_file_t;
+
+struct tmc_cache_s			/**** Band cache ****/
+{
+  pthread_mutex_t	mutex;		/* Cache lock */
+  size_t		max_bytes,	/* Size limit */
+			bytes;		/* Size of entries */
+  cache_entry_t		*buckets[CACHE_BUCKETS],
+					/* Hash table */
+			*first,		/* Most recently used entry */
+			*last;		/* Least recently used entry */
+  char			*directory;	/* Cache directory or NULL */
+  tmc_cache_stats_t	stats;		/* Counters */
+};
+
+
+/*
+ * Local functions...
+ */
+
+static cache_entry_t	*cache_find(tmc_cache_t *c, const tmc_hash_t *key);
+static cache_entry_t	*cache_insert(tmc_cache_t *c, cache_entry_t *e);
+static cache_entry_t	*cache_new(const tmc_hash_t *key,
+			           const unsigned char **data,
+				   const int *type, const int *length);
+static cache_entry_t	*cache_read(tmc_cache_t *c, const tmc_hash_t *key);
+static void		cache_remove(tmc_cache_t *c, cache_entry_t *e);
+static void		cache_write(tmc_cache_t *c, const tmc_hash_t *key,
+			            const unsigned char **data,
+				    const int *type, const int *length);
+
+
+/*
+ * 'hash_mix()' - Multiply two values and fold the 128-bit product.
+ */
+
+static inline uint64_t			/* O - Mixed value */
+hash_mix(uint64_t a,			/* I - First value */
+         uint64_t b)			/* I - Second value */
+{
+  __uint128_t	r = (__uint128_t)a * b;	/* Product */
+
+
+  return ((uint64_t)r ^ (uint64_t)(r >> 64));
+}
+
+
+/*
+ * 'tmcHashInit()' - Start a new hash.
+ */
+
+void
+tmcHashInit(tmc_hash_t *h)		/* I - Hash */
+{
+  h->h[0] = HASH_K0;
+  h->h[1] = HASH_K1;
+}
+
+
+/*
+ * 'tmcHashUpdate()' - Add data to a hash.
+ */
+
+void
+tmcHashUpdate(tmc_hash_t *h,		/* I - Hash */
+              const void *data,		/* I - Data */
+	      size_t     length)	/* I - Number of bytes */
+{
+  const unsigned char	*ptr = (const unsigned char *)data;
+					/* Pointer into data */
+  uint64_t		h0, h1,		/* Hash lanes */
+			a, b;		/* Current data words */
+
+
+  h0 = h->h[0] ^ hash_mix(length ^ HASH_K2, HASH_K3);
+  h1 = h->h[1] ^ length;
+
+  for (; length >= 16; length -= 16, ptr += 16)
+  {
+    memcpy(&a, ptr, 8);
+    memcpy(&b, ptr + 8, 8);
+
+    h0 = hash_mix(a ^ HASH_K0, b ^ h0);
+    h1 = hash_mix(b ^ HASH_K2, a ^ h1 ^ HASH_K3);
+  }
+
+  if (length > 0)
+  {
+    unsigned char	tail[16];	/* Last partial block */
+
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, ptr, length);
+    memcpy(&a, tail, 8);
+    memcpy(&b, tail + 8, 8);
+
+    h0 = hash_mix(a ^ HASH_K0, b ^ h0);
+    h1 = hash_mix(b ^ HASH_K2, a ^ h1 ^ HASH_K3);
+  }
+
+  h->h[0] = hash_mix(h0 ^ HASH_K1, h1 ^ HASH_K2);
+  h->h[1] = hash_mix(h1 ^ HASH_K3, h0 ^ HASH_K0);
+}
+
+
+/*
+ * 'tmcCacheNew()' - Create a band cache.
+ */
+
+tmc_cache_t *				/* O - New cache or NULL */
+tmcCacheNew(size_t     max_bytes,	/* I - Size limit */
+            const char *directory)	/* I - Cache directory or NULL */
+{
+  tmc_cache_t	*c;			/* New cache */
+
+
+  if ((c = calloc(1, sizeof(tmc_cache_t))) == NULL)
+    return (NULL);
+
+  pthread_mutex_init(&c->mutex, NULL);
+
+  c->max_bytes = max_bytes;
+
+  if (directory && *directory)
+    c->directory = strdup(directory);
+
+  return (c);
+}
+
+
+/*
+ * 'tmcCacheDelete()' - Free a band cache.
+ */
+
+void
+tmcCacheDelete(tmc_cache_t *c)		/* I - Cache */
+{
+  cache_entry_t	*e,			/* Current entry */
+		*next;			/* Next entry */
+
+
+  if (!c)
+    return;
+
+  for (e = c->first; e; e = next)
+  {
+    next = e->next;
+    free(e);
+  }
+
+  pthread_mutex_destroy(&c->mutex);
+
+  free(c->directory);
+  free(c);
+}
+
+
+/*
+ * 'tmcCacheGet()' - Copy a cached band into the caller's pass buffers.
+ *
+ * "saved" is the number of bytes the caller would otherwise have packed and
+ * compressed, for the statistics.
+ */
+
+int					/* O - 1 if found, 0 otherwise */
+tmcCacheGet(tmc_cache_t      *c,	/* I - Cache */
+            const tmc_hash_t *key,	/* I - Hash of dithered band */
+	    unsigned char    **data,	/* I - Buffers for each pass */
+	    int              *type,	/* O - Compression type of each pass */
+	    int              *length,	/* O - Length of each pass */
+	    size_t           saved)	/* I - Bytes saved on a hit */
+{
+  int		i;			/* Looping var */
+  cache_entry_t	*e;			/* Cached band */
+
+
+  pthread_mutex_lock(&c->mutex);
+
+  if ((e = cache_find(c, key)) == NULL && c->directory)
+  {
+   /*
+    * Try the cache directory, without holding the lock while reading...
+    */
+
+    pthread_mutex_unlock(&c->mutex);
+    e = cache_read(c, key);
+    pthread_mutex_lock(&c->mutex);
+
+    if (e)
+    {
+      e = cache_insert(c, e);
+      c->stats.disk_hits ++;
+    }
+  }
+
+  if (!e)
+  {
+    c->stats.misses ++;
+    pthread_mutex_unlock(&c->mutex);
+    return (0);
+  }
+
+ /*
+  * Move the band to the front of the list and copy it out...
+  */
+
+  if (e != c->first)
+  {
+    cache_remove(c, e);
+    cache_insert(c, e);
+  }
+
+  for (i = 0; i < 2; i ++)
+  {
+    type[i]   = e->type[i];
+    length[i] = e->length[i];
+
+    memcpy(data[i], e->data + (i ? e->length[0] : 0), e->length[i]);
+  }
+
+  c->stats.hits ++;
+  c->stats.bytes_saved += saved;
+
+  pthread_mutex_unlock(&c->mutex);
+
+  return (1);
+}
+
+
+/*
+ * 'tmcCachePut()' - Add a compressed band to the cache.
+ */
+
+void
+tmcCachePut(tmc_cache_t         *c,	/* I - Cache */
+            const tmc_hash_t    *key,	/* I - Hash of dithered band */
+	    const unsigned char **data,	/* I - Data for each pass */
+	    const int           *type,	/* I - Compression type of each pass */
+	    const int           *length)/* I - Length of each pass */
+{
+  cache_entry_t	*e,			/* New entry */
+		*added;			/* Entry in cache */
+
+
+  if ((e = cache_new(key, data, type, length)) == NULL)
+    return;
+
+  if (e->size > c->max_bytes)
+  {
+    free(e);
+    return;
+  }
+
+  pthread_mutex_lock(&c->mutex);
+  added = cache_insert(c, e);
+  pthread_mutex_unlock(&c->mutex);
+
+  if (added == e && c->directory)
+    cache_write(c, key, data, type, length);
+}
+
+
+/*
+ * 'tmcCacheStats()' - Get the cache counters.
+ */
+
+void
+tmcCacheStats(tmc_cache_t       *c,	/* I - Cache */
+              tmc_cache_stats_t *stats)	/* O - Counters */
+{
+  pthread_mutex_lock(&c->mutex);
+  *stats = c->stats;
+  pthread_mutex_unlock(&c->mutex);
+}
+
+
+/*
+ * 'cache_find()' - Find a band in the hash table.
+ */
+
+static cache_entry_t *			/* O - Entry or NULL */
+cache_find(tmc_cache_t      *c,		/* I - Cache */
+           const tmc_hash_t *key)	/* I - Hash of dithered band */
+{
+  cache_entry_t	*e;			/* Current entry */
+
+
+  for (e = c->buckets[key->h[0] & (CACHE_BUCKETS - 1)]; e; e = e->chain)
+    if (e->key.h[0] == key->h[0] && e->key.h[1] == key->h[1])
+      return (e);
+
+  return (NULL);
+}
+
+
+/*
+ * 'cache_insert()' - Add an entry as the most recently used one, evicting
+ *                    the least recently used entries as needed.
+ *
+ * If the band is already cached the new entry is freed and the cached one
+ * is returned.
+ */
+
+static cache_entry_t *			/* O - Entry in cache */
+cache_insert(tmc_cache_t   *c,		/* I - Cache */
+             cache_entry_t *e)		/* I - New entry */
+{
+  cache_entry_t	*old,			/* Cached entry */
+		**bucket;		/* Hash bucket */
+
+
+  if ((old = cache_find(c, &e->key)) != NULL && old != e)
+  {
+    free(e);
+    return (old);
+  }
+
+  bucket   = c->buckets + (e->key.h[0] & (CACHE_BUCKETS - 1));
+  e->chain = *bucket;
+  *bucket  = e;
+
+  e->prev = NULL;
+  e->next = c->first;
+
+  if (c->first)
+    c->first->prev = e;
+  else
+    c->last = e;
+
+  c->first = e;
+  c->bytes += e->size;
+
+  while (c->bytes > c->max_bytes && c->last != e)
+  {
+    old = c->last;
+    cache_remove(c, old);
+    free(old);
+  }
+
+  return (e);
+}
+
+
+/*
+ * 'cache_new()' - Create an entry for a band.
+ */
+
+static cache_entry_t *			/* O - New entry or NULL */
+cache_new(const tmc_hash_t    *key,	/* I - Hash of dithered band */
+          const unsigned char **data,	/* I - Data for each pass */
+	  const int           *type,	/* I - Compression type of each pass */
+	  const int           *length)	/* I - Length of each pass */
+{
+  size_t	size;			/* Size of entry */
+  cache_entry_t	*e;			/* New entry */
+
+
+  size = sizeof(cache_entry_t) + length[0] + length[1];
+
+  if ((e = malloc(size)) == NULL)
+    return (NULL);
+
+  e->key       = *key;
+  e->size      = size;
+  e->type[0]   = type[0];
+  e->type[1]   = type[1];
+  e->length[0] = length[0];
+  e->length[1] = length[1];
+
+  memcpy(e->data, data[0], length[0]);
+  memcpy(e->data + length[0], data[1], length[1]);
+
+  return (e);
+}
+
+
+/*
+ * 'cache_read()' - Read a band from the cache directory.
+ */
+
+static cache_entry_t *			/* O - New entry or NULL */
+cache_read(tmc_cache_t      *c,		/* I - Cache */
+           const tmc_hash_t *key)	/* I - Hash of dithered band */
+{
+  char		filename[1024];		/* Cache file */
+  FILE		*fp;			/* Cache file */
+  cache_file_t	header;			/* File header */
+  cache_entry_t	*e;			/* New entry */
+  size_t	size;			/* Size of entry */
+
+
+  snprintf(filename, sizeof(filename), "%s/%016llx%016llx.band", c->directory,
+           (unsigned long long)key->h[0], (unsigned long long)key->h[1]);
+
+  if ((fp = fopen(filename, "rb")) == NULL)
+    return (NULL);
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      header.magic != CACHE_MAGIC || header.version != CACHE_VERSION ||
+      header.key.h[0] != key->h[0] || header.key.h[1] != key->h[1] ||
+      header.length[0] < 0 || header.length[1] < 0 ||
+      header.length[0] > 0x1000000 || header.length[1] > 0x1000000)
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  size = sizeof(cache_entry_t) + header.length[0] + header.length[1];
+
+  if ((e = malloc(size)) == NULL)
+  {
+    fclose(fp);
+    return (NULL);
+  }
+
+  e->key       = *key;
+  e->size      = size;
+  e->type[0]   = header.type[0];
+  e->type[1]   = header.type[1];
+  e->length[0] = header.length[0];
+  e->length[1] = header.length[1];
+
+  if (fread(e->data, 1, e->length[0] + e->length[1], fp) !=
+          (size_t)(e->length[0] + e->length[1]) ||
+      getc(fp) != EOF)
+  {
+    free(e);
+    e = NULL;
+  }
+
+  fclose(fp);
+
+  return (e);
+}
+
+
+/*
+ * 'cache_remove()' - Unlink an entry from the hash table and LRU list.
+ */
+
+static void
+cache_remove(tmc_cache_t   *c,		/* I - Cache */
+             cache_entry_t *e)		/* I - Entry */
+{
+  cache_entry_t	**bucket;		/* Pointer into hash bucket */
+
+
+  for (bucket = c->buckets + (e->key.h[0] & (CACHE_BUCKETS - 1));
+       *bucket != e;
+       bucket = &(*bucket)->chain);
+
+  *bucket = e->chain;
+
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    c->first = e->next;
+
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    c->last = e->prev;
+
+  c->bytes -= e->size;
+}
+
+
+/*
+ * 'cache_write()' - Save a band in the cache directory.
+ *
+ * The file is written under a temporary name and then renamed, so other
+ * jobs never see a partial file.
+ */
+
+static void
+cache_write(tmc_cache_t         *c,	/* I - Cache */
+            const tmc_hash_t    *key,	/* I - Hash of dithered band */
+	    const unsigned char **data,	/* I - Data for each pass */
+	    const int           *type,	/* I - Compression type of each pass */
+	    const int           *length)/* I - Length of each pass */
+{
+  char		filename[1024],		/* Cache file */
+		tempname[1100];		/* Temporary file */
+  FILE		*fp;			/* Cache file */
+  cache_file_t	header;			/* File header */
+  int		ok;			/* Written OK? */
+
+
+  snprintf(filename, sizeof(filename), "%s/%016llx%016llx.band", c->directory,
+           (unsigned long long)key->h[0], (unsigned long long)key->h[1]);
+
+  if (!access(filename, F_OK))
+    return;
+
+  snprintf(tempname, sizeof(tempname), "%s.%d.%p", filename, (int)getpid(),
+           (void *)data);
+
+  if ((fp = fopen(tempname, "wb")) == NULL)
+    return;
+
+  memset(&header, 0, sizeof(header));
+
+  header.magic     = CACHE_MAGIC;
+  header.version   = CACHE_VERSION;
+  header.key       = *key;
+  header.type[0]   = type[0];
+  header.type[1]   = type[1];
+  header.length[0] = length[0];
+  header.length[1] = length[1];
+
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+       fwrite(data[0], 1, length[0], fp) == (size_t)length[0] &&
+       fwrite(data[1], 1, length[1], fp) == (size_t)length[1];
+
+  if (fclose(fp) || !ok || rename(tempname, filename))
+    unlink(tempname);
+}
@@ -0,0 +1,57 @@
+/*
+ * Compressed band cache for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_CACHE_H_
+#  define _TMC6XX_CACHE_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+#  include <stdint.h>
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_hash_s		/**** 128-bit content hash ****/
+{
+  uint64_t	h[2];			/* Hash value */
+} tmc_hash_t;
+
+typedef struct tmc_cache_stats_s	/**** Cache counters ****/
+{
+  unsigned long		hits,		/* Bands found in the cache */
+			disk_hits,	/* ...of which were read from disk */
+			misses;		/* Bands not found */
+  unsigned long long	bytes_saved;	/* Bytes not packed and compressed */
+} tmc_cache_stats_t;
+
+typedef struct tmc_cache_s tmc_cache_t;	/**** Band cache ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcHashInit(tmc_hash_t *h);
+extern void		tmcHashUpdate(tmc_hash_t *h, const void *data,
+			              size_t length);
+
+extern tmc_cache_t	*tmcCacheNew(size_t max_bytes, const char *directory);
+extern void		tmcCacheDelete(tmc_cache_t *c);
+extern int		tmcCacheGet(tmc_cache_t *c, const tmc_hash_t *key,
+			            unsigned char **data, int *type,
+				    int *length, size_t saved);
+extern void		tmcCachePut(tmc_cache_t *c, const tmc_hash_t *key,
+			            const unsigned char **data,
+				    const int *type, const int *length);
+extern void		tmcCacheStats(tmc_cache_t *c, tmc_cache_stats_t *stats);
+
+#endif /* !_TMC6XX_CACHE_H_ */
@@ -0,0 +1,487 @@
+/*
+ * Unix socket transport for the TM-C6xx rendering daemon.
+ *
+ * A filter process hands its job to the daemon in one message: a small
+ * header, the job's arguments and settings as nul-terminated strings, and
+ * the raster, printer and log file descriptors attached with SCM_RIGHTS.
+ * The daemon prints straight to those descriptors and answers with the
+ * job's exit status, so no print data goes through the socket.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#define _GNU_SOURCE			/* struct ucred */
+#include "daemon.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+
+/*
+ * Constants...
+ */
+
+#define DAEMON_MAGIC		0x544d4331	/* "TMC1" */
+#define DAEMON_MAX_ARGS		(256 * 1024)
+					/* Largest argument block */
+
+
+/*
+ * Types...
+ */
+
+typedef struct daemon_header_s		/**** Job message header ****/
+{
+  unsigned	magic,			/* DAEMON_MAGIC */
+		num_args,		/* Number of strings */
+		length;			/* Bytes of strings */
+} daemon_header_t;
+
+
+/*
+ * Local functions...
+ */
+
+static int	read_all(int fd, void *buffer, size_t length);
+static int	set_address(struct sockaddr_un *addr, const char *path);
+static int	write_all(int fd, const void *buffer, size_t length);
+
+
+/*
+ * 'tmcDaemonAccept()' - Wait for a job connection.
+ *
+ * Only processes running as the same user may connect.  Returns -1 with
+ * errno set to ETIMEDOUT when nothing connects within "timeout" seconds.
+ */
+
+int					/* O - Connection or -1 */
+tmcDaemonAccept(int listener,		/* I - Listening socket */
+                int timeout)		/* I - Seconds to wait */
+{
+  struct pollfd	pfd;			/* Poll data */
+  int		sock;			/* Connection */
+#ifdef SO_PEERCRED
+  struct ucred	cred;			/* Peer credentials */
+  socklen_t	credlen = sizeof(cred);	/* Size of credentials */
+#endif /* SO_PEERCRED */
+
+
+  pfd.fd     = listener;
+  pfd.events = POLLIN;
+
+  switch (poll(&pfd, 1, timeout * 1000))
+  {
+    case -1 :
+        return (-1);
+
+    case 0 :
+        errno = ETIMEDOUT;
+        return (-1);
+  }
+
+  if ((sock = accept(listener, NULL, NULL)) < 0)
+    return (-1);
+
+#ifdef SO_PEERCRED
+  if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) ||
+      cred.uid != getuid())
+  {
+    close(sock);
+    errno = EPERM;
+    return (-1);
+  }
+#endif /* SO_PEERCRED */
+
+  return (sock);
+}
+
+
+/*
+ * 'tmcDaemonConnect()' - Connect to a daemon.
+ *
+ * The job's descriptors go to whoever answers, so a daemon running as
+ * another user is refused with EPERM.
+ */
+
+int					/* O - Connection or -1 */
+tmcDaemonConnect(const char *path)	/* I - Socket path */
+{
+  struct sockaddr_un	addr;		/* Socket address */
+  int			sock;		/* Connection */
+#ifdef SO_PEERCRED
+  struct ucred		cred;		/* Peer credentials */
+  socklen_t		credlen = sizeof(cred);
+					/* Size of credentials */
+#endif /* SO_PEERCRED */
+
+
+  if (set_address(&addr, path))
+    return (-1);
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return (-1);
+
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    close(sock);
+    return (-1);
+  }
+
+#ifdef SO_PEERCRED
+  if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) ||
+      cred.uid != getuid())
+  {
+    close(sock);
+    errno = EPERM;
+    return (-1);
+  }
+#endif /* SO_PEERCRED */
+
+  return (sock);
+}
+
+
+/*
+ * 'tmcDaemonListen()' - Create the daemon's listening socket.
+ *
+ * Fails with EADDRINUSE when another daemon already answers on the path;
+ * a socket file left by a daemon that has gone away is replaced.
+ */
+
+int					/* O - Listening socket or -1 */
+tmcDaemonListen(const char *path)	/* I - Socket path */
+{
+  struct sockaddr_un	addr;		/* Socket address */
+  int			sock;		/* Listening socket */
+  mode_t		mask;		/* Old umask */
+
+
+  if (set_address(&addr, path))
+    return (-1);
+
+  if ((sock = tmcDaemonConnect(path)) >= 0 || errno == EPERM)
+  {
+    if (sock >= 0)
+      close(sock);
+
+    errno = EADDRINUSE;
+    return (-1);
+  }
+
+  unlink(path);
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return (-1);
+
+  mask = umask(077);
+
+  if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 8))
+  {
+    umask(mask);
+    close(sock);
+    return (-1);
+  }
+
+  umask(mask);
+
+  return (sock);
+}
+
+
+/*
+ * 'tmcDaemonReceive()' - Receive a job.
+ *
+ * "args" is a single allocation holding the array and the strings, for the
+ * caller to free().
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcDaemonReceive(
+    int  sock,				/* I - Connection */
+    int  *num_args,			/* O - Number of strings */
+    char ***args,			/* O - Strings */
+    int  fds[TMC_DAEMON_FDS])		/* O - Raster, printer, log */
+{
+  daemon_header_t	header;		/* Message header */
+  struct msghdr		msg;		/* Message */
+  struct iovec		iov;		/* Header buffer */
+  struct cmsghdr	*cmsg;		/* Control message */
+  union
+  {
+    struct cmsghdr	align;		/* Alignment */
+    char		buf[CMSG_SPACE(TMC_DAEMON_FDS * sizeof(int))];
+  }			control;	/* Control buffer */
+  char			**list,		/* Strings */
+			*ptr,		/* Pointer into strings */
+			*end;		/* End of strings */
+  int			i,		/* Looping var */
+			count = 0;	/* Descriptors received */
+
+
+  iov.iov_base = &header;
+  iov.iov_len  = sizeof(header);
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(header))
+    return (-1);
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+      count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+
+      if (count > TMC_DAEMON_FDS)
+        count = TMC_DAEMON_FDS;
+
+      memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+      break;
+    }
+
+  if (count != TMC_DAEMON_FDS || (msg.msg_flags & MSG_CTRUNC) ||
+      header.magic != DAEMON_MAGIC || header.num_args == 0 ||
+      header.length > DAEMON_MAX_ARGS ||
+      (list = malloc((header.num_args + 1) * sizeof(char *) +
+                     header.length + 1)) == NULL)
+  {
+    for (i = 0; i < count; i ++)
+      close(fds[i]);
+
+    return (-1);
+  }
+
+ /*
+  * Read the strings after the array and check that there are as many as
+  * the header says...
+  */
+
+  ptr = (char *)(list + header.num_args + 1);
+  end = ptr + header.length;
+
+  if (read_all(sock, ptr, header.length))
+    header.num_args = 0;
+
+  *end = '\0';
+
+  for (i = 0; i < (int)header.num_args && ptr < end; i ++)
+  {
+    list[i] = ptr;
+    ptr     += strlen(ptr) + 1;
+  }
+
+  if (i == 0 || i != (int)header.num_args || ptr != end)
+  {
+    free(list);
+
+    for (i = 0; i < count; i ++)
+      close(fds[i]);
+
+    return (-1);
+  }
+
+  list[i] = NULL;
+
+  *num_args = i;
+  *args     = list;
+
+  return (0);
+}
+
+
+/*
+ * 'tmcDaemonReply()' - Send a job's exit status.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcDaemonReply(int sock,		/* I - Connection */
+               int status)		/* I - Exit status */
+{
+  return (send(sock, &status, sizeof(status), MSG_NOSIGNAL) ==
+              (ssize_t)sizeof(status) ? 0 : -1);
+}
+
+
+/*
+ * 'tmcDaemonSend()' - Send a job to a daemon.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcDaemonSend(
+    int               sock,		/* I - Connection */
+    int               num_args,		/* I - Number of strings */
+    const char * const *args,		/* I - Strings */
+    const int         fds[TMC_DAEMON_FDS])
+					/* I - Raster, printer, log */
+{
+  daemon_header_t	header;		/* Message header */
+  struct msghdr		msg;		/* Message */
+  struct iovec		iov;		/* Header buffer */
+  struct cmsghdr	*cmsg;		/* Control message */
+  union
+  {
+    struct cmsghdr	align;		/* Alignment */
+    char		buf[CMSG_SPACE(TMC_DAEMON_FDS * sizeof(int))];
+  }			control;	/* Control buffer */
+  char			*block,		/* Strings */
+			*ptr;		/* Pointer into strings */
+  size_t		length;		/* Bytes of strings */
+  int			i,		/* Looping var */
+			status;		/* Send status */
+
+
+  for (i = 0, length = 0; i < num_args; i ++)
+    length += strlen(args[i]) + 1;
+
+  if (length > DAEMON_MAX_ARGS || (block = malloc(length)) == NULL)
+    return (-1);
+
+  for (i = 0, ptr = block; i < num_args; i ++)
+  {
+    strcpy(ptr, args[i]);
+    ptr += strlen(ptr) + 1;
+  }
+
+  header.magic    = DAEMON_MAGIC;
+  header.num_args = (unsigned)num_args;
+  header.length   = (unsigned)length;
+
+  iov.iov_base = &header;
+  iov.iov_len  = sizeof(header);
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov        = &iov;
+  msg.msg_iovlen     = 1;
+  msg.msg_control    = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg             = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type  = SCM_RIGHTS;
+  cmsg->cmsg_len   = CMSG_LEN(TMC_DAEMON_FDS * sizeof(int));
+
+  memcpy(CMSG_DATA(cmsg), fds, TMC_DAEMON_FDS * sizeof(int));
+
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(header))
+    status = -1;
+  else
+    status = write_all(sock, block, length);
+
+  free(block);
+
+  return (status);
+}
+
+
+/*
+ * 'tmcDaemonWait()' - Wait for a job's exit status.
+ */
+
+int					/* O - Exit status or -1 on error */
+tmcDaemonWait(int sock)			/* I - Connection */
+{
+  int	status;				/* Exit status */
+
+
+  if (read_all(sock, &status, sizeof(status)) || status < 0)
+    return (-1);
+
+  return (status);
+}
+
+
+/*
+ * 'read_all()' - Read an exact number of bytes.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+read_all(int    fd,			/* I - File descriptor */
+         void   *buffer,		/* O - Bytes */
+	 size_t length)			/* I - Number of bytes */
+{
+  char		*ptr = (char *)buffer;	/* Pointer into buffer */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  while (length > 0)
+  {
+    if ((bytes = read(fd, ptr, length)) < 0 && errno == EINTR)
+      continue;
+
+    if (bytes <= 0)
+      return (-1);
+
+    ptr    += bytes;
+    length -= (size_t)bytes;
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'set_address()' - Fill in a Unix socket address.
+ */
+
+static int				/* O - 0 on success, -1 if too long */
+set_address(struct sockaddr_un *addr,	/* O - Socket address */
+            const char         *path)	/* I - Socket path */
+{
+  memset(addr, 0, sizeof(struct sockaddr_un));
+
+  addr->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr->sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return (-1);
+  }
+
+  strcpy(addr->sun_path, path);
+
+  return (0);
+}
+
+
+/*
+ * 'write_all()' - Write an exact number of bytes.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+write_all(int        fd,		/* I - File descriptor */
+          const void *buffer,		/* I - Bytes */
+	  size_t     length)		/* I - Number of bytes */
+{
+  const char	*ptr = (const char *)buffer;
+					/* Pointer into buffer */
+  ssize_t	bytes;			/* Bytes written */
+
+
+  while (length > 0)
+  {
+    if ((bytes = send(fd, ptr, length, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+      continue;
+
+    if (bytes <= 0)
+      return (-1);
+
+    ptr    += bytes;
+    length -= (size_t)bytes;
+  }
+
+  return (0);
+}
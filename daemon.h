@@ -0,0 +1,32 @@
+/*
+ * Unix socket transport for the TM-C6xx rendering daemon.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_DAEMON_H_
+#  define _TMC6XX_DAEMON_H_
+
+/*
+ * Constants...
+ */
+
+#  define TMC_DAEMON_FDS	3	/* Raster, printer and log descriptors */
+
+
+/*
+ * Prototypes...
+ */
+
+extern int	tmcDaemonAccept(int listener, int timeout);
+extern int	tmcDaemonConnect(const char *path);
+extern int	tmcDaemonListen(const char *path);
+extern int	tmcDaemonReceive(int sock, int *num_args, char ***args,
+		                 int fds[TMC_DAEMON_FDS]);
+extern int	tmcDaemonReply(int sock, int status);
+extern int	tmcDaemonSend(int sock, int num_args, const char * const *args,
+		              const int fds[TMC_DAEMON_FDS]);
+extern int	tmcDaemonWait(int sock);
+
+#endif /* !_TMC6XX_DAEMON_H_ */
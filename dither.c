@@ -0,0 +1,482 @@
+/*
+ * Native error diffusion for the TM-C6xx filter.
+ *
+ * cupsDitherLine() draws random numbers from the process-wide rand()
+ * sequence, so its output depends on the order in which the planes are
+ * dithered.  This is a plain Floyd-Steinberg diffusion using the same
+ * lookup tables and the same handling of blank pixels, but with no shared
+ * state between planes: each plane can be dithered on its own thread and
+ * the result is the same as dithering them one after another.
+ *
+ * Within a plane, each pixel only needs the error from the pixels before it
+ * on its own line and from the three pixels around it on the line above,
+ * so a band of lines can also be dithered as a wavefront: each line runs a
+ * few pixels behind the one above it, on its own thread.  Every pixel still
+ * receives the same error as in a single sweep, so the dots are the same.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "dither.h"
+#include <sched.h>
+
+
+/*
+ * Local constants...
+ */
+
+#define DITHER_CHUNK	64		/* Pixels between wavefront updates */
+
+
+/*
+ * Local functions...
+ */
+
+static void	dither_rgb_span(int **cur, int **next, cups_lut_t **lut,
+		                short (*sep)[256], const unsigned char *rgb,
+				unsigned char **p, int x0, int x1);
+static void	wavefront_wait(tmc_dither_t *d, int i, int x);
+
+
+/*
+ * 'tmcDitherNew()' - Create an error diffusion state for a line width.
+ */
+
+tmc_dither_t *				/* O - New state or NULL */
+tmcDitherNew(int width)			/* I - Width of line in pixels */
+{
+  tmc_dither_t	*d;			/* New state */
+
+
+  if (width < 1)
+    return (NULL);
+
+  if ((d = calloc(1, sizeof(tmc_dither_t))) == NULL)
+    return (NULL);
+
+ /*
+  * Two error lines, each with a guard pixel on either side...
+  */
+
+  if ((d->errors = calloc(2 * (width + 2), sizeof(int))) == NULL)
+  {
+    free(d);
+    return (NULL);
+  }
+
+  d->width = width;
+
+  return (d);
+}
+
+
+/*
+ * 'tmcDitherDelete()' - Free an error diffusion state.
+ */
+
+void
+tmcDitherDelete(tmc_dither_t *d)	/* I - State */
+{
+  if (!d)
+    return;
+
+  free(d->errors);
+  free(d->lines);
+  free(d->progress);
+  free(d);
+}
+
+
+/*
+ * 'tmcDitherReset()' - Clear the error state for a new page.
+ */
+
+void
+tmcDitherReset(tmc_dither_t *d)		/* I - State */
+{
+  d->row = 0;
+
+  memset(d->errors, 0, 2 * (d->width + 2) * sizeof(int));
+}
+
+
+/*
+ * 'tmcDitherSkip()' - Advance past blank lines.
+ *
+ * This leaves the same state as dithering "rows" lines of blank pixels:
+ * blank pixels drop their error, so one blank line clears the error for
+ * the line after it and two clear everything.
+ */
+
+void
+tmcDitherSkip(tmc_dither_t *d,		/* I - State */
+              int          rows)	/* I - Number of blank lines */
+{
+  if (rows <= 0)
+    return;
+
+  if (rows == 1)
+    memset(d->errors + (~d->row & 1) * (d->width + 2), 0,
+           (d->width + 2) * sizeof(int));
+  else
+    memset(d->errors, 0, 2 * (d->width + 2) * sizeof(int));
+
+  d->row += rows;
+}
+
+
+/*
+ * 'dither_pixel()' - Diffuse the error for one pixel and return its dot.
+ */
+
+static inline int			/* O - Dot value */
+dither_pixel(int              value,	/* I - Separated value */
+             const cups_lut_t *lut,	/* I - Lookup table */
+	     int              *cur,	/* I - Errors for this line */
+	     int              *next,	/* I - Errors for the next line */
+	     int              x)	/* I - Current column */
+{
+  int		pixel,			/* Adjusted pixel value */
+		e;			/* Quantization error */
+
+
+ /*
+  * Blank pixels stay blank and drop any error they received...
+  */
+
+  if (value == 0)
+    return (0);
+
+  pixel = lut[value].intensity + cur[x] / 16;
+
+  if (pixel > CUPS_MAX_LUT)
+    pixel = CUPS_MAX_LUT;
+  else if (pixel < 0)
+    pixel = 0;
+
+  e = lut[pixel].error;
+
+  cur[x + 1]  += 7 * e;
+  next[x - 1] += 3 * e;
+  next[x]     += 5 * e;
+  next[x + 1] += e;
+
+  return (lut[pixel].pixel);
+}
+
+
+/*
+ * 'tmcDitherLine()' - Dither a line of separated pixels.
+ */
+
+void
+tmcDitherLine(tmc_dither_t     *d,	/* I - State */
+              const cups_lut_t *lut,	/* I - Lookup table */
+              const short      *data,	/* I - Separation data */
+              int              num_channels,
+					/* I - Number of components */
+              unsigned char    *p)	/* O - Pixels */
+{
+  int		x;			/* Current column */
+  int		*cur,			/* Errors for this line */
+		*next;			/* Errors for the next line */
+
+
+  cur  = d->errors + (d->row & 1) * (d->width + 2) + 1;
+  next = d->errors + (~d->row & 1) * (d->width + 2) + 1;
+
+  memset(next - 1, 0, (d->width + 2) * sizeof(int));
+
+  for (x = 0; x < d->width; x ++, data += num_channels)
+    p[x] = dither_pixel(*data, lut, cur, next, x);
+
+  d->row ++;
+}
+
+
+/*
+ * 'tmcDitherRGB()' - Separate, dither and pack a line of 8-bit RGB pixels.
+ *
+ * This is the same as running the separation, tmcDitherLine() for each of
+ * the three planes and cupsPackHorizontal2(), but in a single pass over the
+ * line.  "sep" holds the separated value of each 8-bit component for each
+ * plane, which is only valid when the separation treats the components
+ * independently.
+ */
+
+void
+tmcDitherRGB(tmc_dither_t        **d,	/* I - States for C, M and Y */
+             cups_lut_t          **lut,	/* I - Lookup tables */
+	     short               (*sep)[256],
+					/* I - Separation tables */
+	     const unsigned char *rgb,	/* I - RGB pixels */
+	     unsigned char       **p)	/* O - Packed 2-bit dots */
+{
+  int		plane,			/* Current plane */
+		width;			/* Width of line */
+  int		*cur[3],		/* Errors for this line */
+		*next[3];		/* Errors for the next line */
+
+
+  width = d[0]->width;
+
+  for (plane = 0; plane < 3; plane ++)
+  {
+    cur[plane]  = d[plane]->errors + (d[plane]->row & 1) * (width + 2) + 1;
+    next[plane] = d[plane]->errors + (~d[plane]->row & 1) * (width + 2) + 1;
+
+    memset(next[plane] - 1, 0, (width + 2) * sizeof(int));
+  }
+
+  dither_rgb_span(cur, next, lut, sep, rgb, p, 0, width);
+
+  for (plane = 0; plane < 3; plane ++)
+    d[plane]->row ++;
+}
+
+
+/*
+ * 'tmcDitherBegin()' - Start dithering a batch of lines as a wavefront.
+ *
+ * The lines are then dithered with tmcDitherRow() or tmcDitherRGBRow(),
+ * numbered from 0, on any threads; each one waits for the line above it to
+ * get far enough ahead, so a line must not be started before the line
+ * above it.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcDitherBegin(tmc_dither_t *d,		/* I - State */
+               int          rows)	/* I - Number of lines */
+{
+  int	*lines,				/* New error lines */
+	*progress;			/* New progress counters */
+
+
+  if (rows + 1 > d->num_lines)
+  {
+    if ((lines = realloc(d->lines, (rows + 1) * (d->width + 2) *
+                                   sizeof(int))) == NULL)
+      return (-1);
+
+    d->lines = lines;
+
+    if ((progress = realloc(d->progress, rows * sizeof(int))) == NULL)
+      return (-1);
+
+    d->progress  = progress;
+    d->num_lines = rows + 1;
+  }
+
+  memcpy(d->lines, d->errors + (d->row & 1) * (d->width + 2),
+         (d->width + 2) * sizeof(int));
+  memset(d->progress, 0, rows * sizeof(int));
+
+  return (0);
+}
+
+
+/*
+ * 'tmcDitherEnd()' - Finish a wavefront, leaving the state as if the lines
+ *                    had been dithered one at a time.
+ */
+
+void
+tmcDitherEnd(tmc_dither_t *d,		/* I - State */
+             int          rows)		/* I - Number of lines */
+{
+  d->row += rows;
+
+  memcpy(d->errors + (d->row & 1) * (d->width + 2),
+         d->lines + rows * (d->width + 2), (d->width + 2) * sizeof(int));
+}
+
+
+/*
+ * 'tmcDitherRow()' - Dither line "i" of a wavefront.
+ *
+ * A NULL "data" is a blank line, the same as tmcDitherSkip().
+ */
+
+void
+tmcDitherRow(tmc_dither_t     *d,	/* I - State */
+             int              i,	/* I - Line in wavefront */
+             const cups_lut_t *lut,	/* I - Lookup table */
+             const short      *data,	/* I - Separation data or NULL */
+             int              num_channels,
+					/* I - Number of components */
+             unsigned char    *p)	/* O - Pixels */
+{
+  int		x, x0, x1;		/* Current column and chunk */
+  int		*cur,			/* Errors for this line */
+		*next;			/* Errors for the next line */
+
+
+  cur  = d->lines + i * (d->width + 2) + 1;
+  next = cur + d->width + 2;
+
+  memset(next - 1, 0, (d->width + 2) * sizeof(int));
+
+  if (!data)
+  {
+    memset(p, 0, d->width);
+    __atomic_store_n(d->progress + i, d->width, __ATOMIC_RELEASE);
+    return;
+  }
+
+  for (x0 = 0; x0 < d->width; x0 = x1)
+  {
+    x1 = x0 + DITHER_CHUNK < d->width ? x0 + DITHER_CHUNK : d->width;
+
+    wavefront_wait(d, i, x1);
+
+    for (x = x0; x < x1; x ++, data += num_channels)
+      p[x] = dither_pixel(*data, lut, cur, next, x);
+
+    __atomic_store_n(d->progress + i, x1, __ATOMIC_RELEASE);
+  }
+}
+
+
+/*
+ * 'tmcDitherRGBRow()' - Separate, dither and pack line "i" of a wavefront.
+ *
+ * All three states must have been started with tmcDitherBegin(); the first
+ * one tracks the progress of the line.  A NULL "rgb" is a blank line.
+ */
+
+void
+tmcDitherRGBRow(tmc_dither_t        **d,/* I - States for C, M and Y */
+                int                 i,	/* I - Line in wavefront */
+                cups_lut_t          **lut,
+					/* I - Lookup tables */
+	        short               (*sep)[256],
+					/* I - Separation tables */
+	        const unsigned char *rgb,
+					/* I - RGB pixels or NULL */
+	        unsigned char       **p)/* O - Packed 2-bit dots */
+{
+  int		plane,			/* Current plane */
+		width,			/* Width of line */
+		x0, x1;			/* Current chunk */
+  int		*cur[3],		/* Errors for this line */
+		*next[3];		/* Errors for the next line */
+
+
+  width = d[0]->width;
+
+  for (plane = 0; plane < 3; plane ++)
+  {
+    cur[plane]  = d[plane]->lines + i * (width + 2) + 1;
+    next[plane] = cur[plane] + width + 2;
+
+    memset(next[plane] - 1, 0, (width + 2) * sizeof(int));
+  }
+
+  if (!rgb)
+  {
+    for (plane = 0; plane < 3; plane ++)
+      memset(p[plane], 0, (width + 3) / 4);
+
+    __atomic_store_n(d[0]->progress + i, width, __ATOMIC_RELEASE);
+    return;
+  }
+
+  for (x0 = 0; x0 < width; x0 = x1)
+  {
+    x1 = x0 + DITHER_CHUNK < width ? x0 + DITHER_CHUNK : width;
+
+    wavefront_wait(d[0], i, x1);
+    dither_rgb_span(cur, next, lut, sep, rgb, p, x0, x1);
+    __atomic_store_n(d[0]->progress + i, x1, __ATOMIC_RELEASE);
+  }
+}
+
+
+/*
+ * 'dither_rgb_span()' - Separate, dither and pack part of an RGB line.
+ *
+ * "x0" must be a multiple of 4, as must "x1" unless it is the end of the
+ * line.
+ */
+
+static void
+dither_rgb_span(int                 **cur,
+					/* I - Errors for this line */
+                int                 **next,
+					/* I - Errors for the next line */
+                cups_lut_t          **lut,
+					/* I - Lookup tables */
+	        short               (*sep)[256],
+					/* I - Separation tables */
+	        const unsigned char *rgb,
+					/* I - RGB line */
+	        unsigned char       **p,/* O - Packed 2-bit dots */
+		int                 x0,	/* I - First column */
+		int                 x1)	/* I - Column after last */
+{
+  int		x, i,			/* Current column */
+		plane;			/* Current plane */
+  unsigned	b0, b1, b2;		/* Bytes being packed */
+  unsigned char	tail[3][3];		/* Dots left over at the end */
+
+
+  rgb += 3 * x0;
+
+  for (x = x0; x + 4 <= x1; x += 4)
+  {
+    b0 = b1 = b2 = 0;
+
+    for (i = 0; i < 4; i ++, rgb += 3)
+    {
+      b0 = (b0 << 2) | dither_pixel(sep[0][rgb[0]], lut[0], cur[0], next[0], x + i);
+      b1 = (b1 << 2) | dither_pixel(sep[1][rgb[1]], lut[1], cur[1], next[1], x + i);
+      b2 = (b2 << 2) | dither_pixel(sep[2][rgb[2]], lut[2], cur[2], next[2], x + i);
+    }
+
+    p[0][x / 4] = b0;
+    p[1][x / 4] = b1;
+    p[2][x / 4] = b2;
+  }
+
+  if (x < x1)
+  {
+    for (i = 0; x + i < x1; i ++, rgb += 3)
+      for (plane = 0; plane < 3; plane ++)
+        tail[plane][i] = dither_pixel(sep[plane][rgb[plane]], lut[plane],
+	                              cur[plane], next[plane], x + i);
+
+    for (plane = 0; plane < 3; plane ++)
+      cupsPackHorizontal2(tail[plane], p[plane] + x / 4, x1 - x, 1);
+  }
+}
+
+
+/*
+ * 'wavefront_wait()' - Wait for the line above to get ahead of a chunk.
+ *
+ * The pixels up to "x" need the error from the line above up to "x + 1",
+ * and the line above must be past "x + 1" before this line adds error at
+ * "x" to the same error line, so it has to have finished "x + 2" pixels.
+ */
+
+static void
+wavefront_wait(tmc_dither_t *d,		/* I - State */
+               int          i,		/* I - Line in wavefront */
+	       int          x)		/* I - End of chunk */
+{
+  int	need;				/* Pixels needed in line above */
+
+
+  if (i == 0)
+    return;
+
+  need = x + 2 < d->width ? x + 2 : d->width;
+
+  while (__atomic_load_n(d->progress + i - 1, __ATOMIC_ACQUIRE) < need)
+    sched_yield();
+}
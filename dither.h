@@ -0,0 +1,58 @@
+/*
+ * Native error diffusion for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_DITHER_H_
+#  define _TMC6XX_DITHER_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <cupsfilters/driver.h>
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_dither_s		/**** Error diffusion state ****/
+{
+  int		width,			/* Width of line */
+		row;			/* Current row */
+  int		*errors;		/* Error lines */
+  int		num_lines;		/* Number of wavefront error lines */
+  int		*lines,			/* Wavefront error lines */
+		*progress;		/* Pixels done in each wavefront row */
+} tmc_dither_t;
+
+
+/*
+ * Prototypes...
+ */
+
+extern tmc_dither_t	*tmcDitherNew(int width);
+extern void		tmcDitherDelete(tmc_dither_t *d);
+extern void		tmcDitherReset(tmc_dither_t *d);
+extern void		tmcDitherSkip(tmc_dither_t *d, int rows);
+extern void		tmcDitherLine(tmc_dither_t *d, const cups_lut_t *lut,
+			              const short *data, int num_channels,
+				      unsigned char *p);
+extern void		tmcDitherRGB(tmc_dither_t **d, cups_lut_t **lut,
+			             short (*sep)[256],
+				     const unsigned char *rgb,
+				     unsigned char **p);
+extern int		tmcDitherBegin(tmc_dither_t *d, int rows);
+extern void		tmcDitherEnd(tmc_dither_t *d, int rows);
+extern void		tmcDitherRow(tmc_dither_t *d, int i,
+			             const cups_lut_t *lut, const short *data,
+				     int num_channels, unsigned char *p);
+extern void		tmcDitherRGBRow(tmc_dither_t **d, int i,
+			                cups_lut_t **lut, short (*sep)[256],
+					const unsigned char *rgb,
+					unsigned char **p);
+
+#endif /* !_TMC6XX_DITHER_H_ */
@@ -0,0 +1,330 @@
+/*
+ * Benchmark harness for the TM-C6xx filter.
+ *
+ * Usage:
+ *
+ *   filter-bench [-f filter] [-p ppd] [-i iterations] [-o options]
+ *                [-r results] file.ras [... file.ras]
+ *
+ * Runs the filter the way the CUPS scheduler would, with the printer output
+ * going to /dev/null, and reports pages per second, raster MB/s in, bytes
+ * out, peak RSS and the filter's own stage times and counters (from its
+ * TMC6XX_STATS report).  Every run is also appended to the results file as
+ * one JSON object per line.  With more than one iteration it also reports
+ * the minimum, median and maximum time per job for each file, which shows
+ * the startup a resident filter (TMCDaemon) saves after the first job.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+
+/*
+ * Types...
+ */
+
+typedef struct result_s			/**** Results of one run ****/
+{
+  int		pages;			/* Pages printed */
+  unsigned long	bytes_out;		/* Bytes sent to the printer */
+  long		max_rss;		/* Peak RSS in KiB */
+  double	elapsed;		/* Wall clock seconds */
+  char		stats[2048];		/* Filter stats as a JSON object */
+} result_t;
+
+
+/*
+ * Local functions...
+ */
+
+static int	compare_times(const void *a, const void *b);
+static double	get_time(void);
+static int	run_filter(const char *filter, const char *ppd,
+		           const char *options, const char *filename,
+			   result_t *result);
+
+
+/*
+ * 'main()' - Run the benchmark.
+ */
+
+int					/* O - Exit status */
+main(int  argc,				/* I - Number of command-line args */
+     char *argv[])			/* I - Command-line arguments */
+{
+  int		i,			/* Looping var */
+		iter,			/* Current iteration */
+		iterations = 1;		/* Number of iterations */
+  const char	*filter = "./rastertotmc6xx",
+					/* Filter to run */
+		*ppd = "ppd/ep_tmc610.ppd",
+					/* PPD file */
+		*options = "",		/* Job options */
+		*results = NULL;	/* Results file */
+  FILE		*fp = NULL;		/* Results file */
+  struct stat	info;			/* Raster file information */
+  result_t	result;			/* Results of one run */
+  double	mbytes;			/* Raster MB */
+  double	*times;			/* Time of each iteration */
+  int		status = 0;		/* Exit status */
+
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i ++)
+    if (!strcmp(argv[i], "-f") && i + 1 < argc)
+      filter = argv[++ i];
+    else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+      ppd = argv[++ i];
+    else if (!strcmp(argv[i], "-i") && i + 1 < argc)
+      iterations = atoi(argv[++ i]);
+    else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+      options = argv[++ i];
+    else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+      results = argv[++ i];
+    else
+      break;
+
+  if (i >= argc || iterations < 1)
+  {
+    fputs("Usage: filter-bench [-f filter] [-p ppd] [-i iterations] "
+          "[-o options] [-r results] file.ras [... file.ras]\n", stderr);
+    return (1);
+  }
+
+  if ((times = calloc((size_t)iterations, sizeof(double))) == NULL)
+  {
+    perror("filter-bench");
+    return (1);
+  }
+
+  if (results && (fp = fopen(results, "a")) == NULL)
+  {
+    perror(results);
+    free(times);
+    return (1);
+  }
+
+  for (; i < argc; i ++)
+  {
+    if (stat(argv[i], &info))
+    {
+      perror(argv[i]);
+      status = 1;
+      continue;
+    }
+
+    mbytes = info.st_size / 1048576.0;
+
+    for (iter = 0; iter < iterations; iter ++)
+    {
+      if (run_filter(filter, ppd, options, argv[i], &result))
+      {
+        status = 1;
+	break;
+      }
+
+      printf("%s: %d pages in %.3fs, %.1f pages/s, %.1f MB/s in, "
+             "%lu bytes out, %ld KiB peak RSS\n", argv[i], result.pages,
+	     result.elapsed, result.pages / result.elapsed,
+	     mbytes / result.elapsed, result.bytes_out, result.max_rss);
+      if (result.stats[0])
+        printf("    %s\n", result.stats);
+
+      if (fp)
+        fprintf(fp, "{\"file\":\"%s\",\"options\":\"%s\",\"iteration\":%d,"
+	            "\"pages\":%d,\"seconds\":%.6f,\"pages_per_sec\":%.3f,"
+		    "\"mb_per_sec_in\":%.3f,\"bytes_in\":%lld,"
+		    "\"bytes_out\":%lu,\"max_rss_kb\":%ld,\"filter\":%s}\n",
+		argv[i], options, iter, result.pages, result.elapsed,
+		result.pages / result.elapsed, mbytes / result.elapsed,
+		(long long)info.st_size, result.bytes_out, result.max_rss,
+		result.stats[0] ? result.stats : "null");
+
+      times[iter] = result.elapsed;
+    }
+
+   /*
+    * Summarize the time per job...
+    */
+
+    if (iter == iterations && iterations > 1)
+    {
+      qsort(times, (size_t)iterations, sizeof(double), compare_times);
+
+      printf("%s: %d jobs, %.1fms min, %.1fms median, %.1fms max per job\n",
+             argv[i], iterations, 1000.0 * times[0],
+	     1000.0 * times[iterations / 2], 1000.0 * times[iterations - 1]);
+    }
+  }
+
+  if (fp)
+    fclose(fp);
+
+  free(times);
+
+  return (status);
+}
+
+
+/*
+ * 'compare_times()' - Compare two job times for qsort().
+ */
+
+static int				/* O - Result of comparison */
+compare_times(const void *a,		/* I - First time */
+              const void *b)		/* I - Second time */
+{
+  double	ta = *(const double *)a,/* First time */
+		tb = *(const double *)b;/* Second time */
+
+
+  return (ta < tb ? -1 : ta > tb);
+}
+
+
+/*
+ * 'get_time()' - Get the current time in seconds.
+ */
+
+static double				/* O - Time in seconds */
+get_time(void)
+{
+  struct timespec	ts;		/* Current time */
+
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec + ts.tv_nsec * 0.000000001);
+}
+
+
+/*
+ * 'run_filter()' - Run the filter on a raster file.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+run_filter(const char *filter,		/* I - Filter to run */
+           const char *ppd,		/* I - PPD file */
+	   const char *options,		/* I - Job options */
+	   const char *filename,	/* I - Raster file */
+	   result_t   *result)		/* O - Results */
+{
+  int		fds[2];			/* Pipe for stderr */
+  pid_t		pid;			/* Filter process */
+  int		status;			/* Exit status */
+  struct rusage	usage;			/* Resource usage */
+  FILE		*fp;			/* stderr of filter */
+  char		line[4096],		/* Line from stderr */
+		*ptr;			/* Pointer into line */
+  double	start;			/* Start time */
+  unsigned long	bytes;			/* Bytes in one report */
+
+
+  memset(result, 0, sizeof(result_t));
+
+  if (pipe(fds))
+  {
+    perror("filter-bench");
+    return (-1);
+  }
+
+  start = get_time();
+
+  if ((pid = fork()) < 0)
+  {
+    perror("filter-bench");
+    close(fds[0]);
+    close(fds[1]);
+    return (-1);
+  }
+  else if (pid == 0)
+  {
+    int	fd;				/* /dev/null */
+
+
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0)
+    {
+      dup2(fd, 1);
+      close(fd);
+    }
+
+    dup2(fds[1], 2);
+    close(fds[0]);
+    close(fds[1]);
+
+    setenv("PPD", ppd, 1);
+    setenv("TMC6XX_STATS", "1", 1);
+
+    execl(filter, filter, "1", "bench", "bench", "1", options, filename,
+          (char *)NULL);
+    perror(filter);
+    _exit(1);
+  }
+
+  close(fds[1]);
+
+ /*
+  * Collect the page count, output bytes and filter stats from the log...
+  */
+
+  if ((fp = fdopen(fds[0], "r")) == NULL)
+  {
+    perror("filter-bench");
+    close(fds[0]);
+    kill(pid, SIGTERM);
+    wait4(pid, &status, 0, &usage);
+    return (-1);
+  }
+
+  while (fgets(line, sizeof(line), fp))
+  {
+    if (!strncmp(line, "PAGE: ", 6))
+      result->pages ++;
+    else if ((ptr = strstr(line, "output = ")) != NULL &&
+             sscanf(ptr + 9, "%lu", &bytes) == 1)
+      result->bytes_out += bytes;
+    else if ((ptr = strstr(line, "tmc6xx-stats ")) != NULL)
+    {
+      strncpy(result->stats, ptr + 13, sizeof(result->stats) - 1);
+      if ((ptr = strchr(result->stats, '\n')) != NULL)
+        *ptr = '\0';
+    }
+    else if (!strncmp(line, "ERROR: ", 7))
+      fprintf(stderr, "%s: %s", filename, line + 7);
+  }
+
+  fclose(fp);
+
+  if (wait4(pid, &status, 0, &usage) < 0)
+  {
+    perror("filter-bench");
+    return (-1);
+  }
+
+  result->elapsed = get_time() - start;
+  result->max_rss = usage.ru_maxrss;
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+  {
+    fprintf(stderr, "%s: %s failed with status %d\n", filename, filter,
+            status);
+    return (-1);
+  }
+
+  return (0);
+}
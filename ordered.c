@@ -0,0 +1,574 @@
+/*
+ * Threshold-matrix (ordered) dithering for the TM-C6xx filter.
+ *
+ * Each pixel is compared against a fixed threshold for its position on the
+ * page instead of receiving error from its neighbours, so every line (and
+ * every band) can be dithered on its own, in any order, and the same input
+ * always gives the same dots.  Solid areas land exactly on a dot level and
+ * get no dither at all, which keeps barcode and text edges sharp.
+ *
+ * tmcOrderedNew() turns a dither lookup table into a table of codes: the
+ * level below each separated value in the high byte and the fraction of
+ * the way to the next level in the low byte.  Adding a threshold from 0 to
+ * 255 then carries into the next level for that fraction of the matrix, so
+ * a whole line is dithered with one 16-bit add and shift per dot, which is
+ * done 16 or 32 dots at a time with vector instructions.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "ordered.h"
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define HAVE_X86_SIMD 1
+#  include <immintrin.h>
+#endif /* __GNUC__ && (__x86_64__ || __i386__) */
+
+
+/*
+ * Local constants...
+ */
+
+#define ORDERED_CELLS	(TMC_ORDERED_SIZE * TMC_ORDERED_SIZE)
+#define BLUENOISE_SIZE	32		/* Width and height of blue-noise mask */
+#define BLUENOISE_CELLS	(BLUENOISE_SIZE * BLUENOISE_SIZE)
+#define BLUENOISE_RADIUS 5		/* Radius of void-and-cluster filter */
+
+
+/*
+ * Local types...
+ */
+
+typedef void (*tmc_screen_cb_t)(const unsigned short *codes,
+                                const unsigned short *thresholds,
+				unsigned char *p, int count);
+
+
+/*
+ * Local functions...
+ */
+
+static void	make_bayer(void);
+static void	make_bluenoise(void);
+static int	bluenoise_find(const unsigned char *pattern,
+		               const int *energy, int value);
+static void	bluenoise_set(unsigned char *pattern, int *energy, int cell,
+		              int value);
+static void	screen_generic(const unsigned short *codes,
+		               const unsigned short *thresholds,
+			       unsigned char *p, int count);
+#ifdef HAVE_X86_SIMD
+static void	screen_sse2(const unsigned short *codes,
+		            const unsigned short *thresholds,
+			    unsigned char *p, int count);
+static void	screen_avx2(const unsigned short *codes,
+		            const unsigned short *thresholds,
+			    unsigned char *p, int count);
+#endif /* HAVE_X86_SIMD */
+
+
+/*
+ * Local globals...
+ */
+
+static const struct
+{
+  const char		*name;		/* Implementation name */
+  tmc_screen_cb_t	cb;		/* Threshold function */
+}		screen_impls[] =	/* Available implementations, best last */
+{
+  { "generic", screen_generic },
+#ifdef HAVE_X86_SIMD
+  { "sse2", screen_sse2 },
+  { "avx2", screen_avx2 },
+#endif /* HAVE_X86_SIMD */
+};
+static int	screen_impl = 0;	/* Selected implementation */
+
+static unsigned short	matrices[2][ORDERED_CELLS];
+					/* Thresholds, tiled to 64x64 */
+static pthread_once_t	matrix_once[2] =
+			{ PTHREAD_ONCE_INIT, PTHREAD_ONCE_INIT };
+					/* Matrix built? */
+
+static const int	bluenoise_kernel[2 * BLUENOISE_RADIUS * BLUENOISE_RADIUS + 1] =
+			{		/* 1024 * exp(-d^2 / 4.5), by d^2 */
+			  1024, 820, 657, 526, 421, 337, 270, 216, 173, 139,
+			  111, 89, 71, 57, 46, 37, 29, 23, 19, 15, 12, 10, 8,
+			  6, 5, 4, 3, 3, 2, 2, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+			  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+			};
+
+
+/*
+ * 'screen_supported()' - Can this CPU run an implementation?
+ */
+
+static int				/* O - 1 if supported */
+screen_supported(const char *name)	/* I - Implementation name */
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+
+  if (!strcmp(name, "sse2"))
+    return (__builtin_cpu_supports("sse2"));
+  else if (!strcmp(name, "avx2"))
+    return (__builtin_cpu_supports("avx2"));
+#endif /* HAVE_X86_SIMD */
+
+  (void)name;
+
+  return (1);
+}
+
+
+/*
+ * 'tmcOrderedInit()' - Pick the fastest implementation for this CPU.
+ */
+
+void
+tmcOrderedInit(void)
+{
+  int	i;				/* Looping var */
+
+
+  for (i = (int)(sizeof(screen_impls) / sizeof(screen_impls[0])) - 1; i > 0; i --)
+    if (screen_supported(screen_impls[i].name))
+      break;
+
+  screen_impl = i;
+}
+
+
+/*
+ * 'tmcOrderedSelect()' - Select an implementation by name.
+ */
+
+int					/* O - 0 on success, -1 if unavailable */
+tmcOrderedSelect(const char *name)	/* I - "generic", "sse2" or "avx2" */
+{
+  int	i;				/* Looping var */
+
+
+  for (i = 0; i < (int)(sizeof(screen_impls) / sizeof(screen_impls[0])); i ++)
+    if (!strcmp(name, screen_impls[i].name) &&
+        screen_supported(screen_impls[i].name))
+    {
+      screen_impl = i;
+      return (0);
+    }
+
+  return (-1);
+}
+
+
+/*
+ * 'tmcOrderedName()' - Return the name of the selected implementation.
+ */
+
+const char *				/* O - Implementation name */
+tmcOrderedName(void)
+{
+  return (screen_impls[screen_impl].name);
+}
+
+
+/*
+ * 'tmcOrderedNew()' - Create an ordered dither table from a lookup table.
+ */
+
+tmc_ordered_t *				/* O - New table or NULL */
+tmcOrderedNew(const cups_lut_t *lut,	/* I - Dither lookup table */
+              int              matrix)	/* I - TMC_ORDERED_BAYER or _BLUENOISE */
+{
+  tmc_ordered_t	*o;			/* New table */
+  int		i,			/* Looping var */
+		value,			/* Separated value */
+		level,			/* Dot level below value */
+		num_levels;		/* Number of dot levels */
+  int		levels[255];		/* Intensity of each dot level */
+
+
+  if (matrix != TMC_ORDERED_BAYER && matrix != TMC_ORDERED_BLUENOISE)
+    return (NULL);
+
+  if ((o = calloc(1, sizeof(tmc_ordered_t))) == NULL)
+    return (NULL);
+
+  if (matrix == TMC_ORDERED_BAYER)
+    pthread_once(matrix_once + matrix, make_bayer);
+  else
+    pthread_once(matrix_once + matrix, make_bluenoise);
+
+  o->matrix = matrices[matrix];
+
+ /*
+  * Find the intensity of each dot level; every entry of the lookup table
+  * records the distance to the level it rounds to...
+  */
+
+  memset(levels, 0, sizeof(levels));
+
+  for (i = 0, num_levels = 1; i <= CUPS_MAX_LUT; i ++)
+    if (lut[i].pixel > 0 && lut[i].pixel < 255)
+    {
+      levels[lut[i].pixel] = i - lut[i].error;
+
+      if (lut[i].pixel >= num_levels)
+        num_levels = lut[i].pixel + 1;
+    }
+
+ /*
+  * Then code each separated value as its level and the fraction of the way
+  * to the next level.  Blank pixels stay blank...
+  */
+
+  for (value = 1; value <= CUPS_MAX_LUT; value ++)
+  {
+    i = lut[value].intensity;
+
+    if (i < 0)
+      i = 0;
+    else if (i > CUPS_MAX_LUT)
+      i = CUPS_MAX_LUT;
+
+    for (level = 0; level + 1 < num_levels && levels[level + 1] <= i; level ++);
+
+    if (level + 1 < num_levels && levels[level + 1] > levels[level] &&
+        i > levels[level])
+      o->codes[value] = (level << 8) |
+                        (256 * (i - levels[level]) /
+			 (levels[level + 1] - levels[level]));
+    else
+      o->codes[value] = level << 8;
+  }
+
+  return (o);
+}
+
+
+/*
+ * 'tmcOrderedDelete()' - Free an ordered dither table.
+ */
+
+void
+tmcOrderedDelete(tmc_ordered_t *o)	/* I - Table */
+{
+  free(o);
+}
+
+
+/*
+ * 'tmcOrderedLine()' - Dither a line of separated pixels.
+ *
+ * "y" is the line's position on the page, which picks the matrix row.
+ */
+
+void
+tmcOrderedLine(const tmc_ordered_t *o,	/* I - Table */
+               const short         *data,
+					/* I - Separation data */
+               int                 num_channels,
+					/* I - Number of components */
+	       int                 width,
+					/* I - Width of line */
+	       unsigned            y,	/* I - Line on page */
+               unsigned char       *p)	/* O - Pixels */
+{
+  tmc_screen_cb_t	cb = screen_impls[screen_impl].cb;
+					/* Threshold function */
+  const unsigned short	*thresholds;	/* Matrix row */
+  unsigned short	codes[TMC_ORDERED_SIZE];
+					/* Codes for a tile of the line */
+  int			x, i,		/* Current column */
+			count;		/* Pixels in tile */
+
+
+  thresholds = o->matrix + (y % TMC_ORDERED_SIZE) * TMC_ORDERED_SIZE;
+
+  for (x = 0; x < width; x += count, p += count)
+  {
+    count = width - x < TMC_ORDERED_SIZE ? width - x : TMC_ORDERED_SIZE;
+
+    for (i = 0; i < count; i ++, data += num_channels)
+      codes[i] = o->codes[*data];
+
+    (*cb)(codes, thresholds, p, count);
+  }
+}
+
+
+/*
+ * 'make_bayer()' - Build the Bayer matrix.
+ */
+
+static void
+make_bayer(void)
+{
+  int		x, y,			/* Current position */
+		size;			/* Size of matrix so far */
+  unsigned char	bayer[16][16];		/* Bayer matrix */
+
+
+ /*
+  * Each doubling puts 4x the smaller matrix in each quadrant, offset by 0,
+  * 2, 3 and 1...
+  */
+
+  bayer[0][0] = 0;
+
+  for (size = 1; size < 16; size *= 2)
+    for (y = 0; y < size; y ++)
+      for (x = 0; x < size; x ++)
+      {
+        bayer[y][x]               = 4 * bayer[y][x];
+	bayer[y][x + size]        = bayer[y][x] + 2;
+	bayer[y + size][x]        = bayer[y][x] + 3;
+	bayer[y + size][x + size] = bayer[y][x] + 1;
+      }
+
+  for (y = 0; y < TMC_ORDERED_SIZE; y ++)
+    for (x = 0; x < TMC_ORDERED_SIZE; x ++)
+      matrices[TMC_ORDERED_BAYER][y * TMC_ORDERED_SIZE + x] =
+          255 - bayer[y & 15][x & 15];
+}
+
+
+/*
+ * 'make_bluenoise()' - Build the blue-noise mask.
+ *
+ * This is Ulichney's void-and-cluster method on a 32x32 torus, with
+ * integer filter weights and a fixed starting pattern so that the mask is
+ * the same on every run.  Building it takes time proportional to the
+ * square of its area, so the smaller mask is tiled to fill the matrix.
+ */
+
+static void
+make_bluenoise(void)
+{
+  int		i,			/* Looping var */
+		cell,			/* Current cell */
+		moved,			/* Cell moved into a void */
+		ones,			/* Cells set in starting pattern */
+		rank;			/* Rank of current cell */
+  unsigned	seed = 1;		/* Pseudo-random number */
+  unsigned char	pattern[BLUENOISE_CELLS],	/* Current pattern */
+		start[BLUENOISE_CELLS];	/* Starting pattern */
+  int		energy[BLUENOISE_CELLS],	/* Filtered pattern */
+		start_energy[BLUENOISE_CELLS];
+					/* Filtered starting pattern */
+  unsigned short ranks[BLUENOISE_CELLS];	/* Order cells are set in */
+
+
+ /*
+  * Start with about 10% of the cells set and move the tightest cluster to
+  * the largest void until they are the same cell...
+  */
+
+  memset(pattern, 0, sizeof(pattern));
+  memset(energy, 0, sizeof(energy));
+
+  for (cell = 0, ones = 0; cell < BLUENOISE_CELLS; cell ++)
+  {
+    seed = seed * 1103515245 + 12345;
+
+    if ((seed >> 16) % 10 == 0)
+    {
+      bluenoise_set(pattern, energy, cell, 1);
+      ones ++;
+    }
+  }
+
+  for (i = 0; i < BLUENOISE_CELLS; i ++)
+  {
+    cell = bluenoise_find(pattern, energy, 1);
+    bluenoise_set(pattern, energy, cell, 0);
+
+    moved = bluenoise_find(pattern, energy, 0);
+    bluenoise_set(pattern, energy, moved, 1);
+
+    if (moved == cell)
+      break;
+  }
+
+  memcpy(start, pattern, sizeof(start));
+  memcpy(start_energy, energy, sizeof(start_energy));
+
+ /*
+  * Rank the starting cells by removing the tightest cluster each time...
+  */
+
+  for (rank = ones - 1; rank >= 0; rank --)
+  {
+    cell = bluenoise_find(pattern, energy, 1);
+    bluenoise_set(pattern, energy, cell, 0);
+    ranks[cell] = rank;
+  }
+
+ /*
+  * Then rank the rest by filling the largest void each time...
+  */
+
+  memcpy(pattern, start, sizeof(pattern));
+  memcpy(energy, start_energy, sizeof(energy));
+
+  for (rank = ones; rank < BLUENOISE_CELLS; rank ++)
+  {
+    cell = bluenoise_find(pattern, energy, 0);
+    bluenoise_set(pattern, energy, cell, 1);
+    ranks[cell] = rank;
+  }
+
+  for (cell = 0; cell < ORDERED_CELLS; cell ++)
+    matrices[TMC_ORDERED_BLUENOISE][cell] =
+        255 - ranks[(cell / TMC_ORDERED_SIZE % BLUENOISE_SIZE) * BLUENOISE_SIZE +
+	            cell % BLUENOISE_SIZE] * 256 / BLUENOISE_CELLS;
+}
+
+
+/*
+ * 'bluenoise_find()' - Find the tightest cluster or the largest void.
+ *
+ * The tightest cluster is the set cell with the most energy and the
+ * largest void the clear cell with the least.
+ */
+
+static int				/* O - Cell */
+bluenoise_find(
+    const unsigned char *pattern,	/* I - Pattern */
+    const int           *energy,	/* I - Filtered pattern */
+    int                 value)		/* I - 1 for cluster, 0 for void */
+{
+  int	cell,				/* Current cell */
+	best = -1;			/* Best cell */
+
+
+  for (cell = 0; cell < BLUENOISE_CELLS; cell ++)
+    if (pattern[cell] == value &&
+        (best < 0 || (value ? energy[cell] > energy[best] :
+	                      energy[cell] < energy[best])))
+      best = cell;
+
+  return (best);
+}
+
+
+/*
+ * 'bluenoise_set()' - Set or clear a cell and update the filtered pattern.
+ */
+
+static void
+bluenoise_set(unsigned char *pattern,	/* I - Pattern */
+              int           *energy,	/* I - Filtered pattern */
+	      int           cell,	/* I - Cell */
+	      int           value)	/* I - 1 to set, 0 to clear */
+{
+  int	x, y,				/* Cell position */
+	dx, dy;				/* Offset from cell */
+
+
+  pattern[cell] = value;
+
+  x = cell % BLUENOISE_SIZE;
+  y = cell / BLUENOISE_SIZE;
+
+  for (dy = -BLUENOISE_RADIUS; dy <= BLUENOISE_RADIUS; dy ++)
+    for (dx = -BLUENOISE_RADIUS; dx <= BLUENOISE_RADIUS; dx ++)
+      energy[((y + dy) & (BLUENOISE_SIZE - 1)) * BLUENOISE_SIZE +
+             ((x + dx) & (BLUENOISE_SIZE - 1))] +=
+          value ? bluenoise_kernel[dx * dx + dy * dy] :
+	          -bluenoise_kernel[dx * dx + dy * dy];
+}
+
+
+/*
+ * 'screen_generic()' - Threshold codes a dot at a time.
+ */
+
+static void
+screen_generic(
+    const unsigned short *codes,	/* I - Codes */
+    const unsigned short *thresholds,	/* I - Thresholds */
+    unsigned char        *p,		/* O - Pixels */
+    int                  count)		/* I - Number of pixels */
+{
+  for (; count > 0; count --)
+    *p++ = (*codes++ + *thresholds++) >> 8;
+}
+
+
+#ifdef HAVE_X86_SIMD
+/*
+ * 'screen_sse2()' - Threshold codes 16 at a time.
+ */
+
+__attribute__((target("sse2")))
+static void
+screen_sse2(
+    const unsigned short *codes,	/* I - Codes */
+    const unsigned short *thresholds,	/* I - Thresholds */
+    unsigned char        *p,		/* O - Pixels */
+    int                  count)		/* I - Number of pixels */
+{
+  __m128i	lo, hi;			/* Dots */
+
+
+  for (; count >= 16; count -= 16, codes += 16, thresholds += 16, p += 16)
+  {
+    lo = _mm_add_epi16(_mm_loadu_si128((const __m128i *)codes),
+                       _mm_loadu_si128((const __m128i *)thresholds));
+    hi = _mm_add_epi16(_mm_loadu_si128((const __m128i *)(codes + 8)),
+                       _mm_loadu_si128((const __m128i *)(thresholds + 8)));
+
+    _mm_storeu_si128((__m128i *)p,
+                     _mm_packus_epi16(_mm_srli_epi16(lo, 8),
+		                      _mm_srli_epi16(hi, 8)));
+  }
+
+  screen_generic(codes, thresholds, p, count);
+}
+
+
+/*
+ * 'screen_avx2()' - Threshold codes 32 at a time.
+ */
+
+__attribute__((target("avx2")))
+static void
+screen_avx2(
+    const unsigned short *codes,	/* I - Codes */
+    const unsigned short *thresholds,	/* I - Thresholds */
+    unsigned char        *p,		/* O - Pixels */
+    int                  count)		/* I - Number of pixels */
+{
+  __m256i	lo, hi;			/* Dots */
+
+
+  for (; count >= 32; count -= 32, codes += 32, thresholds += 32, p += 32)
+  {
+    lo = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)codes),
+                          _mm256_loadu_si256((const __m256i *)thresholds));
+    hi = _mm256_add_epi16(_mm256_loadu_si256((const __m256i *)(codes + 16)),
+                          _mm256_loadu_si256((const __m256i *)(thresholds + 16)));
+
+   /*
+    * The pack works within each 128-bit half, so put the 64-bit groups
+    * back in order afterwards...
+    */
+
+    _mm256_storeu_si256((__m256i *)p,
+                        _mm256_permute4x64_epi64(
+			    _mm256_packus_epi16(_mm256_srli_epi16(lo, 8),
+			                        _mm256_srli_epi16(hi, 8)),
+			    0xd8));
+  }
+
+  screen_sse2(codes, thresholds, p, count);
+}
+#endif /* HAVE_X86_SIMD */
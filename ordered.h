@@ -0,0 +1,62 @@
+/*
+ * Threshold-matrix (ordered) dithering for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_ORDERED_H_
+#  define _TMC6XX_ORDERED_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <cupsfilters/driver.h>
+
+
+/*
+ * Constants...
+ */
+
+#  define TMC_ORDERED_SIZE	64	/* Width and height of matrix tile */
+
+
+/*
+ * Threshold matrices...
+ */
+
+enum
+{
+  TMC_ORDERED_BAYER,			/* 16x16 Bayer matrix */
+  TMC_ORDERED_BLUENOISE			/* 32x32 void-and-cluster mask */
+};
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_ordered_s		/**** Ordered dither table ****/
+{
+  unsigned short	codes[CUPS_MAX_LUT + 1];
+					/* Dot level << 8 | fraction per value */
+  const unsigned short	*matrix;	/* Threshold matrix */
+} tmc_ordered_t;
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcOrderedInit(void);
+extern int		tmcOrderedSelect(const char *name);
+extern const char	*tmcOrderedName(void);
+extern tmc_ordered_t	*tmcOrderedNew(const cups_lut_t *lut, int matrix);
+extern void		tmcOrderedDelete(tmc_ordered_t *o);
+extern void		tmcOrderedLine(const tmc_ordered_t *o,
+			               const short *data, int num_channels,
+				       int width, unsigned y,
+				       unsigned char *p);
+
+#endif /* !_TMC6XX_ORDERED_H_ */
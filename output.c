@@ -0,0 +1,709 @@
+/*
+ * Buffered ESC/P-R output for the TM-C6xx filter.
+ *
+ * Commands and their parameters are collected in a buffer, and the
+ * compressed graphics are queued by reference, so a whole band goes out in
+ * a few writev() calls when the filter flushes at the end of the band.
+ * Data queued with tmcOutputData() must stay valid until the next flush.
+ *
+ * The output can also be captured while it is written, so that a finished
+ * page can be sent again for each copy.
+ *
+ * The job, page and graphics command sequences are here too, so that the
+ * filter and the tmcJob API in tmc6xx.c send exactly the same stream.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "output.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+
+/*
+ * Constants...
+ */
+
+#define OUTPUT_BUFFER	65536		/* Size of command buffer */
+#define OUTPUT_IOV	64		/* Queued writes per writev() */
+#define OUTPUT_COPY	256		/* Largest data to copy into buffer */
+
+
+/*
+ * Local globals...
+ */
+
+static int		OutputFd = 1;		/* Output file */
+static tmc_output_cb_t	OutputCB = NULL;	/* Output callback or NULL */
+static void		*OutputCtx = NULL;	/* Callback data */
+static unsigned char	Buffer[OUTPUT_BUFFER];	/* Command buffer */
+static size_t		BufferUsed,		/* Bytes in buffer */
+			BufferMark;		/* Start of unqueued bytes */
+static struct iovec	Iov[OUTPUT_IOV];	/* Queued writes */
+static int		NumIov;			/* Number of queued writes */
+static unsigned long	Writes,			/* write() calls since last stats */
+			Bytes;			/* Bytes since last stats */
+static int		WriteError;		/* Have we reported an error? */
+static int		Capturing;		/* Capture the output? */
+static unsigned char	*Capture;		/* Captured output */
+static size_t		CaptureLength,		/* Bytes captured */
+			CaptureSize;		/* Size of capture buffer */
+static const unsigned char IdleSpacing[32767] = { 0 };
+						/* Idle spacing data */
+
+
+/*
+ * Local functions...
+ */
+
+static void	output_capture(const void *data, size_t length);
+static void	output_queue(const void *data, size_t length);
+static int	output_write(struct iovec *iov, int count);
+
+
+/*
+ * 'tmcOutputInit()' - Set the output file.
+ */
+
+void
+tmcOutputInit(int fd)			/* I - File descriptor */
+{
+  OutputFd   = fd;
+  OutputCB   = NULL;
+  OutputCtx  = NULL;
+  BufferUsed = 0;
+  BufferMark = 0;
+  NumIov     = 0;
+  Writes     = 0;
+  Bytes      = 0;
+  WriteError = 0;
+}
+
+
+/*
+ * 'tmcOutputInitCB()' - Send the output to a callback instead of a file.
+ */
+
+void
+tmcOutputInitCB(tmc_output_cb_t cb,	/* I - Write callback */
+                void            *ctx)	/* I - Callback data */
+{
+  tmcOutputInit(-1);
+
+  OutputCB  = cb;
+  OutputCtx = ctx;
+}
+
+
+/*
+ * 'tmcOutputFlush()' - Write everything that is queued.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcOutputFlush(void)
+{
+  int	status;				/* Write status */
+
+
+  output_queue(NULL, 0);
+
+  status = NumIov ? output_write(Iov, NumIov) : 0;
+
+  BufferUsed = 0;
+  BufferMark = 0;
+  NumIov     = 0;
+
+  return (status);
+}
+
+
+/*
+ * 'tmcOutputStats()' - Get the write() calls and bytes since the last call.
+ */
+
+void
+tmcOutputStats(unsigned long *writes,	/* O - Number of write calls */
+               unsigned long *bytes)	/* O - Number of bytes */
+{
+  *writes = Writes;
+  *bytes  = Bytes;
+
+  Writes = 0;
+  Bytes  = 0;
+}
+
+
+/*
+ * 'tmcOutputByte()' - Add a byte to the output.
+ */
+
+void
+tmcOutputByte(int c)			/* I - Byte */
+{
+  if (BufferUsed >= OUTPUT_BUFFER)
+    tmcOutputFlush();
+
+  Buffer[BufferUsed ++] = c;
+
+  if (Capturing)
+    output_capture(Buffer + BufferUsed - 1, 1);
+}
+
+
+/*
+ * 'tmcOutputBytes()' - Copy bytes to the output.
+ */
+
+void
+tmcOutputBytes(const void *data,	/* I - Bytes */
+               size_t     length)	/* I - Number of bytes */
+{
+  struct iovec	iov;			/* Direct write */
+
+
+  if (Capturing)
+    output_capture(data, length);
+
+  if (length > OUTPUT_BUFFER - BufferUsed)
+  {
+    tmcOutputFlush();
+
+    if (length > OUTPUT_BUFFER)
+    {
+      iov.iov_base = (void *)data;
+      iov.iov_len  = length;
+
+      output_write(&iov, 1);
+      return;
+    }
+  }
+
+  memcpy(Buffer + BufferUsed, data, length);
+  BufferUsed += length;
+}
+
+
+/*
+ * 'tmcOutputData()' - Queue bytes for output without copying them.
+ */
+
+void
+tmcOutputData(const void *data,		/* I - Bytes */
+              size_t     length)	/* I - Number of bytes */
+{
+  if (length <= OUTPUT_COPY)
+  {
+    tmcOutputBytes(data, length);
+    return;
+  }
+
+  if (NumIov > OUTPUT_IOV - 3)
+    tmcOutputFlush();
+
+  if (Capturing)
+    output_capture(data, length);
+
+  output_queue(data, length);
+}
+
+
+/*
+ * 'tmcOutputCaptureStart()' - Start capturing the output.
+ */
+
+void
+tmcOutputCaptureStart(void)
+{
+  Capturing     = 1;
+  CaptureLength = 0;
+}
+
+
+/*
+ * 'tmcOutputCaptureLength()' - Get the number of bytes captured so far.
+ */
+
+size_t					/* O - Bytes captured */
+tmcOutputCaptureLength(void)
+{
+  return (CaptureLength);
+}
+
+
+/*
+ * 'tmcOutputCaptureEnd()' - Stop capturing the output.
+ *
+ * The captured bytes stay valid until the next tmcOutputCaptureStart().
+ */
+
+unsigned char *				/* O - Captured bytes or NULL on error */
+tmcOutputCaptureEnd(size_t *length)	/* O - Number of bytes */
+{
+  int	ok = Capturing > 0;		/* Was the capture complete? */
+
+
+  Capturing = 0;
+  *length   = CaptureLength;
+
+  return (ok ? Capture : NULL);
+}
+
+
+/*
+ * 'tmcOutputInt16()' - Add a little-endian 16-bit value to the output.
+ */
+
+void
+tmcOutputInt16(unsigned v)		/* I - Value */
+{
+  unsigned char	b[2];			/* Bytes */
+
+
+  b[0] = v;
+  b[1] = v >> 8;
+
+  tmcOutputBytes(b, sizeof(b));
+}
+
+
+/*
+ * 'tmcOutputInt32()' - Add a little-endian 32-bit value to the output.
+ */
+
+void
+tmcOutputInt32(unsigned v)		/* I - Value */
+{
+  unsigned char	b[4];			/* Bytes */
+
+
+  b[0] = v;
+  b[1] = v >> 8;
+  b[2] = v >> 16;
+  b[3] = v >> 24;
+
+  tmcOutputBytes(b, sizeof(b));
+}
+
+
+/*
+ * 'tmcOutputColor()' - Get the ESC i color code of a printer plane.
+ */
+
+int					/* O - Color code */
+tmcOutputColor(int planes,		/* I - Number of printer planes */
+               int plane)		/* I - Printer plane */
+{
+  static const int ctable[7][7] =	/* Colors */
+		{
+		  {  0,  0,  0,  0,  0,  0,  0 },	/* K */
+		  {  0, 16,  0,  0,  0,  0,  0 },	/* Kk */
+		  {  2,  1,  4,  0,  0,  0,  0 },	/* CMY */
+		  {  2,  1,  4,  0,  0,  0,  0 },	/* CMYK */
+		  {  0,  0,  0,  0,  0,  0,  0 },
+		  {  2, 18,  1, 17,  4,  0,  0 },	/* CcMmYK */
+		  {  2, 18,  1, 17,  4,  0, 16 },	/* CcMmYKk */
+		};
+
+
+  return (ctable[planes - 1][plane]);
+}
+
+
+/*
+ * 'tmcOutputJobEnd()' - Reset the printer at the end of a job.
+ */
+
+void
+tmcOutputJobEnd(void)
+{
+ /*
+  * Reset the printer...
+  */
+
+  tmcOutputBytes("\033@\033@", 4);
+
+ /*
+  * Go into remote mode, load the defaults and exit remote mode...
+  */
+
+  tmcOutputBytes("\033(R\010\000\000REMOTE1", 13);
+  tmcOutputBytes("LD\000\000", 4);
+  tmcOutputBytes("\033\000\000\000", 4);
+}
+
+
+/*
+ * 'tmcOutputJobStart()' - Start a job.
+ */
+
+void
+tmcOutputJobStart(void)
+{
+ /*
+  * Some EPSON printers need an additional command issued at the
+  * beginning of each job to exit from USB "packet" mode...
+  */
+
+  tmcOutputBytes("\000\000\000\033\001@EJL 1284.4\n@EJL     \n\033@", 29);
+}
+
+
+/*
+ * 'tmcOutputPageStart()' - Reset the printer and set up a page.
+ *
+ * "cut" is the REMOTE1 AC (auto cutter) value, or -1 to leave the cutter
+ * alone.  "length" and "top" are in lines.
+ */
+
+long					/* O - Capture offset of cut value or -1 */
+tmcOutputPageStart(int      cut,	/* I - Cutter setting or -1 */
+                   int      idle,	/* I - Send idle spacing? */
+		   unsigned xdpi,	/* I - Horizontal resolution */
+		   unsigned ydpi,	/* I - Vertical resolution */
+		   unsigned length,	/* I - Page length */
+		   unsigned top)	/* I - Top margin */
+{
+  int		i;			/* Looping var */
+  unsigned	units;			/* Units for resolution */
+  long		offset = -1;		/* Offset of cut value */
+
+
+ /*
+  * Initialize the printer...
+  */
+
+  tmcOutputBytes("\033@", 2);
+
+ /*
+  * Go into remote mode...
+  */
+
+  tmcOutputBytes("\033(R\010\000\000REMOTE1", 13);
+  tmcOutputBytes("EX\006\000\000\000\000\000\005\000", 10);
+
+  if (cut >= 0)
+  {
+   /*
+    * Enable/disable cutter.
+    */
+
+    tmcOutputBytes("AC\002\000\000", 5);
+    offset = (long)tmcOutputCaptureLength();
+    tmcOutputByte(cut);
+  }
+
+ /*
+  * Exit remote mode...
+  */
+
+  tmcOutputBytes("\033\000\000\000", 4);
+
+ /*
+  * Idle spacing, unless the printer doesn't need it
+  */
+
+  if (idle)
+  {
+    for (i = 0; i < 2; i ++)
+    {
+      tmcOutputBytes("\033(d\xff\x7f", 5);
+      tmcOutputData(IdleSpacing, sizeof(IdleSpacing));
+    }
+  }
+
+ /*
+  * Enter graphics mode...
+  */
+
+  tmcOutputBytes("\033(G\001\000\001", 6);
+
+ /*
+  * Set the line feed increment...
+  */
+
+  for (units = 1440; units < xdpi; units *= 2);
+
+  tmcOutputUnits(units / ydpi, units / ydpi, units / xdpi, units);
+
+ /*
+  * Set the page length and the top and bottom margins...
+  */
+
+  tmcOutputPageLength(length);
+  tmcOutputMargins(top, length);
+
+ /*
+  * Paper load/ejecting
+  */
+
+  tmcOutputBytes("\033\x19\x01", 3);
+
+  return (offset);
+}
+
+
+/*
+ * 'tmcOutputPass()' - Send a microweave pass of a plane (ESC i).
+ *
+ * The second pass of a band goes back to the left margin first and
+ * returns the head afterwards.
+ */
+
+void
+tmcOutputPass(int         color,	/* I - Color code */
+              int         microweave,	/* I - Microweave pass? */
+	      int         compressed,	/* I - PackBits data? */
+	      int         bits,		/* I - Bits per dot */
+	      unsigned    bytes,	/* I - Bytes per line */
+	      unsigned    rows,		/* I - Number of lines */
+	      const void  *data,	/* I - Graphics data */
+	      size_t      length)	/* I - Bytes of data */
+{
+  if (microweave)
+    tmcOutputOffset(0);
+
+  tmcOutputGraphics(color | (microweave ? 64 : 0), compressed, bits, bytes,
+                    rows);
+  tmcOutputData(data, length);
+
+  if (microweave)
+    tmcOutputByte(0x0d);
+}
+
+
+/*
+ * 'tmcOutputFeed()' - Advance the paper (ESC ( v).
+ */
+
+void
+tmcOutputFeed(unsigned feed)		/* I - Lines to feed */
+{
+  tmcOutputBytes("\033(v\004\000", 5);
+  tmcOutputInt32(feed);
+}
+
+
+/*
+ * 'tmcOutputGraphics()' - Start a block of raster graphics (ESC i).
+ *
+ * The graphics data follows with tmcOutputData().
+ */
+
+void
+tmcOutputGraphics(int      color,	/* I - Color code */
+                  int      compressed,	/* I - PackBits data? */
+		  int      bits,	/* I - Bits per dot */
+		  unsigned bytes,	/* I - Bytes per line */
+		  unsigned rows)	/* I - Number of lines */
+{
+  unsigned char	b[9];			/* Command */
+
+
+  b[0] = 0x1b;
+  b[1] = 'i';
+  b[2] = color;
+  b[3] = compressed;
+  b[4] = bits;
+  b[5] = bytes;
+  b[6] = bytes >> 8;
+  b[7] = rows;
+  b[8] = rows >> 8;
+
+  tmcOutputBytes(b, sizeof(b));
+}
+
+
+/*
+ * 'tmcOutputMargins()' - Set the top and bottom margins (ESC ( c).
+ */
+
+void
+tmcOutputMargins(unsigned top,		/* I - Top margin */
+                 unsigned length)	/* I - Page length */
+{
+  tmcOutputBytes("\033(c\010\000", 5);
+  tmcOutputInt32(top);
+  tmcOutputInt32(length);
+}
+
+
+/*
+ * 'tmcOutputOffset()' - Set the horizontal print position (ESC ( $).
+ */
+
+void
+tmcOutputOffset(unsigned offset)	/* I - Head offset */
+{
+  tmcOutputBytes("\033($\004\000", 5);
+  tmcOutputInt32(offset);
+}
+
+
+/*
+ * 'tmcOutputPageLength()' - Set the page length (ESC ( C).
+ */
+
+void
+tmcOutputPageLength(unsigned length)	/* I - Page length */
+{
+  tmcOutputBytes("\033(C\004\000", 5);
+  tmcOutputInt32(length);
+}
+
+
+/*
+ * 'tmcOutputUnits()' - Set the units of measure (ESC ( U).
+ */
+
+void
+tmcOutputUnits(unsigned page,		/* I - Page unit divisor */
+               unsigned vertical,	/* I - Vertical unit divisor */
+	       unsigned horizontal,	/* I - Horizontal unit divisor */
+	       unsigned base)		/* I - Base unit */
+{
+  tmcOutputBytes("\033(U\005\000", 5);
+  tmcOutputByte(page);
+  tmcOutputByte(vertical);
+  tmcOutputByte(horizontal);
+  tmcOutputInt16(base);
+}
+
+
+/*
+ * 'output_capture()' - Add bytes to the capture buffer.
+ */
+
+static void
+output_capture(const void *data,	/* I - Bytes */
+               size_t     length)	/* I - Number of bytes */
+{
+  size_t	size;			/* New size of buffer */
+  unsigned char	*temp;			/* New buffer */
+
+
+  if (Capturing < 0)
+    return;
+
+  if (CaptureLength + length > CaptureSize)
+  {
+    for (size = CaptureSize ? CaptureSize : 262144;
+         size < CaptureLength + length;
+	 size *= 2);
+
+    if ((temp = realloc(Capture, size)) == NULL)
+    {
+     /*
+      * Keep writing, but report that the capture is incomplete...
+      */
+
+      Capturing = -1;
+      return;
+    }
+
+    Capture     = temp;
+    CaptureSize = size;
+  }
+
+  memcpy(Capture + CaptureLength, data, length);
+  CaptureLength += length;
+}
+
+
+/*
+ * 'output_queue()' - Queue the buffered bytes and then some external data.
+ */
+
+static void
+output_queue(const void *data,		/* I - Bytes or NULL */
+             size_t     length)		/* I - Number of bytes */
+{
+  if (BufferUsed > BufferMark)
+  {
+    Iov[NumIov].iov_base = Buffer + BufferMark;
+    Iov[NumIov].iov_len  = BufferUsed - BufferMark;
+    NumIov ++;
+
+    BufferMark = BufferUsed;
+  }
+
+  if (data && length > 0)
+  {
+    Iov[NumIov].iov_base = (void *)data;
+    Iov[NumIov].iov_len  = length;
+    NumIov ++;
+  }
+}
+
+
+/*
+ * 'output_write()' - Write a list of buffers, retrying short writes.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+output_write(struct iovec *iov,		/* I - Buffers */
+             int          count)	/* I - Number of buffers */
+{
+  ssize_t	bytes;			/* Bytes written */
+
+
+  while (count > 0)
+  {
+    Writes ++;
+
+    if (OutputCB)
+    {
+     /*
+      * The callback takes one buffer at a time...
+      */
+
+      if ((*OutputCB)(OutputCtx, iov->iov_base, iov->iov_len))
+        return (-1);
+
+      Bytes += iov->iov_len;
+      iov ++;
+      count --;
+      continue;
+    }
+
+    if ((bytes = writev(OutputFd, iov, count)) < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+
+      if (!WriteError)
+      {
+        fprintf(stderr, "DEBUG: Unable to write print data: %s\n",
+	        strerror(errno));
+        WriteError = 1;
+      }
+
+      return (-1);
+    }
+
+    Bytes += bytes;
+
+    while (count > 0 && (size_t)bytes >= iov->iov_len)
+    {
+      bytes -= iov->iov_len;
+      iov ++;
+      count --;
+    }
+
+    if (count > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + bytes;
+      iov->iov_len  -= bytes;
+    }
+  }
+
+  return (0);
+}
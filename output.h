@@ -0,0 +1,64 @@
+/*
+ * Buffered ESC/P-R output for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_OUTPUT_H_
+#  define _TMC6XX_OUTPUT_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+
+
+/*
+ * Types...
+ */
+
+typedef int (*tmc_output_cb_t)(void *ctx, const void *data, size_t length);
+					/**** Write callback, 0 on success ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern void	tmcOutputInit(int fd);
+extern void	tmcOutputInitCB(tmc_output_cb_t cb, void *ctx);
+extern int	tmcOutputFlush(void);
+extern void	tmcOutputStats(unsigned long *writes, unsigned long *bytes);
+
+extern void	tmcOutputCaptureStart(void);
+extern size_t	tmcOutputCaptureLength(void);
+extern unsigned char *tmcOutputCaptureEnd(size_t *length);
+
+extern void	tmcOutputByte(int c);
+extern void	tmcOutputBytes(const void *data, size_t length);
+extern void	tmcOutputData(const void *data, size_t length);
+extern void	tmcOutputInt16(unsigned v);
+extern void	tmcOutputInt32(unsigned v);
+
+extern int	tmcOutputColor(int planes, int plane);
+extern void	tmcOutputJobEnd(void);
+extern void	tmcOutputJobStart(void);
+extern long	tmcOutputPageStart(int cut, int idle, unsigned xdpi,
+		                   unsigned ydpi, unsigned length,
+				   unsigned top);
+extern void	tmcOutputPass(int color, int microweave, int compressed,
+		              int bits, unsigned bytes, unsigned rows,
+			      const void *data, size_t length);
+
+extern void	tmcOutputFeed(unsigned feed);
+extern void	tmcOutputGraphics(int color, int compressed, int bits,
+		                  unsigned bytes, unsigned rows);
+extern void	tmcOutputMargins(unsigned top, unsigned length);
+extern void	tmcOutputOffset(unsigned offset);
+extern void	tmcOutputPageLength(unsigned length);
+extern void	tmcOutputUnits(unsigned page, unsigned vertical,
+		               unsigned horizontal, unsigned base);
+
+#endif /* !_TMC6XX_OUTPUT_H_ */
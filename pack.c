@@ -0,0 +1,299 @@
+/*
+ * 2-bit dot packing for the TM-C6xx filter.
+ *
+ * tmcPackLines2() does the work of calling cupsPackHorizontal2() once per
+ * line, for a whole half-band of lines at once.  Dot values must be 0 to 3,
+ * which is all a 2-bit lookup table can produce.  Groups of four dots are
+ * packed with vector shifts; when the width is not a multiple of four, the
+ * dots left over at the end of each line are still packed by
+ * cupsPackHorizontal2() so the padding matches exactly.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "pack.h"
+#include <cupsfilters/driver.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define HAVE_X86_SIMD 1
+#  include <immintrin.h>
+#endif /* __GNUC__ && (__x86_64__ || __i386__) */
+
+
+/*
+ * Local types...
+ */
+
+typedef void (*tmc_pack_cb_t)(const unsigned char *src, unsigned char *dst,
+                              int bytes);
+
+
+/*
+ * Local functions...
+ */
+
+static void	pack_generic(const unsigned char *src, unsigned char *dst,
+		             int bytes);
+#ifdef HAVE_X86_SIMD
+static void	pack_sse2(const unsigned char *src, unsigned char *dst,
+		          int bytes);
+static void	pack_avx2(const unsigned char *src, unsigned char *dst,
+		          int bytes);
+#endif /* HAVE_X86_SIMD */
+
+
+/*
+ * Local globals...
+ */
+
+static const struct
+{
+  const char		*name;		/* Implementation name */
+  tmc_pack_cb_t		cb;		/* Packer, NULL for cupsPackHorizontal2 */
+}		pack_impls[] =		/* Available packers, best last */
+{
+  { "cups", NULL },
+  { "generic", pack_generic },
+#ifdef HAVE_X86_SIMD
+  { "sse2", pack_sse2 },
+  { "avx2", pack_avx2 },
+#endif /* HAVE_X86_SIMD */
+};
+static int	pack_impl = 0;		/* Selected packer */
+
+
+/*
+ * 'pack_supported()' - Can this CPU run a packer?
+ */
+
+static int				/* O - 1 if supported */
+pack_supported(const char *name)	/* I - Implementation name */
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+
+  if (!strcmp(name, "sse2"))
+    return (__builtin_cpu_supports("sse2"));
+  else if (!strcmp(name, "avx2"))
+    return (__builtin_cpu_supports("avx2"));
+#endif /* HAVE_X86_SIMD */
+
+  (void)name;
+
+  return (1);
+}
+
+
+/*
+ * 'tmcPackInit()' - Pick the fastest packer for this CPU.
+ */
+
+void
+tmcPackInit(void)
+{
+  int	i;				/* Looping var */
+
+
+  for (i = (int)(sizeof(pack_impls) / sizeof(pack_impls[0])) - 1; i > 0; i --)
+    if (pack_supported(pack_impls[i].name))
+      break;
+
+  pack_impl = i;
+}
+
+
+/*
+ * 'tmcPackSelect()' - Select a packer by name.
+ */
+
+int					/* O - 0 on success, -1 if unavailable */
+tmcPackSelect(const char *name)		/* I - "cups", "generic", "sse2" or "avx2" */
+{
+  int	i;				/* Looping var */
+
+
+  for (i = 0; i < (int)(sizeof(pack_impls) / sizeof(pack_impls[0])); i ++)
+    if (!strcmp(name, pack_impls[i].name) && pack_supported(pack_impls[i].name))
+    {
+      pack_impl = i;
+      return (0);
+    }
+
+  return (-1);
+}
+
+
+/*
+ * 'tmcPackName()' - Return the name of the selected packer.
+ */
+
+const char *				/* O - Implementation name */
+tmcPackName(void)
+{
+  return (pack_impls[pack_impl].name);
+}
+
+
+/*
+ * 'tmcPackLines2()' - Pack lines of 2-bit dots, 4 dots per byte.
+ *
+ * The "rows" source lines of "width" dots follow each other in "src"; the
+ * packed lines are written "dst_bytes" apart in "dst".
+ */
+
+void
+tmcPackLines2(const unsigned char *src,	/* I - Dots, one per byte */
+              int                 width,/* I - Dots per line */
+              int                 rows,	/* I - Number of lines */
+	      unsigned char       *dst,	/* O - Packed lines */
+	      int                 dst_bytes)
+					/* I - Bytes between packed lines */
+{
+  tmc_pack_cb_t	cb = pack_impls[pack_impl].cb;
+					/* Packer */
+  int		whole = width / 4,	/* Whole bytes per line */
+		extra = width & 3;	/* Dots left over per line */
+
+
+  if (!cb)
+  {
+    for (; rows > 0; rows --, src += width, dst += dst_bytes)
+      cupsPackHorizontal2(src, dst, width, 1);
+  }
+  else if (!extra && dst_bytes == whole)
+  {
+   /*
+    * The lines pack back to back, so do the whole half-band at once...
+    */
+
+    (*cb)(src, dst, whole * rows);
+  }
+  else
+  {
+    for (; rows > 0; rows --, src += width, dst += dst_bytes)
+    {
+      (*cb)(src, dst, whole);
+
+      if (extra)
+        cupsPackHorizontal2(src + 4 * whole, dst + whole, extra, 1);
+    }
+  }
+}
+
+
+/*
+ * 'pack_generic()' - Pack dots a byte at a time.
+ */
+
+static void
+pack_generic(const unsigned char *src,	/* I - Dots */
+             unsigned char       *dst,	/* O - Packed bytes */
+	     int                 bytes)	/* I - Number of bytes to write */
+{
+  for (; bytes > 0; bytes --, src += 4)
+    *dst++ = (src[0] << 6) | (src[1] << 4) | (src[2] << 2) | src[3];
+}
+
+
+#ifdef HAVE_X86_SIMD
+/*
+ * 'pack4_sse2()' - Pack 16 dots into the low byte of each 32-bit lane.
+ *
+ * With the first dot in the low byte of a lane, shifting the lane left by
+ * 6 and right by 4, 14 and 24 bits lines each dot up with its place in the
+ * packed byte.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i			/* O - Packed bytes, one per lane */
+pack4_sse2(const unsigned char *src)	/* I - 16 dots */
+{
+  __m128i	v = _mm_loadu_si128((const __m128i *)src);
+					/* Dots */
+
+  return (_mm_and_si128(_mm_or_si128(_mm_or_si128(_mm_slli_epi32(v, 6),
+                                                  _mm_srli_epi32(v, 4)),
+                                     _mm_or_si128(_mm_srli_epi32(v, 14),
+				                  _mm_srli_epi32(v, 24))),
+                        _mm_set1_epi32(255)));
+}
+
+
+/*
+ * 'pack_sse2()' - Pack dots 64 at a time.
+ */
+
+__attribute__((target("sse2")))
+static void
+pack_sse2(const unsigned char *src,	/* I - Dots */
+          unsigned char       *dst,	/* O - Packed bytes */
+	  int                 bytes)	/* I - Number of bytes to write */
+{
+  for (; bytes >= 16; bytes -= 16, src += 64, dst += 16)
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_packus_epi16(_mm_packs_epi32(pack4_sse2(src),
+		                                      pack4_sse2(src + 16)),
+                                      _mm_packs_epi32(pack4_sse2(src + 32),
+				                      pack4_sse2(src + 48))));
+
+  pack_generic(src, dst, bytes);
+}
+
+
+/*
+ * 'pack4_avx2()' - Pack 32 dots into the low byte of each 32-bit lane.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256i			/* O - Packed bytes, one per lane */
+pack4_avx2(const unsigned char *src)	/* I - 32 dots */
+{
+  __m256i	v = _mm256_loadu_si256((const __m256i *)src);
+					/* Dots */
+
+  return (_mm256_and_si256(_mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(v, 6),
+                                                           _mm256_srli_epi32(v, 4)),
+                                           _mm256_or_si256(_mm256_srli_epi32(v, 14),
+				                           _mm256_srli_epi32(v, 24))),
+                           _mm256_set1_epi32(255)));
+}
+
+
+/*
+ * 'pack_avx2()' - Pack dots 128 at a time.
+ */
+
+__attribute__((target("avx2")))
+static void
+pack_avx2(const unsigned char *src,	/* I - Dots */
+          unsigned char       *dst,	/* O - Packed bytes */
+	  int                 bytes)	/* I - Number of bytes to write */
+{
+  __m256i	packed;			/* Packed bytes */
+
+
+  for (; bytes >= 32; bytes -= 32, src += 128, dst += 32)
+  {
+   /*
+    * The packs work within each 128-bit half, so put the 32-bit groups
+    * back in order afterwards...
+    */
+
+    packed = _mm256_packus_epi16(_mm256_packs_epi32(pack4_avx2(src),
+		                                    pack4_avx2(src + 32)),
+                                 _mm256_packs_epi32(pack4_avx2(src + 64),
+				                    pack4_avx2(src + 96)));
+    packed = _mm256_permutevar8x32_epi32(packed,
+                                         _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+
+    _mm256_storeu_si256((__m256i *)dst, packed);
+  }
+
+  pack_sse2(src, dst, bytes);
+}
+#endif /* HAVE_X86_SIMD */
@@ -0,0 +1,22 @@
+/*
+ * 2-bit dot packing for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_PACK_H_
+#  define _TMC6XX_PACK_H_
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcPackInit(void);
+extern int		tmcPackSelect(const char *name);
+extern const char	*tmcPackName(void);
+extern void		tmcPackLines2(const unsigned char *src, int width,
+			              int rows, unsigned char *dst,
+				      int dst_bytes);
+
+#endif /* !_TMC6XX_PACK_H_ */
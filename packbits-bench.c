@@ -0,0 +1,370 @@
+/*
+ * PackBits encoder microbenchmark for the TM-C6xx filter.
+ *
+ * Usage:
+ *
+ *   packbits-bench [-i iterations] [file.ras ...]
+ *
+ * Each CUPS raster page is cut into the same 2-bit microweave passes the
+ * filter compresses (180-line bands, C/M/Y planes quantized to 4 levels),
+ * and every available encoder compresses all of them.  Without any files a
+ * synthetic label (text, barcode and a photo strip) is used instead.
+ *
+ * The fast encoders must match the scalar one byte for byte; the optimal
+ * encoder must decode back to the pass and is reported with the bytes it
+ * saves over the scalar one.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "packbits.h"
+#include <cups/raster.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+
+/*
+ * Types...
+ */
+
+typedef struct pass_s			/**** Microweave pass to compress ****/
+{
+  unsigned char	*data;			/* Packed 2-bit data */
+  int		length;			/* Number of bytes */
+} pass_t;
+
+
+/*
+ * Globals...
+ */
+
+static pass_t	*Passes = NULL;		/* Passes to compress */
+static int	NumPasses = 0,		/* Number of passes */
+		AllocPasses = 0;	/* Allocated passes */
+static long	TotalBytes = 0;		/* Uncompressed bytes */
+
+
+/*
+ * 'unpack()' - Decode PackBits data.
+ */
+
+static int				/* O - Number of bytes decoded */
+unpack(const unsigned char *comp,	/* I - Compressed data */
+       int                 length,	/* I - Number of compressed bytes */
+       unsigned char       *data,	/* O - Decoded data */
+       int                 max)		/* I - Size of data buffer */
+{
+  const unsigned char	*end = comp + length;
+					/* End of compressed data */
+  int			count,		/* Bytes in run */
+			bytes = 0;	/* Bytes decoded */
+
+
+  while (comp < end)
+  {
+    if (*comp < 128)
+    {
+      count = *comp++ + 1;
+
+      if (bytes + count > max || comp + count > end)
+        return (-1);
+
+      memcpy(data + bytes, comp, count);
+      comp += count;
+    }
+    else if (*comp > 128)
+    {
+      count = 257 - *comp++;
+
+      if (bytes + count > max || comp >= end)
+        return (-1);
+
+      memset(data + bytes, *comp++, count);
+    }
+    else
+    {
+      comp ++;
+      continue;
+    }
+
+    bytes += count;
+  }
+
+  return (bytes);
+}
+
+
+/*
+ * 'add_band()' - Cut a band of 1-byte-per-channel lines into passes.
+ */
+
+static void
+add_band(const unsigned char *lines,	/* I - Lines (0 = white, 255 = full ink) */
+         int                 width,	/* I - Pixels per line */
+	 int                 channels,	/* I - Channels per pixel */
+	 int                 rows)	/* I - Number of lines */
+{
+  int		plane,			/* Current plane */
+		pass,			/* Current pass */
+		row,			/* Current line */
+		x;			/* Current column */
+  int		bytes = (width + 3) / 4;/* Bytes per packed line */
+  unsigned char	*ptr;			/* Output pointer */
+
+
+  for (plane = 0; plane < 3; plane ++)
+    for (pass = 0; pass < 2; pass ++)
+    {
+      if (NumPasses >= AllocPasses)
+      {
+        AllocPasses += 256;
+	Passes      = realloc(Passes, AllocPasses * sizeof(pass_t));
+      }
+
+      Passes[NumPasses].length = bytes * (rows / 2);
+      Passes[NumPasses].data   = calloc(1, Passes[NumPasses].length + 1);
+
+      for (row = pass, ptr = Passes[NumPasses].data; row + 1 < rows + pass && row < rows; row += 2, ptr += bytes)
+        for (x = 0; x < width; x ++)
+	  ptr[x / 4] |= (lines[(row * width + x) * channels + plane % channels] >> 6) << (6 - 2 * (x & 3));
+
+      TotalBytes += Passes[NumPasses].length;
+      NumPasses ++;
+    }
+}
+
+
+/*
+ * 'load_raster()' - Load the pages of a CUPS raster file.
+ */
+
+static int				/* O - 0 on success */
+load_raster(const char *filename)	/* I - Raster file */
+{
+  int			fd;		/* File descriptor */
+  cups_raster_t		*ras;		/* Raster stream */
+  cups_page_header2_t	header;		/* Page header */
+  unsigned char		*band,		/* Band of inverted lines */
+			*line;		/* Raster line */
+  unsigned		y,		/* Current line */
+			x,		/* Current byte */
+			rows;		/* Lines in band */
+
+
+  if ((fd = open(filename, O_RDONLY)) < 0)
+  {
+    perror(filename);
+    return (-1);
+  }
+
+  ras = cupsRasterOpen(fd, CUPS_RASTER_READ);
+
+  while (cupsRasterReadHeader2(ras, &header))
+  {
+    if (header.cupsBitsPerColor != 8 ||
+        (header.cupsBitsPerPixel != 8 && header.cupsBitsPerPixel != 24))
+    {
+      fprintf(stderr, "%s: Only 8-bit gray and RGB rasters are supported.\n",
+              filename);
+      break;
+    }
+
+    band = malloc(180 * header.cupsBytesPerLine);
+    line = malloc(header.cupsBytesPerLine);
+
+    for (y = 0, rows = 0; y < header.cupsHeight; y ++)
+    {
+      if (!cupsRasterReadPixels(ras, line, header.cupsBytesPerLine))
+        break;
+
+      for (x = 0; x < header.cupsBytesPerLine; x ++)
+        band[rows * header.cupsBytesPerLine + x] = 255 - line[x];
+
+      if (++ rows == 180)
+      {
+        add_band(band, header.cupsWidth, header.cupsBitsPerPixel / 8, rows);
+	rows = 0;
+      }
+    }
+
+    if (rows > 1)
+      add_band(band, header.cupsWidth, header.cupsBitsPerPixel / 8, rows);
+
+    free(band);
+    free(line);
+  }
+
+  cupsRasterClose(ras);
+  close(fd);
+
+  return (0);
+}
+
+
+/*
+ * 'make_label()' - Make a synthetic 2.25x3in label.
+ */
+
+static void
+make_label(void)
+{
+  int		width = 810,		/* Width of label */
+		height = 540,		/* Height of label */
+		x, y, c;		/* Looping vars */
+  unsigned char	*band;			/* Band of lines */
+
+
+  band = malloc(180 * width * 3);
+
+  for (y = 0; y < height; y ++)
+  {
+    for (x = 0; x < width; x ++)
+      for (c = 0; c < 3; c ++)
+      {
+        unsigned char v = 0;
+
+        if (y < 180)
+	  v = ((y % 24) < 16 && ((x / 6 + y / 4) % 7) < 3) ? 255 : 0;
+	else if (y < 360)
+	  v = (x > 40 && x < 770 && ((x * 37 / 11) % 9) < 4) ? 255 : 0;
+	else
+	  v = (x * 255 / width + y * (c + 1) * 3) & 255;
+
+        band[((y % 180) * width + x) * 3 + c] = v;
+      }
+
+    if ((y % 180) == 179)
+      add_band(band, width, 3, 180);
+  }
+
+  free(band);
+}
+
+
+/*
+ * 'main()' - Time each encoder over the passes.
+ */
+
+int					/* O - Exit status */
+main(int  argc,				/* I - Number of command-line args */
+     char *argv[])			/* I - Command-line arguments */
+{
+  int			i,		/* Looping var */
+			impl,		/* Current implementation */
+			iter,		/* Current iteration */
+			iterations = 200;/* Number of iterations */
+  long			comp_bytes,	/* Compressed bytes */
+			ref_bytes = 0;	/* Compressed bytes from reference */
+  unsigned char		*comp,		/* Compression buffer */
+			*ref,		/* Reference output */
+			*check;		/* Decoded output */
+  int			max_length = 0;	/* Longest pass */
+  struct timespec	start, end;	/* Timestamps */
+  double		secs;		/* Elapsed seconds */
+  static const char * const impls[] =	/* Implementations to time */
+  {
+    "scalar",
+    "generic",
+    "sse2",
+    "avx2",
+    "optimal"
+  };
+
+
+  for (i = 1; i < argc; i ++)
+  {
+    if (!strcmp(argv[i], "-i") && i + 1 < argc)
+      iterations = atoi(argv[++ i]);
+    else if (load_raster(argv[i]))
+      return (1);
+  }
+
+  if (!NumPasses)
+    make_label();
+
+  for (i = 0; i < NumPasses; i ++)
+    if (Passes[i].length > max_length)
+      max_length = Passes[i].length;
+
+  comp = malloc(max_length + 256);
+  ref   = malloc(max_length + 256);
+  check = malloc(max_length);
+
+  printf("%d passes, %ld bytes, %d iterations\n", NumPasses, TotalBytes,
+         iterations);
+
+  for (impl = 0; impl < (int)(sizeof(impls) / sizeof(impls[0])); impl ++)
+  {
+    if (tmcPackBitsSelect(impls[impl]))
+    {
+      printf("%-8s not supported on this CPU\n", impls[impl]);
+      continue;
+    }
+
+   /*
+    * Check the output against the reference encoder, or for the optimal
+    * encoder that it decodes and is never longer...
+    */
+
+    for (i = 0, comp_bytes = 0; i < NumPasses; i ++)
+    {
+      int len = tmcPackBits(Passes[i].data, Passes[i].length, comp);
+      int rlen = tmcPackBitsScalar(Passes[i].data, Passes[i].length, ref);
+
+      if (tmcPackBitsExact() && (len != rlen || memcmp(comp, ref, len)))
+      {
+        printf("%-8s output differs from scalar encoder on pass %d!\n",
+	       impls[impl], i);
+        return (1);
+      }
+      else if (!tmcPackBitsExact() &&
+               ((len < Passes[i].length &&
+	         (unpack(comp, len, check, Passes[i].length) !=
+		      Passes[i].length ||
+		  memcmp(check, Passes[i].data, Passes[i].length))) ||
+	        (len > rlen && rlen < Passes[i].length)))
+      {
+        printf("%-8s output is wrong or longer than scalar on pass %d!\n",
+	       impls[impl], i);
+        return (1);
+      }
+
+      comp_bytes += len < Passes[i].length ? len : Passes[i].length;
+    }
+
+    if (impl == 0)
+      ref_bytes = comp_bytes;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (iter = 0; iter < iterations; iter ++)
+      for (i = 0; i < NumPasses; i ++)
+        tmcPackBits(Passes[i].data, Passes[i].length, comp);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + 1e-9 * (end.tv_nsec - start.tv_nsec);
+
+    printf("%-8s %8.1f MB/s  %6.2f ns/byte  %ld -> %ld bytes (%.1f%%)",
+           impls[impl], TotalBytes * (double)iterations / secs / 1e6,
+	   secs * 1e9 / ((double)TotalBytes * iterations), TotalBytes,
+	   comp_bytes, 100.0 * comp_bytes / TotalBytes);
+
+    if (comp_bytes != ref_bytes)
+      printf("  saves %ld bytes (%.2f%%)", ref_bytes - comp_bytes,
+             100.0 * (ref_bytes - comp_bytes) / ref_bytes);
+
+    putchar('\n');
+  }
+
+  return (0);
+}
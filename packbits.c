@@ -0,0 +1,703 @@
+/*
+ * TIFF PackBits encoder for the TM-C6xx filter.
+ *
+ * The fast encoders make the same choices as the original byte-at-a-time
+ * loop: a repeat starts at any two equal bytes, runs stop at 127 bytes, and
+ * a lone last byte goes out as its own literal.  Only the search for the end
+ * of each run is vectorized, comparing 16 (SSE2) or 32 (AVX2) neighbouring
+ * byte pairs at a time, so all of them produce the same bytes.
+ *
+ * The "optimal" encoder instead finds the shortest possible PackBits data,
+ * using 128-byte runs and only breaking a literal for a repeat when that
+ * saves bytes.  It is several times slower and is never picked by default.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "packbits.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define HAVE_X86_SIMD 1
+#  include <immintrin.h>
+#endif /* __GNUC__ && (__x86_64__ || __i386__) */
+
+
+/*
+ * Local types...
+ */
+
+typedef int (*tmc_packbits_cb_t)(const unsigned char *line, int length,
+                                 unsigned char *comp);
+
+
+/*
+ * Local functions...
+ */
+
+static int	packbits_generic(const unsigned char *line, int length,
+		                 unsigned char *comp);
+static int	packbits_optimal(const unsigned char *line, int length,
+		                 unsigned char *comp);
+#ifdef HAVE_X86_SIMD
+static int	packbits_sse2(const unsigned char *line, int length,
+		              unsigned char *comp);
+static int	packbits_avx2(const unsigned char *line, int length,
+		              unsigned char *comp);
+#endif /* HAVE_X86_SIMD */
+
+
+/*
+ * Local globals...
+ */
+
+static const struct
+{
+  const char		*name;		/* Implementation name */
+  tmc_packbits_cb_t	cb;		/* Encoder */
+  int			exact;		/* Same bytes as tmcPackBitsScalar()? */
+}		packbits_impls[] =	/* Available encoders, best last */
+{
+  { "optimal", packbits_optimal, 0 },
+  { "scalar", tmcPackBitsScalar, 1 },
+  { "generic", packbits_generic, 1 },
+#ifdef HAVE_X86_SIMD
+ /*
+  * Runs stop at 127 bytes, so 32-pair blocks rarely pay for themselves;
+  * on label rasters the SSE2 scanners are faster than the AVX2 ones.
+  */
+
+  { "avx2", packbits_avx2, 1 },
+  { "sse2", packbits_sse2, 1 },
+#endif /* HAVE_X86_SIMD */
+};
+static int	packbits_impl = 0;	/* Selected encoder */
+
+
+/*
+ * 'packbits_supported()' - Can this CPU run an encoder?
+ */
+
+static int				/* O - 1 if supported */
+packbits_supported(const char *name)	/* I - Implementation name */
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+
+  if (!strcmp(name, "sse2"))
+    return (__builtin_cpu_supports("sse2"));
+  else if (!strcmp(name, "avx2"))
+    return (__builtin_cpu_supports("avx2"));
+#endif /* HAVE_X86_SIMD */
+
+  (void)name;
+
+  return (1);
+}
+
+
+/*
+ * 'tmcPackBitsInit()' - Pick the fastest encoder for this CPU.
+ *
+ * Call this before starting any threads that compress data.
+ */
+
+void
+tmcPackBitsInit(void)
+{
+  int	i;				/* Looping var */
+
+
+  for (i = (int)(sizeof(packbits_impls) / sizeof(packbits_impls[0])) - 1;
+       i > 0;
+       i --)
+    if (packbits_impls[i].exact && packbits_supported(packbits_impls[i].name))
+      break;
+
+  packbits_impl = i;
+}
+
+
+/*
+ * 'tmcPackBitsSelect()' - Select an encoder by name.
+ */
+
+int					/* O - 0 on success, -1 if unavailable */
+tmcPackBitsSelect(const char *name)	/* I - "scalar", "generic", "sse2", "avx2" or "optimal" */
+{
+  int	i;				/* Looping var */
+
+
+  for (i = 0; i < (int)(sizeof(packbits_impls) / sizeof(packbits_impls[0])); i ++)
+    if (!strcmp(name, packbits_impls[i].name) &&
+        packbits_supported(packbits_impls[i].name))
+    {
+      packbits_impl = i;
+      return (0);
+    }
+
+  return (-1);
+}
+
+
+/*
+ * 'tmcPackBitsName()' - Return the name of the selected encoder.
+ */
+
+const char *				/* O - Implementation name */
+tmcPackBitsName(void)
+{
+  return (packbits_impls[packbits_impl].name);
+}
+
+
+/*
+ * 'tmcPackBitsExact()' - Does the selected encoder match the scalar one?
+ */
+
+int					/* O - 1 if same bytes, 0 otherwise */
+tmcPackBitsExact(void)
+{
+  return (packbits_impls[packbits_impl].exact);
+}
+
+
+/*
+ * 'tmcPackBits()' - Compress data with TIFF PackBits.
+ *
+ * Encoding stops once the output reaches "length" bytes, since the data
+ * is then sent uncompressed; "comp" needs room for length + 128 bytes.
+ */
+
+int					/* O - Number of compressed bytes */
+tmcPackBits(const unsigned char *line,	/* I - Data to compress */
+            int                 length,	/* I - Number of bytes */
+	    unsigned char       *comp)	/* O - Compressed data */
+{
+  return ((*packbits_impls[packbits_impl].cb)(line, length, comp));
+}
+
+
+/*
+ * 'tmcPackBitsScalar()' - Compress data a byte at a time.
+ *
+ * This is the reference encoder the others must match.
+ */
+
+int					/* O - Number of compressed bytes */
+tmcPackBitsScalar(
+    const unsigned char *line,		/* I - Data to compress */
+    int                 length,		/* I - Number of bytes */
+    unsigned char       *comp)		/* O - Compressed data */
+{
+  register const unsigned char *line_ptr,
+					/* Current byte pointer */
+        	*line_end,		/* End-of-line byte pointer */
+        	*start;			/* Start of compression sequence */
+  register unsigned char *comp_ptr;	/* Pointer into compression buffer */
+  register int  count;			/* Count of bytes for output */
+
+
+  line_ptr = line;
+  line_end = line + length;
+  comp_ptr = comp;
+
+  while (line_ptr < line_end && (comp_ptr - comp) < length)
+  {
+    if ((line_ptr + 1) >= line_end)
+    {
+     /*
+      * Single byte on the end...
+      */
+
+      *comp_ptr++ = 0x00;
+      *comp_ptr++ = *line_ptr++;
+    }
+    else if (line_ptr[0] == line_ptr[1])
+    {
+     /*
+      * Repeated sequence...
+      */
+
+      line_ptr ++;
+      count = 2;
+
+      while (line_ptr < (line_end - 1) &&
+             line_ptr[0] == line_ptr[1] &&
+             count < 127)
+      {
+        line_ptr ++;
+        count ++;
+      }
+
+      *comp_ptr++ = 257 - count;
+      *comp_ptr++ = *line_ptr++;
+    }
+    else
+    {
+     /*
+      * Non-repeated sequence...
+      */
+
+      start    = line_ptr;
+      line_ptr ++;
+      count    = 1;
+
+      while (line_ptr < (line_end - 1) &&
+             line_ptr[0] != line_ptr[1] &&
+             count < 127)
+      {
+        line_ptr ++;
+        count ++;
+      }
+
+      *comp_ptr++ = count - 1;
+
+      memcpy(comp_ptr, start, count);
+      comp_ptr += count;
+    }
+  }
+
+  return ((int)(comp_ptr - comp));
+}
+
+
+/*
+ * 'packbits_encode()' - Compress data using the given run scanners.
+ *
+ * "same" returns how many of the byte pairs (p[i], p[i + 1]) for i from 0
+ * to max-1 are equal before the first unequal pair, "differ" the reverse.
+ */
+
+static inline int			/* O - Number of compressed bytes */
+packbits_encode(
+    const unsigned char *line,		/* I - Data to compress */
+    int                 length,		/* I - Number of bytes */
+    unsigned char       *comp,		/* O - Compressed data */
+    int                 (*same)(const unsigned char *p, int max),
+					/* I - Equal pair scanner */
+    int                 (*differ)(const unsigned char *p, int max))
+					/* I - Unequal pair scanner */
+{
+  const unsigned char	*line_ptr,	/* Current byte pointer */
+			*line_end;	/* End-of-line byte pointer */
+  unsigned char		*comp_ptr;	/* Pointer into compression buffer */
+  int			count,		/* Count of bytes for output */
+			max;		/* Number of pairs left to scan */
+
+
+  line_ptr = line;
+  line_end = line + length;
+  comp_ptr = comp;
+
+  while (line_ptr < line_end && (comp_ptr - comp) < length)
+  {
+    if ((line_ptr + 1) >= line_end)
+    {
+      *comp_ptr++ = 0x00;
+      *comp_ptr++ = *line_ptr++;
+      continue;
+    }
+
+    max = (int)(line_end - line_ptr) - 2;
+
+    if (line_ptr[0] == line_ptr[1])
+    {
+      count = 2 + (*same)(line_ptr + 1, max < 125 ? max : 125);
+
+      *comp_ptr++ = 257 - count;
+      *comp_ptr++ = *line_ptr;
+    }
+    else
+    {
+      count = 1 + (*differ)(line_ptr + 1, max < 126 ? max : 126);
+
+      *comp_ptr++ = count - 1;
+
+      memcpy(comp_ptr, line_ptr, count);
+      comp_ptr += count;
+    }
+
+    line_ptr += count;
+  }
+
+  return ((int)(comp_ptr - comp));
+}
+
+
+/*
+ * 'packbits_optimal()' - Compress data to the fewest possible bytes.
+ *
+ * cost[i] is the fewest bytes that encode the first i bytes of data.  The
+ * last token of that encoding is either a literal of 1 to 128 bytes
+ * (1 + k bytes) or a repeat of 2 to 128 equal bytes (2 bytes), so
+ *
+ *   cost[i] = min(cost[j] - j + 1 + i  for i - 128 <= j < i,
+ *                 cost[j] + 2          for i - 128 <= j <= i - 2 and
+ *                                      line[j .. i - 1] all equal)
+ *
+ * Both minimums are over sliding windows, which two monotonic queues of
+ * positions keep in O(1) per byte.  The tokens are then read back from
+ * the end and written out in order.
+ */
+
+static int				/* O - Number of compressed bytes */
+packbits_optimal(
+    const unsigned char *line,		/* I - Data to compress */
+    int                 length,		/* I - Number of bytes */
+    unsigned char       *comp)		/* O - Compressed data */
+{
+  int		*cost,			/* Fewest bytes for each prefix */
+		*lits,			/* Literal start queue */
+		*reps;			/* Repeat start queue */
+  short		*token;			/* Last token: >0 literal, <0 repeat */
+  int		lit_head, lit_tail,	/* Literal queue bounds */
+		rep_head, rep_tail;	/* Repeat queue bounds */
+  int		i, j,			/* Looping vars */
+		best,			/* Cost of best token */
+		count;			/* Bytes in token */
+  unsigned char	*comp_ptr;		/* Pointer into compression buffer */
+
+
+  if (length <= 0)
+    return (0);
+
+  cost  = malloc(3 * (length + 1) * sizeof(int));
+  token = malloc((length + 1) * sizeof(short));
+
+  if (!cost || !token)
+  {
+    free(cost);
+    free(token);
+
+    return (tmcPackBitsScalar(line, length, comp));
+  }
+
+  lits = cost + length + 1;
+  reps = lits + length + 1;
+
+  cost[0]  = 0;
+  lit_head = lit_tail = 0;
+  rep_head = rep_tail = 0;
+
+  for (i = 1; i <= length; i ++)
+  {
+   /*
+    * Literals can start anywhere in the last 128 bytes...
+    */
+
+    j = i - 1;
+
+    while (lit_tail > lit_head &&
+           cost[lits[lit_tail - 1]] - lits[lit_tail - 1] >= cost[j] - j)
+      lit_tail --;
+
+    lits[lit_tail ++] = j;
+
+    if (lits[lit_head] < i - 128)
+      lit_head ++;
+
+    j        = lits[lit_head];
+    best     = cost[j] - j + 1 + i;
+    token[i] = (short)(i - j);
+
+   /*
+    * Repeats can start anywhere in the last 128 bytes of the current run
+    * of equal bytes...
+    */
+
+    if (i >= 2 && line[i - 1] == line[i - 2])
+    {
+      j = i - 2;
+
+      while (rep_tail > rep_head && cost[reps[rep_tail - 1]] >= cost[j])
+	rep_tail --;
+
+      reps[rep_tail ++] = j;
+
+      if (reps[rep_head] < i - 128)
+        rep_head ++;
+
+      j = reps[rep_head];
+
+      if (cost[j] + 2 < best)
+      {
+        best     = cost[j] + 2;
+	token[i] = (short)(j - i);
+      }
+    }
+    else
+      rep_head = rep_tail = 0;
+
+    cost[i] = best;
+  }
+
+  if ((count = cost[length]) < length)
+  {
+   /*
+    * Move each token to where it starts, then write them in order...
+    */
+
+    for (i = length; i > 0; i = j)
+    {
+      j        = i - abs(token[i]);
+      lits[j]  = token[i];
+    }
+
+    for (i = 0, comp_ptr = comp; i < length; i += abs(lits[i]))
+    {
+      if (lits[i] > 0)
+      {
+        *comp_ptr++ = lits[i] - 1;
+	memcpy(comp_ptr, line + i, lits[i]);
+	comp_ptr += lits[i];
+      }
+      else
+      {
+        *comp_ptr++ = 257 + lits[i];
+	*comp_ptr++ = line[i];
+      }
+    }
+  }
+
+  free(cost);
+  free(token);
+
+  return (count);
+}
+
+
+/*
+ * 'same_generic()' - Count equal byte pairs.
+ */
+
+static inline int			/* O - Number of equal pairs */
+same_generic(const unsigned char *p,	/* I - Data */
+             int                 max)	/* I - Maximum pairs */
+{
+  int	n;				/* Pair count */
+
+
+  for (n = 0; n < max && p[n] == p[n + 1]; n ++);
+
+  return (n);
+}
+
+
+/*
+ * 'differ_generic()' - Count unequal byte pairs.
+ */
+
+static inline int			/* O - Number of unequal pairs */
+differ_generic(const unsigned char *p,	/* I - Data */
+               int                 max)	/* I - Maximum pairs */
+{
+  int	n;				/* Pair count */
+
+
+  for (n = 0; n < max && p[n] != p[n + 1]; n ++);
+
+  return (n);
+}
+
+
+/*
+ * 'packbits_generic()' - Compress data with the portable run scanners.
+ */
+
+static int				/* O - Number of compressed bytes */
+packbits_generic(
+    const unsigned char *line,		/* I - Data to compress */
+    int                 length,		/* I - Number of bytes */
+    unsigned char       *comp)		/* O - Compressed data */
+{
+  return (packbits_encode(line, length, comp, same_generic, differ_generic));
+}
+
+
+#ifdef HAVE_X86_SIMD
+/*
+ * 'pairs_sse2()' - Get the equal pair mask for 16 byte pairs.
+ */
+
+__attribute__((target("sse2")))
+static inline unsigned			/* O - Bit N set if p[N] == p[N + 1] */
+pairs_sse2(const unsigned char *p)	/* I - Data */
+{
+  return ((unsigned)_mm_movemask_epi8(
+              _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+	                     _mm_loadu_si128((const __m128i *)(p + 1)))));
+}
+
+
+/*
+ * 'pairs_avx2()' - Get the equal pair mask for 32 byte pairs.
+ */
+
+__attribute__((target("avx2")))
+static inline unsigned			/* O - Bit N set if p[N] == p[N + 1] */
+pairs_avx2(const unsigned char *p)	/* I - Data */
+{
+  return ((unsigned)_mm256_movemask_epi8(
+              _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p),
+	                        _mm256_loadu_si256((const __m256i *)(p + 1)))));
+}
+
+
+/*
+ * 'scan_sse2()' - Count pairs matching "want", 16 at a time.
+ *
+ * "want" is 0 to count equal pairs and ~0 to count unequal ones.  The last
+ * partial block is handled by re-reading the final 16 pairs and skipping
+ * the ones already counted, so nothing is read past p[max].
+ */
+
+__attribute__((target("sse2")))
+static inline int			/* O - Number of matching pairs */
+scan_sse2(const unsigned char *p,	/* I - Data */
+          int                 max,	/* I - Maximum pairs */
+	  unsigned            want)	/* I - Mask of a stop pair */
+{
+  int		n;			/* Pair count */
+  unsigned	stops;			/* Pairs that end the run */
+
+
+  if (max < 16)
+    return (want ? differ_generic(p, max) : same_generic(p, max));
+
+  for (n = 0; n + 16 <= max; n += 16)
+    if ((stops = (pairs_sse2(p + n) ^ 0xffff ^ want) & 0xffff) != 0)
+      return (n + __builtin_ctz(stops));
+
+  if (n < max)
+  {
+    stops = ((pairs_sse2(p + max - 16) ^ 0xffff ^ want) & 0xffff) >> (n + 16 - max);
+
+    if (stops)
+      return (n + __builtin_ctz(stops));
+  }
+
+  return (max);
+}
+
+
+/*
+ * 'same_sse2()' - Count equal byte pairs, 16 at a time.
+ */
+
+__attribute__((target("sse2")))
+static inline int			/* O - Number of equal pairs */
+same_sse2(const unsigned char *p,	/* I - Data */
+          int                 max)	/* I - Maximum pairs */
+{
+  return (scan_sse2(p, max, 0));
+}
+
+
+/*
+ * 'differ_sse2()' - Count unequal byte pairs, 16 at a time.
+ */
+
+__attribute__((target("sse2")))
+static inline int			/* O - Number of unequal pairs */
+differ_sse2(const unsigned char *p,	/* I - Data */
+            int                 max)	/* I - Maximum pairs */
+{
+  return (scan_sse2(p, max, ~0U));
+}
+
+
+/*
+ * 'packbits_sse2()' - Compress data with the SSE2 run scanners.
+ */
+
+__attribute__((target("sse2")))
+static int				/* O - Number of compressed bytes */
+packbits_sse2(const unsigned char *line,/* I - Data to compress */
+              int                 length,
+					/* I - Number of bytes */
+	      unsigned char       *comp)/* O - Compressed data */
+{
+  return (packbits_encode(line, length, comp, same_sse2, differ_sse2));
+}
+
+
+/*
+ * 'scan_avx2()' - Count pairs matching "want", 32 at a time.
+ */
+
+__attribute__((target("avx2")))
+static inline int			/* O - Number of matching pairs */
+scan_avx2(const unsigned char *p,	/* I - Data */
+          int                 max,	/* I - Maximum pairs */
+	  unsigned            want)	/* I - Mask of a stop pair */
+{
+  int		n;			/* Pair count */
+  unsigned	stops;			/* Pairs that end the run */
+
+
+  if (max < 32)
+    return (scan_sse2(p, max, want));
+
+  for (n = 0; n + 32 <= max; n += 32)
+    if ((stops = pairs_avx2(p + n) ^ ~want) != 0)
+      return (n + __builtin_ctz(stops));
+
+  if (n < max)
+  {
+    stops = (pairs_avx2(p + max - 32) ^ ~want) >> (n + 32 - max);
+
+    if (stops)
+      return (n + __builtin_ctz(stops));
+  }
+
+  return (max);
+}
+
+
+/*
+ * 'same_avx2()' - Count equal byte pairs, 32 at a time.
+ */
+
+__attribute__((target("avx2")))
+static inline int			/* O - Number of equal pairs */
+same_avx2(const unsigned char *p,	/* I - Data */
+          int                 max)	/* I - Maximum pairs */
+{
+  return (scan_avx2(p, max, 0));
+}
+
+
+/*
+ * 'differ_avx2()' - Count unequal byte pairs, 32 at a time.
+ */
+
+__attribute__((target("avx2")))
+static inline int			/* O - Number of unequal pairs */
+differ_avx2(const unsigned char *p,	/* I - Data */
+            int                 max)	/* I - Maximum pairs */
+{
+  return (scan_avx2(p, max, ~0U));
+}
+
+
+/*
+ * 'packbits_avx2()' - Compress data with the AVX2 run scanners.
+ */
+
+__attribute__((target("avx2")))
+static int				/* O - Number of compressed bytes */
+packbits_avx2(const unsigned char *line,/* I - Data to compress */
+              int                 length,
+					/* I - Number of bytes */
+	      unsigned char       *comp)/* O - Compressed data */
+{
+  return (packbits_encode(line, length, comp, same_avx2, differ_avx2));
+}
+#endif /* HAVE_X86_SIMD */
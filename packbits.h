@@ -0,0 +1,24 @@
+/*
+ * TIFF PackBits encoder for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_PACKBITS_H_
+#  define _TMC6XX_PACKBITS_H_
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcPackBitsInit(void);
+extern int		tmcPackBitsSelect(const char *name);
+extern const char	*tmcPackBitsName(void);
+extern int		tmcPackBitsExact(void);
+extern int		tmcPackBits(const unsigned char *line, int length,
+			            unsigned char *comp);
+extern int		tmcPackBitsScalar(const unsigned char *line, int length,
+			                  unsigned char *comp);
+
+#endif /* !_TMC6XX_PACKBITS_H_ */
@@ -0,0 +1,322 @@
+/*
+ * Synthetic CUPS raster generator for the TM-C6xx filter benchmark.
+ *
+ * Usage:
+ *
+ *   raster-gen [-d directory] [-s seed]
+ *
+ * Writes the benchmark workloads as compressed 360x180dpi RGB raster files,
+ * with the same page setup the ColorModel option of ep_tmc610.ppd asks for:
+ *
+ *   text.ras     20 pages of 2.25x3.5in labels with lines of text
+ *   photo.ras    5 full-bleed 2.25x3.5in photos
+ *   barcode.ras  20 pages of 2.25x2in labels with barcode stripes
+ *   roll.ras     one 2.25x1000in page at MaxSize, mixing all three
+ *
+ * The content only depends on the seed, so results from different runs and
+ * different machines can be compared.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include <cups/raster.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+/*
+ * Constants...
+ */
+
+#define RES_X		360		/* Horizontal resolution */
+#define RES_Y		180		/* Vertical resolution */
+#define LABEL_WIDTH	162		/* 2.25in in points */
+
+
+/*
+ * Types...
+ */
+
+typedef enum kind_e			/**** Content of a band of lines ****/
+{
+  KIND_TEXT,				/* Black and red text on white */
+  KIND_PHOTO,				/* Full-bleed gradients and noise */
+  KIND_BARCODE				/* Black stripes on white */
+} kind_t;
+
+
+/*
+ * Globals...
+ */
+
+static unsigned	Seed = 1;		/* Random number state */
+
+
+/*
+ * Local functions...
+ */
+
+static unsigned	next_random(void);
+static void	make_line(unsigned char *line, int width, kind_t kind, int y,
+		          const unsigned char *glyphs, const unsigned char *bars);
+static int	write_file(const char *dir, const char *name, int pages,
+		           int length, kind_t kind);
+
+
+/*
+ * 'main()' - Write the benchmark raster files.
+ */
+
+int					/* O - Exit status */
+main(int  argc,				/* I - Number of command-line args */
+     char *argv[])			/* I - Command-line arguments */
+{
+  int		i;			/* Looping var */
+  const char	*dir = ".";		/* Output directory */
+  unsigned	seed = 1;		/* Random seed */
+
+
+  for (i = 1; i < argc; i ++)
+    if (!strcmp(argv[i], "-d") && i + 1 < argc)
+      dir = argv[++ i];
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+      seed = (unsigned)strtoul(argv[++ i], NULL, 10);
+    else
+    {
+      fputs("Usage: raster-gen [-d directory] [-s seed]\n", stderr);
+      return (1);
+    }
+
+ /*
+  * Each file starts from the same seed so that adding a workload doesn't
+  * change the others...
+  */
+
+  Seed = seed;
+  if (write_file(dir, "text.ras", 20, 252, KIND_TEXT))
+    return (1);
+
+  Seed = seed;
+  if (write_file(dir, "photo.ras", 5, 252, KIND_PHOTO))
+    return (1);
+
+  Seed = seed;
+  if (write_file(dir, "barcode.ras", 20, 144, KIND_BARCODE))
+    return (1);
+
+  Seed = seed;
+  if (write_file(dir, "roll.ras", 1, 72000, -1))
+    return (1);
+
+  return (0);
+}
+
+
+/*
+ * 'next_random()' - Return the next value of a small LCG.
+ */
+
+static unsigned				/* O - Random value (0 to 32767) */
+next_random(void)
+{
+  Seed = Seed * 1103515245 + 12345;
+
+  return ((Seed >> 16) & 32767);
+}
+
+
+/*
+ * 'make_line()' - Fill one RGB line.
+ */
+
+static void
+make_line(unsigned char       *line,	/* I - Line buffer */
+          int                 width,	/* I - Pixels in line */
+	  kind_t              kind,	/* I - Content */
+	  int                 y,	/* I - Line in page */
+	  const unsigned char *glyphs,	/* I - Text glyph columns */
+	  const unsigned char *bars)	/* I - Barcode modules */
+{
+  int		x;			/* Current column */
+  unsigned char	*ptr;			/* Current pixel */
+
+
+  memset(line, 255, width * 3);
+
+  switch (kind)
+  {
+    case KIND_TEXT :
+       /*
+        * 18-line text rows with 12 lines of glyphs, the first of every
+	* four rows in red...
+	*/
+
+        if ((y % 18) >= 12)
+	  break;
+
+        for (x = 0, ptr = line; x < width; x ++, ptr += 3)
+	  if (glyphs[(x / 2) % 256] & (1 << ((y % 18) * 2 / 3)))
+	  {
+	    ptr[0] = (y / 18) % 4 ? 0 : 200;
+	    ptr[1] = 0;
+	    ptr[2] = 0;
+	  }
+        break;
+
+    case KIND_PHOTO :
+       /*
+        * Smooth gradients with a little noise, so nothing compresses well...
+	*/
+
+        for (x = 0, ptr = line; x < width; x ++, ptr += 3)
+	{
+	  int noise = (int)(next_random() & 15) - 8;
+	  int r = x * 255 / width + noise;
+	  int g = (y / 2) % 256 + noise;
+	  int b = 255 - (x + y) % 256 + noise;
+
+          ptr[0] = r < 0 ? 0 : r > 255 ? 255 : r;
+          ptr[1] = g < 0 ? 0 : g > 255 ? 255 : g;
+          ptr[2] = b < 0 ? 0 : b > 255 ? 255 : b;
+	}
+        break;
+
+    case KIND_BARCODE :
+       /*
+        * 1in of stripes between white quiet zones...
+	*/
+
+        if ((y % (2 * RES_Y)) < RES_Y / 2 || (y % (2 * RES_Y)) >= RES_Y * 3 / 2)
+	  break;
+
+        for (x = 40, ptr = line + 40 * 3; x < width - 40; x ++, ptr += 3)
+	  if (bars[((x - 40) / 3) % 256])
+	    ptr[0] = ptr[1] = ptr[2] = 0;
+        break;
+  }
+}
+
+
+/*
+ * 'write_file()' - Write one workload.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+write_file(const char *dir,		/* I - Output directory */
+           const char *name,		/* I - Filename */
+           int        pages,		/* I - Number of pages */
+	   int        length,		/* I - Page length in points */
+	   kind_t     kind)		/* I - Content, -1 for a mix */
+{
+  int			fd;		/* Output file */
+  char			filename[1024];	/* Output filename */
+  cups_raster_t		*ras;		/* Raster stream */
+  cups_page_header2_t	header;		/* Page header */
+  unsigned char		*line,		/* Line buffer */
+			glyphs[256],	/* Text glyph columns */
+			bars[256];	/* Barcode modules */
+  int			page,		/* Current page */
+			y,		/* Current line */
+			i;		/* Looping var */
+
+
+  snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+
+  if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    perror(filename);
+    return (-1);
+  }
+
+  if ((ras = cupsRasterOpen(fd, CUPS_RASTER_WRITE_COMPRESSED)) == NULL)
+  {
+    perror(filename);
+    close(fd);
+    return (-1);
+  }
+
+  for (i = 0; i < 256; i ++)
+  {
+    glyphs[i] = (i % 6) == 5 ? 0 : next_random() & 255;
+    bars[i]   = next_random() & 1;
+  }
+
+  memset(&header, 0, sizeof(header));
+
+  strcpy(header.MediaClass, "PwgRaster");
+  strcpy(header.MediaType, "Plain");
+
+  header.HWResolution[0]  = RES_X;
+  header.HWResolution[1]  = RES_Y;
+  header.PageSize[0]      = LABEL_WIDTH;
+  header.PageSize[1]      = length;
+  header.ImagingBoundingBox[2] = LABEL_WIDTH;
+  header.ImagingBoundingBox[3] = length;
+  header.NumCopies        = 1;
+  header.CutMedia         = CUPS_CUT_PAGE;
+  header.cupsWidth        = LABEL_WIDTH * RES_X / 72;
+  header.cupsHeight       = length * RES_Y / 72;
+  header.cupsBitsPerColor = 8;
+  header.cupsBitsPerPixel = 24;
+  header.cupsBytesPerLine = header.cupsWidth * 3;
+  header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+  header.cupsColorSpace   = CUPS_CSPACE_RGB;
+  header.cupsCompression  = 1;
+  header.cupsNumColors    = 3;
+
+  if ((line = malloc(header.cupsBytesPerLine)) == NULL)
+  {
+    perror(filename);
+    cupsRasterClose(ras);
+    close(fd);
+    return (-1);
+  }
+
+  for (page = 0; page < pages; page ++)
+  {
+    cupsRasterWriteHeader2(ras, &header);
+
+    for (y = 0; y < (int)header.cupsHeight; y ++)
+    {
+     /*
+      * The roll cycles through 3in of each kind of content...
+      */
+
+      make_line(line, header.cupsWidth,
+                kind == (kind_t)-1 ? (kind_t)((y / (3 * RES_Y)) % 3) : kind,
+		y, glyphs, bars);
+
+      if (cupsRasterWritePixels(ras, line, header.cupsBytesPerLine) <
+              header.cupsBytesPerLine)
+      {
+        perror(filename);
+	free(line);
+	cupsRasterClose(ras);
+	close(fd);
+	return (-1);
+      }
+    }
+  }
+
+  free(line);
+  cupsRasterClose(ras);
+
+  if (close(fd))
+  {
+    perror(filename);
+    return (-1);
+  }
+
+  printf("%s: %d pages of %ux%u\n", filename, pages, header.cupsWidth,
+         header.cupsHeight);
+
+  return (0);
+}
@@ -0,0 +1,234 @@
+/*
+ * Raster reader checks for the TM-C6xx filter.
+ *
+ * Usage:
+ *
+ *   raster-test
+ *
+ * Writes small CUPS and Apple raster streams to a temporary file and checks
+ * that tmcRasterReadHeader() accepts well-formed page headers and rejects
+ * ones whose line length doesn't hold cupsWidth pixels, which the filter
+ * would otherwise read past the end of.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "raster.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Local functions...
+ */
+
+static int	read_cups(unsigned width, unsigned bits, unsigned bytes,
+		          cups_order_t order);
+static int	read_apple(unsigned width, unsigned bits);
+static int	read_stream(const void *data, size_t length);
+static void	put_be32(unsigned char *p, unsigned v);
+
+
+/*
+ * 'main()' - Run the checks.
+ */
+
+int					/* O - Exit status */
+main(void)
+{
+  int		failed = 0;		/* Number of failed checks */
+  const struct
+  {
+    const char	*name;			/* Description */
+    int		result,			/* Header read? */
+		expected;		/* Should it be? */
+  }		checks[] =		/* Checks to run */
+  {
+    { "CUPS 100px RGB line",
+      read_cups(100, 24, 300, CUPS_ORDER_CHUNKED), 1 },
+    { "CUPS 100px 1-bit line",
+      read_cups(100, 1, 13, CUPS_ORDER_CHUNKED), 1 },
+    { "CUPS 100px banded RGB line",
+      read_cups(100, 8, 300, CUPS_ORDER_BANDED), 1 },
+    { "CUPS line shorter than its width",
+      read_cups(100, 24, 30, CUPS_ORDER_CHUNKED), 0 },
+    { "CUPS line longer than its width",
+      read_cups(100, 24, 600, CUPS_ORDER_CHUNKED), 0 },
+    { "CUPS width that wraps the line length",
+      read_cups(0x80000000U, 24, 3, CUPS_ORDER_CHUNKED), 0 },
+    { "CUPS banded line shorter than one band",
+      read_cups(100, 8, 3, CUPS_ORDER_BANDED), 0 },
+    { "CUPS 256 bits per pixel",
+      read_cups(1, 256, 32, CUPS_ORDER_CHUNKED), 0 },
+    { "Apple 100px RGB line",
+      read_apple(100, 24), 1 },
+    { "Apple width that wraps the line length",
+      read_apple(0x20000000U, 32), 0 },
+    { "Apple width that wraps to a short line",
+      read_apple(0x55555556U, 24), 0 },
+    { "Apple 12 bits per pixel",
+      read_apple(100, 12), 0 }
+  };
+  size_t	i;			/* Looping var */
+
+
+  for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i ++)
+  {
+    if (checks[i].result == checks[i].expected)
+      printf("PASS: %s\n", checks[i].name);
+    else
+    {
+      printf("FAIL: %s (header %s)\n", checks[i].name,
+             checks[i].result ? "accepted" : "rejected");
+      failed ++;
+    }
+  }
+
+  return (failed != 0);
+}
+
+
+/*
+ * 'read_cups()' - Read the header of a one-line CUPS raster page.
+ */
+
+static int				/* O - 1 if the header was read */
+read_cups(unsigned     width,		/* I - cupsWidth */
+          unsigned     bits,		/* I - cupsBitsPerPixel */
+	  unsigned     bytes,		/* I - cupsBytesPerLine */
+	  cups_order_t order)		/* I - cupsColorOrder */
+{
+  unsigned char		*data;		/* Raster stream */
+  size_t		length;		/* Length of stream */
+  cups_page_header2_t	header;		/* Page header */
+  unsigned		sync = 0x52615333;
+					/* "RaS3", uncompressed */
+  int			status;		/* Result */
+
+
+  memset(&header, 0, sizeof(header));
+
+  header.cupsWidth        = width;
+  header.cupsHeight       = 1;
+  header.cupsBitsPerPixel = bits;
+  header.cupsBitsPerColor = order == CUPS_ORDER_CHUNKED && bits == 24 ?
+                                8 : bits;
+  header.cupsBytesPerLine = bytes;
+  header.cupsColorOrder   = order;
+  header.cupsColorSpace   = CUPS_CSPACE_RGB;
+  header.cupsNumColors    = 3;
+
+  length = sizeof(sync) + sizeof(header) + bytes;
+
+  if ((data = calloc(1, length)) == NULL)
+    return (-1);
+
+  memcpy(data, &sync, sizeof(sync));
+  memcpy(data + sizeof(sync), &header, sizeof(header));
+
+  status = read_stream(data, length);
+
+  free(data);
+
+  return (status);
+}
+
+
+/*
+ * 'read_apple()' - Read the header of a one-line Apple raster page.
+ */
+
+static int				/* O - 1 if the header was read */
+read_apple(unsigned width,		/* I - Width in pixels */
+           unsigned bits)		/* I - Bits per pixel */
+{
+  unsigned char	data[12 + 32 + 300];	/* Raster stream */
+
+
+  memset(data, 0, sizeof(data));
+
+  memcpy(data, "UNIRAST", 8);
+  put_be32(data + 8, 1);		/* Pages */
+
+  data[12] = bits;
+  data[13] = 1;				/* sRGB */
+  data[14] = 1;				/* Duplex */
+  data[15] = 4;				/* Quality */
+  put_be32(data + 24, width);
+  put_be32(data + 28, 1);		/* Height */
+  put_be32(data + 32, 360);		/* Resolution */
+
+ /*
+  * One line of 100 white pixels...
+  */
+
+  data[44] = 0;				/* Line repeat */
+  data[45] = 99;			/* Pixel repeat */
+  memset(data + 46, 255, 3);
+
+  return (read_stream(data, 49));
+}
+
+
+/*
+ * 'read_stream()' - Read the first page header from a raster stream.
+ */
+
+static int				/* O - 1 if the header was read */
+read_stream(const void *data,		/* I - Raster stream */
+            size_t     length)		/* I - Length of stream */
+{
+  FILE			*fp;		/* Temporary file */
+  tmc_raster_t		*r;		/* Raster stream */
+  cups_page_header2_t	header;		/* Page header */
+  int			status;		/* Result */
+
+
+  if ((fp = tmpfile()) == NULL)
+  {
+    perror("raster-test");
+    exit(1);
+  }
+
+  if (fwrite(data, 1, length, fp) != length || fflush(fp))
+  {
+    perror("raster-test");
+    exit(1);
+  }
+
+  rewind(fp);
+
+  if ((r = tmcRasterOpen(fileno(fp))) == NULL)
+  {
+    fclose(fp);
+    return (-1);
+  }
+
+  status = tmcRasterReadHeader(r, &header);
+
+  tmcRasterClose(r);
+  fclose(fp);
+
+  return (status);
+}
+
+
+/*
+ * 'put_be32()' - Store a big-endian 32-bit value.
+ */
+
+static void
+put_be32(unsigned char *p,		/* I - Buffer */
+         unsigned      v)		/* I - Value */
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
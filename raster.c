@@ -0,0 +1,793 @@
+/*
+ * Bulk CUPS, PWG and Apple raster reader for the TM-C6xx filter.
+ *
+ * cupsRasterReadPixels() returns one line per call, through a copy of the
+ * line and (for compressed rasters) small reads from the file.  This reader
+ * maps a raster file into memory, or reads a pipe in large chunks, and
+ * decodes the line-repeat and run-length encoding of any number of lines
+ * straight into the caller's buffer, so the filter reads a whole band at a
+ * time.
+ *
+ * It handles the same streams as libcups: version 1, 2 and 3 rasters in
+ * either byte order (RaSt, RaS2, RaS3 and their reverses), which includes
+ * PWG raster (big-endian RaS2), and Apple raster (UNIRAST), whose short
+ * page headers are turned into CUPS page headers with a MediaClass of
+ * "PwgRaster" as libcups does.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "raster.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * Constants...
+ */
+
+#define RASTER_SYNCv1		0x52615374	/* "RaSt" */
+#define RASTER_REVSYNCv1	0x74536152	/* "tSaR" */
+#define RASTER_SYNCv2		0x52615332	/* "RaS2" */
+#define RASTER_REVSYNCv2	0x32536152	/* "2SaR" */
+#define RASTER_SYNCv3		0x52615333	/* "RaS3" */
+#define RASTER_REVSYNCv3	0x33536152	/* "3SaR" */
+#define RASTER_APPLE		"UNIRAST"	/* Apple raster file identifier */
+#define RASTER_APPLE_HEADER	32	/* Bytes in Apple raster page header */
+
+#define RASTER_BUFFER		(1024 * 1024)
+					/* Bytes per read from a pipe */
+#define RASTER_RELEASE		(4 * 1024 * 1024)
+					/* Bytes of mapped file to drop at once */
+
+
+/*
+ * Types...
+ */
+
+struct tmc_raster_s			/**** Raster stream ****/
+{
+  int			fd;		/* File descriptor */
+  unsigned char		*map,		/* Mapped file or NULL */
+			*buffer;	/* Read buffer or NULL */
+  size_t		map_size;	/* Size of mapping */
+  const unsigned char	*ptr,		/* Next byte to decode */
+			*end,		/* End of data */
+			*released;	/* End of mapping dropped so far */
+  int			compressed,	/* Version 2 raster? */
+			swapped,	/* Other byte order? */
+			apple;		/* Apple raster? */
+  unsigned		apple_pages;	/* Pages in Apple raster file */
+  cups_page_header2_t	header;		/* Current page header */
+  unsigned		bpp,		/* Bytes per run-length unit */
+			remaining,	/* Lines left on page */
+			repeat,		/* Copies of last line still to return */
+			step;		/* Lines read per line returned */
+  unsigned char		white;		/* Blank value for end-of-line runs */
+  unsigned char		*line;		/* Last line, when repeat continues */
+};
+
+
+/*
+ * Local functions...
+ */
+
+static int	apple_header(tmc_raster_t *r);
+static size_t	copy_bytes(tmc_raster_t *r, unsigned char *dst, size_t length);
+static int	decode_line(tmc_raster_t *r, unsigned char *dst);
+static int	fill(tmc_raster_t *r, size_t length);
+static unsigned	get_be32(const unsigned char *p);
+static unsigned	read_lines(tmc_raster_t *r, unsigned char *buffer,
+		           unsigned lines);
+static void	release(tmc_raster_t *r);
+static void	swap_header(cups_page_header2_t *header);
+
+
+/*
+ * 'tmcRasterClose()' - Close a raster stream.
+ *
+ * The file descriptor is left open.
+ */
+
+void
+tmcRasterClose(tmc_raster_t *r)		/* I - Raster stream */
+{
+  if (!r)
+    return;
+
+  if (r->map)
+    munmap(r->map, r->map_size);
+
+  free(r->buffer);
+  free(r->line);
+  free(r);
+}
+
+
+/*
+ * 'tmcRasterMapped()' - Return whether a raster stream is memory mapped.
+ */
+
+int					/* O - 1 if mapped, 0 if read */
+tmcRasterMapped(tmc_raster_t *r)	/* I - Raster stream */
+{
+  return (r->map != NULL);
+}
+
+
+/*
+ * 'tmcRasterOpen()' - Open a raster stream for reading.
+ *
+ * Regular files are mapped from the current offset to the end; anything
+ * else (or a file that cannot be mapped) is read in large chunks.
+ */
+
+tmc_raster_t *				/* O - Raster stream or NULL */
+tmcRasterOpen(int fd)			/* I - File descriptor */
+{
+  tmc_raster_t	*r;			/* Raster stream */
+  struct stat	st;			/* File information */
+  int		have_st;		/* Got file information? */
+  off_t		offset;			/* Current offset in file */
+  unsigned	sync;			/* Synchronization word */
+
+
+  if ((r = calloc(1, sizeof(tmc_raster_t))) == NULL)
+    return (NULL);
+
+  r->fd = fd;
+
+  have_st = !fstat(fd, &st);
+
+  if (have_st && S_ISREG(st.st_mode) &&
+      (offset = lseek(fd, 0, SEEK_CUR)) >= 0 && st.st_size > offset)
+  {
+    r->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (r->map == MAP_FAILED)
+      r->map = NULL;
+    else
+    {
+      r->map_size = (size_t)st.st_size;
+      r->ptr      = r->map + offset;
+      r->end      = r->map + r->map_size;
+      r->released = r->map;
+
+      madvise(r->map, r->map_size, MADV_SEQUENTIAL);
+    }
+  }
+
+  if (!r->map)
+  {
+    if ((r->buffer = malloc(RASTER_BUFFER)) == NULL)
+    {
+      free(r);
+      return (NULL);
+    }
+
+    r->ptr = r->end = r->buffer;
+
+#ifdef F_SETPIPE_SZ
+   /*
+    * A bigger pipe lets the writer run further ahead of us...
+    */
+
+    if (have_st && S_ISFIFO(st.st_mode))
+      fcntl(fd, F_SETPIPE_SZ, RASTER_BUFFER);
+#endif /* F_SETPIPE_SZ */
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+
+ /*
+  * Check the synchronization word...
+  */
+
+  if (!fill(r, sizeof(sync)))
+  {
+    tmcRasterClose(r);
+    return (NULL);
+  }
+
+  if (!memcmp(r->ptr, RASTER_APPLE, sizeof(sync)))
+  {
+   /*
+    * Apple raster starts with "UNIRAST", a nul and the number of pages,
+    * and is always compressed...
+    */
+
+    if (!fill(r, sizeof(RASTER_APPLE) + 4) ||
+        memcmp(r->ptr, RASTER_APPLE, sizeof(RASTER_APPLE)))
+    {
+      tmcRasterClose(r);
+      return (NULL);
+    }
+
+    r->apple_pages = get_be32(r->ptr + sizeof(RASTER_APPLE));
+    r->ptr         += sizeof(RASTER_APPLE) + 4;
+    r->apple       = 1;
+    r->compressed  = 1;
+
+    return (r);
+  }
+
+  memcpy(&sync, r->ptr, sizeof(sync));
+  r->ptr += sizeof(sync);
+
+  switch (sync)
+  {
+    case RASTER_REVSYNCv1 :
+    case RASTER_REVSYNCv3 :
+        r->swapped = 1;
+	/* Fall through */
+    case RASTER_SYNCv1 :
+    case RASTER_SYNCv3 :
+        break;
+
+    case RASTER_REVSYNCv2 :
+        r->swapped = 1;
+	/* Fall through */
+    case RASTER_SYNCv2 :
+        r->compressed = 1;
+        break;
+
+    default :
+        tmcRasterClose(r);
+	return (NULL);
+  }
+
+  return (r);
+}
+
+
+/*
+ * 'tmcRasterReadHeader()' - Read the header of the next page.
+ *
+ * Any lines left on the previous page are skipped.
+ */
+
+int					/* O - 1 on success, 0 at end of stream */
+tmcRasterReadHeader(
+    tmc_raster_t        *r,		/* I - Raster stream */
+    cups_page_header2_t *header)	/* O - Page header */
+{
+  unsigned	lines;			/* Lines on the page */
+  unsigned long long bytes;		/* Bytes in a line of cupsWidth pixels */
+
+
+  while (r->remaining)
+    if (!tmcRasterReadLines(r, r->line, 1))
+      return (0);
+
+  if (r->apple)
+  {
+    if (!apple_header(r))
+      return (0);
+  }
+  else
+  {
+    if (!fill(r, sizeof(cups_page_header2_t)))
+      return (0);
+
+    memcpy(&r->header, r->ptr, sizeof(cups_page_header2_t));
+    r->ptr += sizeof(cups_page_header2_t);
+
+    if (r->swapped)
+      swap_header(&r->header);
+  }
+
+ /*
+  * Run-length units are pixels for chunked data and colors otherwise...
+  */
+
+  if (r->header.cupsColorOrder == CUPS_ORDER_CHUNKED)
+    r->bpp = (r->header.cupsBitsPerPixel + 7) / 8;
+  else
+    r->bpp = (r->header.cupsBitsPerColor + 7) / 8;
+
+  if (r->header.cupsBitsPerPixel > 240 ||
+      r->header.cupsBytesPerLine == 0 || r->header.cupsHeight == 0 ||
+      r->bpp == 0 || (r->header.cupsBytesPerLine % r->bpp) != 0)
+    return (0);
+
+ /*
+  * Like libcups, don't trust a line length that doesn't match the width,
+  * since the filter reads cupsWidth pixels from every line...
+  */
+
+  bytes = ((unsigned long long)r->header.cupsWidth *
+           r->header.cupsBitsPerPixel + 7) / 8;
+
+  if (r->header.cupsColorOrder == CUPS_ORDER_BANDED)
+  {
+    if (bytes == 0 || (r->header.cupsBytesPerLine % bytes) != 0)
+      return (0);
+  }
+  else if (r->header.cupsBytesPerLine != bytes)
+    return (0);
+
+  lines = r->header.cupsHeight;
+
+  if (r->header.cupsColorOrder == CUPS_ORDER_PLANAR &&
+      r->header.cupsNumColors > 1)
+    lines *= r->header.cupsNumColors;
+
+  free(r->line);
+
+  if ((r->line = malloc(r->header.cupsBytesPerLine)) == NULL)
+    return (0);
+
+  r->remaining = lines;
+  r->repeat    = 0;
+  r->step      = 1;
+
+ /*
+  * Runs that fill the rest of a line (PWG and Apple raster) use white...
+  */
+
+  switch (r->header.cupsColorSpace)
+  {
+    case CUPS_CSPACE_W :
+    case CUPS_CSPACE_RGB :
+    case CUPS_CSPACE_SW :
+    case CUPS_CSPACE_SRGB :
+    case CUPS_CSPACE_ADOBERGB :
+        r->white = 0xff;
+	break;
+
+    default :
+        r->white = 0x00;
+	break;
+  }
+
+  *header = r->header;
+
+  return (1);
+}
+
+
+/*
+ * 'tmcRasterReadLines()' - Read lines of the current page.
+ *
+ * The lines are stored one after another, cupsBytesPerLine apart.
+ */
+
+unsigned				/* O - Number of lines read */
+tmcRasterReadLines(tmc_raster_t  *r,	/* I - Raster stream */
+                   unsigned char *buffer,
+					/* O - Lines */
+		   unsigned      lines)	/* I - Number of lines wanted */
+{
+  unsigned	count,			/* Lines returned */
+		skip;			/* Lines skipped */
+
+
+  if (r->step < 2)
+    return (read_lines(r, buffer, lines));
+
+ /*
+  * Return the first line of each step and decode the rest into the
+  * last-line buffer...
+  */
+
+  for (count = 0; count < lines;
+       count ++, buffer += r->header.cupsBytesPerLine)
+  {
+    if (!read_lines(r, buffer, 1))
+      break;
+
+    for (skip = 1; skip < r->step && r->remaining; skip ++)
+      if (!read_lines(r, r->line, 1))
+        break;
+  }
+
+  return (count);
+}
+
+
+/*
+ * 'tmcRasterSetStep()' - Return one line in every "step" lines of the
+ *                        current page.
+ *
+ * This brings a page down to a lower vertical resolution, such as 360dpi
+ * Apple raster to the 180dpi of the printer.  The step is reset by the
+ * next page header.
+ */
+
+void
+tmcRasterSetStep(tmc_raster_t *r,	/* I - Raster stream */
+                 unsigned     step)	/* I - Lines read per line returned */
+{
+  r->step = step ? step : 1;
+}
+
+
+/*
+ * 'apple_header()' - Read an Apple raster page header.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+apple_header(tmc_raster_t *r)		/* I - Raster stream */
+{
+  const unsigned char	*h;		/* Raw header */
+  static const cups_cspace_t cspaces[] =/* Color spaces */
+  {
+    CUPS_CSPACE_SW,
+    CUPS_CSPACE_SRGB,
+    CUPS_CSPACE_CIELab,
+    CUPS_CSPACE_ADOBERGB,
+    CUPS_CSPACE_W,
+    CUPS_CSPACE_RGB,
+    CUPS_CSPACE_CMYK
+  };
+  static const unsigned	colors[] =	/* Colors per color space */
+  {
+    1, 3, 3, 3, 1, 3, 4
+  };
+
+
+  if (!fill(r, RASTER_APPLE_HEADER))
+    return (0);
+
+  h = r->ptr;
+  r->ptr += RASTER_APPLE_HEADER;
+
+  if (h[1] >= sizeof(colors) / sizeof(colors[0]))
+    return (0);
+
+ /*
+  * Pixels are whole bytes, and the line length must fit in 32 bits...
+  */
+
+  if (h[0] == 0 || (h[0] & 7) || (h[0] % colors[h[1]]) ||
+      get_be32(h + 12) > UINT_MAX / h[0])
+    return (0);
+
+  memset(&r->header, 0, sizeof(r->header));
+
+  strcpy(r->header.MediaClass, "PwgRaster");
+
+  r->header.cupsBitsPerPixel = h[0];
+  r->header.cupsColorSpace   = cspaces[h[1]];
+  r->header.cupsNumColors    = colors[h[1]];
+  r->header.cupsBitsPerColor = h[0] / colors[h[1]];
+  r->header.cupsWidth        = get_be32(h + 12);
+  r->header.cupsHeight       = get_be32(h + 16);
+  r->header.cupsBytesPerLine = r->header.cupsWidth * (h[0] / 8);
+  r->header.cupsColorOrder   = CUPS_ORDER_CHUNKED;
+  r->header.HWResolution[0]  = get_be32(h + 20);
+  r->header.HWResolution[1]  = r->header.HWResolution[0];
+  r->header.NumCopies        = 1;
+
+  if (r->header.HWResolution[0] > 0)
+  {
+    r->header.PageSize[0]     = r->header.cupsWidth * 72 /
+                                r->header.HWResolution[0];
+    r->header.PageSize[1]     = r->header.cupsHeight * 72 /
+                                r->header.HWResolution[1];
+    r->header.cupsPageSize[0] = r->header.cupsWidth * 72.0f /
+                                r->header.HWResolution[0];
+    r->header.cupsPageSize[1] = r->header.cupsHeight * 72.0f /
+                                r->header.HWResolution[1];
+  }
+
+  r->header.cupsInteger[0] = r->apple_pages;
+					/* TotalPageCount */
+
+  return (1);
+}
+
+
+/*
+ * 'copy_bytes()' - Copy bytes from the stream, reading large blocks straight
+ *                  into the destination.
+ */
+
+static size_t				/* O - Bytes copied */
+copy_bytes(tmc_raster_t  *r,		/* I - Raster stream */
+           unsigned char *dst,		/* O - Destination */
+	   size_t        length)	/* I - Bytes wanted */
+{
+  size_t	done;			/* Bytes copied */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  if ((done = (size_t)(r->end - r->ptr)) > length)
+    done = length;
+
+  memcpy(dst, r->ptr, done);
+  r->ptr += done;
+
+  while (!r->map && done < length)
+  {
+    if ((bytes = read(r->fd, dst + done, length - done)) < 0 &&
+        (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    if (bytes <= 0)
+      break;
+
+    done += (size_t)bytes;
+  }
+
+  return (done);
+}
+
+
+/*
+ * 'decode_line()' - Decode the runs of a compressed line.
+ */
+
+static int				/* O - 1 on success, 0 on error */
+decode_line(tmc_raster_t  *r,		/* I - Raster stream */
+            unsigned char *dst)		/* O - Line */
+{
+  unsigned char	*end = dst + r->header.cupsBytesPerLine;
+					/* End of line */
+  unsigned	bpp = r->bpp,		/* Bytes per unit */
+		count,			/* Run count */
+		bytes,			/* Bytes in run */
+		done;			/* Bytes of repeat filled */
+
+
+  while (dst < end)
+  {
+    if (!fill(r, 1))
+      return (0);
+
+    count = *(r->ptr)++;
+
+    if (count == 128)
+    {
+     /*
+      * Blank to the end of the line (PWG and Apple raster)...
+      */
+
+      bytes = (unsigned)(end - dst);
+
+      memset(dst, r->white, bytes);
+    }
+    else if (count & 128)
+    {
+     /*
+      * 257 - count units of literal data...
+      */
+
+      if ((bytes = (257 - count) * bpp) > (unsigned)(end - dst))
+        bytes = (unsigned)(end - dst);
+
+      if (!fill(r, bytes))
+        return (0);
+
+      memcpy(dst, r->ptr, bytes);
+      r->ptr += bytes;
+    }
+    else
+    {
+     /*
+      * count + 1 copies of one unit...
+      */
+
+      if ((bytes = (count + 1) * bpp) > (unsigned)(end - dst))
+        bytes = (unsigned)(end - dst);
+
+      if (!fill(r, bpp))
+        return (0);
+
+      if (bpp == 1)
+        memset(dst, *(r->ptr), bytes);
+      else
+      {
+        memcpy(dst, r->ptr, bpp);
+
+        for (done = bpp; done < bytes; done *= 2)
+	  memcpy(dst + done, dst, done < bytes - done ? done : bytes - done);
+      }
+
+      r->ptr += bpp;
+    }
+
+    dst += bytes;
+  }
+
+  return (1);
+}
+
+
+/*
+ * 'fill()' - Make sure there are at least "length" bytes to decode.
+ */
+
+static int				/* O - 1 on success, 0 at end of stream */
+fill(tmc_raster_t *r,			/* I - Raster stream */
+     size_t       length)		/* I - Bytes needed */
+{
+  size_t	have = (size_t)(r->end - r->ptr);
+					/* Bytes buffered */
+  ssize_t	bytes;			/* Bytes read */
+
+
+  if (have >= length)
+    return (1);
+
+  if (r->map || length > RASTER_BUFFER)
+    return (0);
+
+  memmove(r->buffer, r->ptr, have);
+
+  r->ptr = r->buffer;
+  r->end = r->buffer + have;
+
+  while ((size_t)(r->end - r->ptr) < length)
+  {
+    if ((bytes = read(r->fd, r->buffer + have,
+                      RASTER_BUFFER - have)) < 0 &&
+        (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    if (bytes <= 0)
+      return (0);
+
+    have   += (size_t)bytes;
+    r->end += bytes;
+  }
+
+  return (1);
+}
+
+
+/*
+ * 'get_be32()' - Get a big-endian 32-bit number.
+ */
+
+static unsigned				/* O - Number */
+get_be32(const unsigned char *p)	/* I - Bytes */
+{
+  return (((unsigned)p[0] << 24) | ((unsigned)p[1] << 16) |
+          ((unsigned)p[2] << 8) | (unsigned)p[3]);
+}
+
+
+/*
+ * 'read_lines()' - Read lines of the current page without skipping.
+ */
+
+static unsigned				/* O - Number of lines read */
+read_lines(tmc_raster_t  *r,		/* I - Raster stream */
+           unsigned char *buffer,	/* O - Lines */
+	   unsigned      lines)		/* I - Number of lines wanted */
+{
+  unsigned		count;		/* Lines read */
+  unsigned		bpl = r->header.cupsBytesPerLine;
+					/* Bytes per line */
+  unsigned char		*dst,		/* Current line */
+			*p;		/* Pointer into lines */
+  const unsigned char	*last;		/* Last line decoded */
+
+
+  if (lines > r->remaining)
+    lines = r->remaining;
+
+  if (!r->compressed)
+  {
+   /*
+    * Uncompressed lines are copied as one block...
+    */
+
+    count = (unsigned)(copy_bytes(r, buffer, (size_t)lines * bpl) / bpl);
+  }
+  else
+  {
+    for (count = 0, dst = buffer, last = r->line; count < lines;
+         count ++, dst += bpl)
+    {
+      if (r->repeat)
+      {
+        if (dst != last)
+          memcpy(dst, last, bpl);
+
+	r->repeat --;
+      }
+      else if (!fill(r, 1))
+        break;
+      else
+      {
+        r->repeat = *(r->ptr)++;
+
+        if (!decode_line(r, dst))
+	{
+	  r->repeat = 0;
+	  break;
+	}
+      }
+
+      last = dst;
+    }
+
+   /*
+    * Keep the last line if it repeats into the next call...
+    */
+
+    if (r->repeat && last != r->line)
+      memcpy(r->line, last, bpl);
+  }
+
+  if (r->swapped && r->header.cupsBitsPerColor == 16)
+  {
+    unsigned char	temp;		/* Swap byte */
+
+    for (p = buffer, dst = buffer + (size_t)count * bpl; p + 1 < dst; p += 2)
+    {
+      temp = p[0];
+      p[0] = p[1];
+      p[1] = temp;
+    }
+  }
+
+  r->remaining -= count;
+
+  if (r->map)
+    release(r);
+
+  return (count);
+}
+
+
+/*
+ * 'release()' - Drop the mapped pages that have been decoded.
+ *
+ * Long rolls would otherwise keep the whole file in the resident set.
+ */
+
+static void
+release(tmc_raster_t *r)		/* I - Raster stream */
+{
+  size_t	page = (size_t)sysconf(_SC_PAGESIZE),
+					/* Page size */
+		bytes;			/* Bytes to drop */
+
+
+  bytes = (size_t)(r->ptr - r->released) & ~(page - 1);
+
+  if (bytes < RASTER_RELEASE)
+    return;
+
+  madvise((void *)r->released, bytes, MADV_DONTNEED);
+
+  r->released += bytes;
+}
+
+
+/*
+ * 'swap_header()' - Swap the numbers in a page header.
+ *
+ * Everything from AdvanceDistance up to the cupsString values is a 32-bit
+ * integer or float.
+ */
+
+static void
+swap_header(cups_page_header2_t *header)/* I - Page header */
+{
+  unsigned	*s,			/* Current value */
+		temp;			/* Swapped value */
+
+
+  for (s = &(header->AdvanceDistance); s < (unsigned *)header->cupsString;
+       s ++)
+  {
+    temp = *s;
+    *s   = ((temp & 0xff) << 24) | ((temp & 0xff00) << 8) |
+           ((temp & 0xff0000) >> 8) | (temp >> 24);
+  }
+}
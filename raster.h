@@ -0,0 +1,40 @@
+/*
+ * Bulk CUPS, PWG and Apple raster reader for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_RASTER_H_
+#  define _TMC6XX_RASTER_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <cups/raster.h>
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_raster_s tmc_raster_t;
+					/**** Raster stream ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcRasterClose(tmc_raster_t *r);
+extern int		tmcRasterMapped(tmc_raster_t *r);
+extern tmc_raster_t	*tmcRasterOpen(int fd);
+extern int		tmcRasterReadHeader(tmc_raster_t *r,
+			                    cups_page_header2_t *header);
+extern unsigned		tmcRasterReadLines(tmc_raster_t *r,
+			                   unsigned char *buffer,
+					   unsigned lines);
+extern void		tmcRasterSetStep(tmc_raster_t *r, unsigned step);
+
+#endif /* !_TMC6XX_RASTER_H_ */
@@ -13,10 +13,67 @@
 
 #include <cupsfilters/driver.h>
 #include <signal.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "adapt.h"
+#include "arena.h"
+#include "cache.h"
+#include "daemon.h"
+#include "dither.h"
+#include "ordered.h"
+#include "output.h"
+#include "pack.h"
+#include "packbits.h"
+#include "raster.h"
+#include "stats.h"
+#include "workers.h"
 
 #define _(x)    x
 
 
+/*
+ * Band pipeline...
+ *
+ * Raster lines are read on the main thread, separated and dithered on the
+ * dither thread, and packed, compressed and written on the emit thread.
+ * Bands move between the stages through a small ring; a stage only touches
+ * a band after the previous stage has published it, and each stage handles
+ * the bands in order, so the output is the same as a single-threaded run.
+ */
+
+#define BAND_QUEUE_SIZE	4		/* Number of bands in flight */
+#define BAND_ROWS_MAX	180		/* Most lines in a band */
+#define BAND_ROWS_TASK	16		/* Lines per ordered dither work item */
+
+typedef struct band_s			/**** Band of raster lines ****/
+{
+  unsigned	y,			/* First page line in band */
+		rows,			/* Number of lines in band */
+		blank_rows;		/* Number of blank lines */
+  unsigned char	*pixels,		/* Raster lines */
+		*output[7],		/* Dithered lines per plane */
+		blank[BAND_ROWS_MAX];	/* Is each line blank? */
+} band_t;
+
+typedef struct pass_s			/**** Compressed microweave pass ****/
+{
+  int			type;		/* Compression type */
+  const unsigned char	*data;		/* Data to send, NULL if blank */
+  int			length;		/* Number of bytes to send */
+} pass_t;
+
+
+/*
+ * Dithering modes...
+ */
+
+#define DITHER_CUPS	0		/* cupsDitherLine(), one plane at a time */
+#define DITHER_NATIVE	1		/* tmcDitherLine(), planes in parallel */
+#define DITHER_ORDERED	2		/* tmcOrderedLine(), lines in parallel */
+
+
 /*
  * Globals...
  */
@@ -29,34 +86,104 @@ static unsigned PrinterPlanes;
 static unsigned int BitPlanes;
 static unsigned PrinterLength;
 static unsigned PrinterTop;
-static unsigned DotRowCount;
 static unsigned DotRowMax;
+static unsigned		BandHeight,		/* Lines per band for the job */
+			FirstBandHeight,	/* Lines in first band of a page */
+			BandLimit;		/* Lines in band being read */
 static unsigned DotBufferSize;
 static unsigned OutputFeed;
 static unsigned Canceled;
-static unsigned char	*PixelBuffer,		/* Pixel buffer */
-		*CMYKBuffer,		/* CMYK buffer */
-		*OutputBuffers[7],	/* Output buffers */
+static unsigned char	*CMYKBuffer,		/* CMYK buffer */
 		*DotBuffers[7],		/* Dot buffers */
-		*CompBuffer;		/* Compression buffer */
-static short		*InputBuffer;		/* Color separation buffer */
+		*CompBuffer;		/* Compression buffers */
+static unsigned		CompBufferSize;		/* Size of each compression buffer */
+static pass_t		Passes[7][2];		/* Compressed passes per plane */
+static short		*InputBuffer,		/* Color separation buffer */
+			*BlankInput;		/* Separated blank line */
+static int		BlankByte;		/* Value of blank lines, -1 for none */
 static unsigned MicroWeave;
+static int		NumOptions;		/* Number of job options */
+static cups_option_t	*Options;		/* Job options */
+static int		DitherMode;		/* Dithering mode */
+static tmc_dither_t	*NativeStates[7];	/* Native dither states */
+static tmc_ordered_t	*OrderedTables[7];	/* Ordered dither tables */
+static int		OrderedMatrix;		/* Ordered dither matrix */
+static int		FusedRGB;		/* Use tmcDitherRGB() for this page? */
+static short		SepTables[3][256];	/* Separation of each RGB component */
+static int		MonoPath;		/* Dither gray pages once? */
+static int		Mono;			/* Use the same dots for C, M and Y? */
+static int		MonoBits;		/* Pack 1-bit lines without dithering? */
+static unsigned		DitherPlanes;		/* Planes dithered, 1 for mono pages */
+static short		MonoTable[256];		/* Separation of each gray value */
+static unsigned short	MonoDots[256];		/* Dots for each byte of 1-bit pixels */
+static tmc_cache_t	*BandCache;		/* Compressed band cache */
+static int		Adaptive;		/* Skip PackBits when it won't help? */
+static tmc_adapt_t	Adapt[7];		/* Compression policy per plane */
+static int		DitherThreads;		/* Threads in dither stage */
+static tmc_workers_t	*DitherWorkers,		/* Per-plane dither threads */
+			*EmitWorkers;		/* Per-plane pack/compress threads */
+static band_t		Bands[BAND_QUEUE_SIZE];	/* Band ring */
+static unsigned		LinesRead,		/* Lines read on this page */
+			BandsRead,		/* Bands filled by the reader */
+			BandsDithered,		/* Bands separated and dithered */
+			BandsEmitted;		/* Bands written to the printer */
+static int		PipelineDone;		/* Stop the pipeline threads? */
+static pthread_mutex_t	BandMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	BandCond = PTHREAD_COND_INITIALIZER;
+static pthread_t	DitherThread,		/* Separation/dither stage */
+			EmitThread;		/* Pack/compress/emit stage */
+static ppd_file_t	*PagePPD;		/* PPD file for current page */
+static cups_page_header2_t *PageHeader;		/* Header for current page */
+static char		PageKey[1024];		/* Setup key for loaded page data */
+static tmc_arena_t	Arena;			/* Page buffers */
+static long		CutOffset;		/* Cutter setting in captured page */
+static int		Resident;		/* Keep page data between jobs? */
 
 /*
  * Prototypes...
  */
 
 void	Setup(ppd_file_t *);
+int	PwgPage(ppd_file_t *, tmc_raster_t *, cups_page_header2_t *);
 void	StartPage(ppd_file_t *, cups_page_header2_t *);
 void	EndPage(ppd_file_t *, cups_page_header2_t *);
 void	Shutdown(ppd_file_t *);
+void	LoadPage(ppd_file_t *, cups_page_header2_t *, const char *,
+		         const char *);
+void	FreePage(void);
 
 void	CancelJob(int sig);
-void	CompressData(ppd_file_t *, const unsigned char *, const int,
-	             int, int, const int, const int, const int);
-void	ProcessLine(ppd_file_t *, cups_raster_t *,
-	            cups_page_header2_t *, const int y);
-void EmitDotRows(ppd_file_t *, cups_page_header2_t *);
+int	CutCopy(cups_page_header2_t *, unsigned);
+void	ReplayPage(cups_page_header2_t *, unsigned);
+const char *GetOption(ppd_file_t *, const char *);
+int	GetIntOption(ppd_file_t *, const char *, int);
+void	CompressData(const unsigned char *, const int, int,
+	             unsigned char *, pass_t *);
+void	WriteGraphics(int, const pass_t *, const int, const int, const int);
+unsigned ProcessLines(ppd_file_t *, tmc_raster_t *,
+	             cups_page_header2_t *, unsigned);
+void	SeparateLine(cups_page_header2_t *, const unsigned char *, short *,
+		             int);
+void	SeparateGray(cups_page_header2_t *, const unsigned char *, short *,
+		             int);
+int	ProbeSeparation(cups_page_header2_t *);
+int	ProbeMono(cups_page_header2_t *);
+int	ProbeBlank(cups_page_header2_t *);
+void	DitherLine(cups_page_header2_t *, band_t *, const unsigned row);
+void	SeparateRows(cups_page_header2_t *, band_t *, unsigned, unsigned);
+void	DitherBand(cups_page_header2_t *, band_t *);
+void	OrderedBand(cups_page_header2_t *, band_t *);
+void	FuseBand(cups_page_header2_t *, band_t *);
+void	MonoBand(cups_page_header2_t *, band_t *);
+void	EmitDotRows(ppd_file_t *, cups_page_header2_t *, band_t *);
+
+void	StartPipeline(ppd_file_t *);
+void	StopPipeline(void);
+void	FlushBands(void);
+
+int	PrintJob(ppd_file_t *, int);
+int	SubmitJob(int, char *[]);
+void	StartDaemon(ppd_file_t *, int);
 
 /*
  * 'Setup()' - Prepare a printer for graphics output.
@@ -65,12 +192,103 @@ void EmitDotRows(ppd_file_t *, cups_page_header2_t *);
 void
 Setup(ppd_file_t *ppd)		/* I - PPD file */
 {
- /*
-  * Some EPSON printers need an additional command issued at the
-  * beginning of each job to exit from USB "packet" mode...
-  */
+  tmcOutputJobStart();
+}
+
+
+/*
+ * 'PwgPage()' - Set up a PWG or Apple raster page for printing.
+ *
+ * These pages come straight from the application instead of through the
+ * PPD's page setup, so the cutter, compression and media settings are
+ * taken from the PPD and job options, while the size and color space of
+ * the pixels stay as sent.  sGray and sRGB are separated like device gray
+ * and RGB, and a vertical resolution that is a multiple of the printer's
+ * (Apple raster is always square) is brought down by skipping lines.
+ */
+
+int					/* O - 1 to print, 0 to skip the page */
+PwgPage(ppd_file_t          *ppd,	/* I - PPD file */
+        tmc_raster_t        *ras,	/* I - Raster stream */
+        cups_page_header2_t *header)	/* I - Page header */
+{
+  cups_page_header2_t	setup;		/* Page setup from PPD */
+  unsigned		step;		/* Input lines per printed line */
+
+
+  if (cupsRasterInterpretPPD(&setup, ppd, NumOptions, Options, NULL))
+    fputs("DEBUG: Unable to interpret the PPD page setup.\n", stderr);
+
+  switch (header->cupsColorSpace)
+  {
+    case CUPS_CSPACE_SW :
+        header->cupsColorSpace = CUPS_CSPACE_W;
+	break;
+
+    case CUPS_CSPACE_SRGB :
+    case CUPS_CSPACE_ADOBERGB :
+        header->cupsColorSpace = CUPS_CSPACE_RGB;
+	break;
+
+    case CUPS_CSPACE_W :
+    case CUPS_CSPACE_K :
+    case CUPS_CSPACE_RGB :
+    case CUPS_CSPACE_CMYK :
+        break;
+
+    default :
+        _cupsLangPrintFilter(stderr, "ERROR",
+	                     _("Unsupported color space %d."),
+			     header->cupsColorSpace);
+        return (0);
+  }
+
+  if ((header->cupsBitsPerColor != 8 &&
+       (header->cupsBitsPerColor != 1 ||
+        (header->cupsColorSpace != CUPS_CSPACE_W &&
+	 header->cupsColorSpace != CUPS_CSPACE_K))) ||
+      header->cupsColorOrder != CUPS_ORDER_CHUNKED)
+  {
+    _cupsLangPrintFilter(stderr, "ERROR",
+                         _("Unsupported raster data: %d bits per color."),
+			 header->cupsBitsPerColor);
+    return (0);
+  }
+
+  if (header->HWResolution[0] != setup.HWResolution[0] ||
+      setup.HWResolution[1] == 0 ||
+      header->HWResolution[1] < setup.HWResolution[1] ||
+      header->HWResolution[1] % setup.HWResolution[1])
+  {
+    _cupsLangPrintFilter(stderr, "ERROR",
+                         _("Unsupported resolution %dx%ddpi, the printer "
+			   "needs %dx%ddpi."),
+			 header->HWResolution[0], header->HWResolution[1],
+			 setup.HWResolution[0], setup.HWResolution[1]);
+    return (0);
+  }
+
+  if ((step = header->HWResolution[1] / setup.HWResolution[1]) > 1)
+  {
+    fprintf(stderr, "DEBUG: Printing 1 in %u lines of %ddpi page.\n", step,
+            header->HWResolution[1]);
+
+    tmcRasterSetStep(ras, step);
+
+    header->cupsHeight      = (header->cupsHeight + step - 1) / step;
+    header->HWResolution[1] = setup.HWResolution[1];
+  }
+
+  if (header->CutMedia == CUPS_CUT_NONE)
+    header->CutMedia = setup.CutMedia;
+
+  if (!header->MediaType[0])
+    strcpy(header->MediaType, setup.MediaType);
 
-    cupsWritePrintData("\000\000\000\033\001@EJL 1284.4\n@EJL     \n\033@", 29);
+  header->cupsCompression = setup.cupsCompression;
+  header->cupsMediaType   = setup.cupsMediaType;
+
+  return (1);
 }
 
 
@@ -88,22 +306,18 @@ StartPage(ppd_file_t         *ppd,	/* I - PPD file */
 		plane;			/* Current color plane */
   unsigned char	*ptr;			/* Pointer into dot buffer */
   int		bands;			/* Number of bands to allocate */
-  int		units;			/* Units for resolution */
   const char	*colormodel;		/* Color model string */
   char		resolution[PPD_MAX_NAME],
 					/* Resolution string */
-		spec[PPD_MAX_NAME];	/* PPD attribute name */
+		spec[PPD_MAX_NAME],	/* PPD attribute name */
+		key[1024];		/* Page setup key */
   ppd_attr_t	*attr;			/* Attribute from PPD file */
-  const float	default_lut[] =	/* Default dithering lookup table */
-		{
-		  0.0,
-		  0.25,
-		  0.5,
-		  0.75,
-		};
 
 
   fprintf(stderr, "DEBUG: StartPage...\n");
+
+  CutOffset = -1;
+
   fprintf(stderr, "DEBUG: MediaClass = \"%s\"\n", header->MediaClass);
   fprintf(stderr, "DEBUG: MediaColor = \"%s\"\n", header->MediaColor);
   fprintf(stderr, "DEBUG: MediaType = \"%s\"\n", header->MediaType);
@@ -181,6 +395,179 @@ StartPage(ppd_file_t         *ppd,	/* I - PPD file */
   if (!header->MediaType[0])
     strcpy(header->MediaType, "Plain");
 
+ /*
+  * Load the color profiles, lookup tables and buffers unless the previous
+  * page used the same ones...
+  */
+
+  snprintf(key, sizeof(key), "%s/%s/%s/%u/%u/%u/%u/%u/%d/%d/%u/%d", colormodel,
+           header->MediaType, resolution, header->cupsWidth,
+	   header->cupsBytesPerLine, header->cupsBitsPerPixel,
+	   header->cupsColorSpace, header->cupsColorOrder, DitherMode,
+	   OrderedMatrix, BandHeight, MonoPath);
+
+  if (strcmp(key, PageKey))
+  {
+    FreePage();
+    LoadPage(ppd, header, colormodel, resolution);
+    strcpy(PageKey, key);
+  }
+  else
+    fputs("DEBUG: Reusing color profiles and buffers from previous page.\n",
+          stderr);
+
+ /*
+  * Each page starts with a fresh dither state...
+  */
+
+  for (plane = 0; plane < DitherPlanes; plane ++)
+  {
+    if (DitherMode == DITHER_NATIVE)
+      tmcDitherReset(NativeStates[plane]);
+    else if (DitherMode == DITHER_CUPS)
+      DitherStates[plane] = cupsDitherNew(header->cupsWidth);
+  }
+
+ /*
+  * Set the page length and top margin...
+  */
+
+  PrinterLength = header->PageSize[1] * header->HWResolution[1] / 72;
+  PrinterTop    = (int)((ppd->sizes[1].length - ppd->sizes[1].top) *
+                        header->HWResolution[1] / 72.0);
+
+ /*
+  * Initialize the printer, set the cutter and set up the page...
+  */
+
+  attr      = ppdFindAttr(ppd, "cupsESCPAC", spec);
+  CutOffset = tmcOutputPageStart(attr && attr->value ? CutCopy(header, 1) : -1,
+                                 GetIntOption(ppd, "TMCIdleSpacing", 1),
+				 header->HWResolution[0],
+				 header->HWResolution[1], PrinterLength,
+				 PrinterTop);
+
+ /*
+  * Set the top of form...
+  */
+
+  OutputFeed = 0;
+
+ /*
+  * Start the page with empty bands...
+  */
+
+  for (i = 0; i < BAND_QUEUE_SIZE; i ++)
+  {
+    Bands[i].rows       = 0;
+    Bands[i].blank_rows = 0;
+  }
+
+  LinesRead = 0;
+
+ /*
+  * A short first band gets the head moving while the rest of the page is
+  * still being read and dithered...
+  */
+
+  BandLimit = FirstBandHeight ? FirstBandHeight : DotRowMax;
+
+ /*
+  * Hand the page over to the pipeline threads...
+  */
+
+  PagePPD    = ppd;
+  PageHeader = header;
+}
+
+
+/*
+ * 'EndPage()' - Finish a page of graphics.
+ */
+
+void
+EndPage(ppd_file_t         *ppd,	/* I - PPD file */
+        cups_page_header2_t *header)	/* I - Page header */
+{
+  int		i;			/* Looping var */
+  int		plane;			/* Current plane */
+  int		subrow;			/* Current subrow */
+  int		subrows;		/* Number of subrows */
+  unsigned long	writes,			/* write() calls for page */
+		bytes;			/* Bytes sent for page */
+  uint64_t	start;			/* Start time */
+
+
+ /*
+  * Output the last bands of print data as necessary...
+  */
+
+  FlushBands();
+
+ /*
+  * Output a page eject sequence...
+  */
+
+  tmcOutputByte(12);
+
+  start = tmcStatsStart();
+  tmcOutputFlush();
+  tmcStatsStop(TMC_STAGE_WRITE, start);
+
+  tmcOutputStats(&writes, &bytes);
+  tmcStatsCount(TMC_COUNT_BYTES_OUT, bytes);
+
+  fprintf(stderr, "DEBUG: Page output = %lu bytes in %lu write calls\n",
+          bytes, writes);
+
+ /*
+  * Free memory for the page...
+  */
+
+  if (DitherMode == DITHER_CUPS)
+    for (i = 0; i < DitherPlanes; i ++)
+      cupsDitherDelete(DitherStates[i]);
+}
+
+
+/*
+ * 'LoadPage()' - Load the color profiles and allocate the buffers for a
+ *                page.
+ *
+ * Everything loaded here only depends on the color model, media type,
+ * resolution and raster line format, so StartPage() keeps it for the
+ * following pages until one of those changes.
+ */
+
+void
+LoadPage(ppd_file_t          *ppd,	/* I - PPD file */
+         cups_page_header2_t *header,	/* I - Page header */
+	 const char          *colormodel,
+					/* I - Color model string */
+	 const char          *resolution)
+					/* I - Resolution string */
+{
+  int		i;			/* Looping var */
+  unsigned	plane,			/* Current color plane */
+		bit;			/* Current bit of 1-bit pixels */
+  int		ink[2],			/* Dots for a clear and a set bit */
+		value;			/* Separated gray value */
+  size_t	dot_size,		/* Size of each dot buffer */
+		input_size,		/* Size of separation buffer */
+		blank_size,		/* Size of blank separated line */
+		pixel_size,		/* Size of raster lines in a band */
+		output_size,		/* Size of dithered lines in a band */
+		cmyk_size,		/* Size of CMYK buffer */
+		comp_size;		/* Size of compression buffers */
+  const float	default_lut[] =	/* Default dithering lookup table */
+		{
+		  0.0,
+		  0.25,
+		  0.5,
+		  0.75,
+		};
+
+
  /*
   * Load the appropriate color profiles...
   */
@@ -213,6 +600,9 @@ StartPage(ppd_file_t         *ppd,	/* I - PPD file */
   }
 
   PrinterPlanes = CMYK->num_channels;
+  DitherPlanes  = PrinterPlanes;
+  Mono          = 0;
+  MonoBits      = 0;
 
   fprintf(stderr, "DEBUG: PrinterPlanes = %d\n", PrinterPlanes);
 
@@ -239,208 +629,166 @@ StartPage(ppd_file_t         *ppd,	/* I - PPD file */
 
   for (plane = 0; plane < PrinterPlanes; plane ++)
   {
-    DitherStates[plane] = cupsDitherNew(header->cupsWidth);
+    if (DitherMode == DITHER_NATIVE)
+      NativeStates[plane] = tmcDitherNew(header->cupsWidth);
 
     if (!DitherLuts[plane])
       DitherLuts[plane] = cupsLutNew(sizeof(default_lut)/sizeof(default_lut[0]), default_lut);
+
+    if (DitherMode == DITHER_ORDERED)
+      OrderedTables[plane] = tmcOrderedNew(DitherLuts[plane], OrderedMatrix);
   }
 
   BitPlanes = 2;
 
  /*
-  * Initialize the printer...
+  * Setup softweave parameters...
   */
 
-  printf("\033@");
-
-   /*
-    * Go into remote mode...
-    */
-
-    cupsWritePrintData("\033(R\010\000\000REMOTE1", 13);
-
-	cupsWritePrintData("EX\006\000\000\000\000\000\005\000", 10);
-
-    if ((attr = ppdFindAttr(ppd, "cupsESCPAC", spec)) != NULL && attr->value)
-    {
-     /*
-      * Enable/disable cutter.
-      */
-
-      cupsWritePrintData("AC\002\000\000", 5);
-      putchar(header->CutMedia ? '\001' : '\000');
-    }
-
-   /*
-    * Exit remote mode...
-    */
-
-    cupsWritePrintData("\033\000\000\000", 4);
-
-    /*
-     * Idle spacing
-     */
-    for (int i = 0; i < 2; i++)
-    {
-        cupsWritePrintData("\033(d\xff\x7f", 5);
-        for (int j = 0; j < 32767; j++)
-            cupsWritePrintData("\000", 1);
-    }
+  DotRowMax     = BandHeight;
+  DotBufferSize = (header->cupsWidth * BitPlanes + 7) / 8;
 
- /*
-  * Enter graphics mode...
-  */
+  fprintf(stderr, "DEBUG: DotBufferSize = %d\n", DotBufferSize);
+  fprintf(stderr, "DEBUG: DotRowMax = %d\n", DotRowMax);
 
-  cupsWritePrintData("\033(G\001\000\001", 6);
+  fprintf(stderr, "DEBUG: model_number = %x\n", ppd->model_number);
 
  /*
-  * Set the line feed increment...
+  * Carve the page buffers out of the job's arena, which only grows when
+  * this page needs more memory than the pages before it...
   */
 
-  /* TODO: get this from the PPD file... */
-  for (units = 1440; units < header->HWResolution[0]; units *= 2);
-
-  cupsWritePrintData("\033(U\005\000", 5);
-  putchar(units / header->HWResolution[1]);
-  putchar(units / header->HWResolution[1]);
-  putchar(units / header->HWResolution[0]);
-  putchar(units);
-  putchar(units >> 8);
-
- /*
-  * Set the page length...
-  */
+  CompBufferSize = DotBufferSize * DotRowMax;
+
+  dot_size    = DotBufferSize * DotRowMax;
+  input_size  = (DitherMode != DITHER_CUPS ? DotRowMax : 1) *
+                PrinterPlanes * header->cupsWidth * sizeof(InputBuffer[0]);
+  pixel_size  = DotRowMax * header->cupsBytesPerLine;
+  output_size = PrinterPlanes * header->cupsWidth * DotRowMax;
+  blank_size  = DitherMode == DITHER_CUPS ?
+                PrinterPlanes * header->cupsWidth * sizeof(BlankInput[0]) : 0;
+  cmyk_size   = RGB ? (PrinterPlanes + 1) * header->cupsWidth : 0;
+  comp_size   = 2 * PrinterPlanes * CompBufferSize;
+
+  if (tmcArenaReserve(&Arena, PrinterPlanes * tmcArenaRound(dot_size) +
+                              tmcArenaRound(input_size) +
+                              tmcArenaRound(blank_size) +
+			      BAND_QUEUE_SIZE * (tmcArenaRound(pixel_size) +
+			                         tmcArenaRound(output_size)) +
+			      tmcArenaRound(cmyk_size) +
+			      tmcArenaRound(comp_size)))
+  {
+    fputs("ERROR: Unable to allocate memory for page buffers.\n", stderr);
+    exit(1);
+  }
 
-  PrinterLength = header->PageSize[1] * header->HWResolution[1] / 72;
+  fprintf(stderr, "DEBUG: Arena = %lu bytes\n", (unsigned long)Arena.size);
 
-  cupsWritePrintData("\033(C\004\000", 5);
-  putchar(PrinterLength & 255);
-  putchar((PrinterLength >> 8) & 255);
-  putchar((PrinterLength >> 16) & 255);
-  putchar((PrinterLength >> 24) & 255);
+  for (plane = 0; plane < PrinterPlanes; plane ++)
+    DotBuffers[plane] = tmcArenaAlloc(&Arena, dot_size);
 
- /*
-  * Set the top and bottom margins...
-  */
+  InputBuffer = tmcArenaAlloc(&Arena, input_size);
 
-  PrinterTop = (int)((ppd->sizes[1].length - ppd->sizes[1].top) *
-                     header->HWResolution[1] / 72.0);
+  if (DitherMode == DITHER_CUPS)
+  {
+    BlankInput = tmcArenaAlloc(&Arena, blank_size);
+    memset(BlankInput, 0, blank_size);
+  }
 
-  cupsWritePrintData("\033(c\010\000", 5);
+  for (i = 0; i < BAND_QUEUE_SIZE; i ++)
+  {
+    Bands[i].pixels    = tmcArenaAlloc(&Arena, pixel_size);
+    Bands[i].output[0] = tmcArenaAlloc(&Arena, output_size);
 
-  putchar(PrinterTop);
-  putchar(PrinterTop >> 8);
-  putchar(PrinterTop >> 16);
-  putchar(PrinterTop >> 24);
+    for (plane = 1; plane < PrinterPlanes; plane ++)
+      Bands[i].output[plane] = Bands[i].output[0] + plane * header->cupsWidth * DotRowMax;
+  }
 
-  putchar(PrinterLength);
-  putchar(PrinterLength >> 8);
-  putchar(PrinterLength >> 16);
-  putchar(PrinterLength >> 24);
+  CMYKBuffer = RGB ? tmcArenaAlloc(&Arena, cmyk_size) : NULL;
+  CompBuffer = tmcArenaAlloc(&Arena, comp_size);
 
  /*
-  * Setup softweave parameters...
+  * RGB pages with a separation that handles each component on its own
+  * can be separated, dithered and packed in one pass...
   */
 
-  DotRowCount = 0;
-  DotRowMax     = 180;
-  DotBufferSize = (header->cupsWidth * BitPlanes + 7) / 8;
-
-  fprintf(stderr, "DEBUG: DotBufferSize = %d\n", DotBufferSize);
-  fprintf(stderr, "DEBUG: DotRowMax = %d\n", DotRowMax);
-  fprintf(stderr, "DEBUG: DotRowCount = %d\n", DotRowCount);
+  FusedRGB = DitherMode == DITHER_NATIVE && ProbeSeparation(header);
 
-  fprintf(stderr, "DEBUG: model_number = %x\n", ppd->model_number);
+  fprintf(stderr, "DEBUG: FusedRGB = %d\n", FusedRGB);
 
  /*
-  * Allocate memory for a single line of graphics...
+  * Gray pages that come out the same in every plane are dithered, packed
+  * and compressed once for composite black, and 1-bit pages are packed
+  * straight from the raster...
   */
 
-  ptr = calloc(PrinterPlanes, DotBufferSize * DotRowMax);
+  if ((Mono = ProbeMono(header)) != 0)
+  {
+    DitherPlanes = 1;
+    MonoBits     = header->cupsBitsPerColor == 1;
+  }
 
-  for (plane = 0; plane < PrinterPlanes; plane ++, ptr += DotBufferSize * DotRowMax)
-    DotBuffers[plane] = ptr;
+  if (MonoBits)
+  {
+    for (i = 0; i < 2; i ++)
+    {
+      value = MonoTable[i ? 255 : 0];
 
- /*
-  * Set the output resolution...
-  */
+      if (value < 0)
+        value = 0;
+      else if (value > CUPS_MAX_LUT)
+        value = CUPS_MAX_LUT;
 
-  // Paper load/ejecting
-  cupsWritePrintData("\033\x19\x01", 3);
+      ink[i] = DitherLuts[0][value].pixel;
+    }
 
- /*
-  * Set the top of form...
-  */
+    for (i = 0; i < 256; i ++)
+      for (bit = 0, MonoDots[i] = 0; bit < 8; bit ++)
+        MonoDots[i] = (MonoDots[i] << 2) | ink[(i >> (7 - bit)) & 1];
+  }
 
-  OutputFeed = 0;
+  fprintf(stderr, "DEBUG: Mono = %d, MonoBits = %d\n", Mono, MonoBits);
 
  /*
-  * Allocate buffers as needed...
+  * Blank lines skip separation and dithering when they separate to no ink...
   */
 
-  PixelBuffer      = calloc(1, header->cupsBytesPerLine);
-  InputBuffer      = calloc(PrinterPlanes, header->cupsWidth * sizeof(InputBuffer[0]));
-  OutputBuffers[0] = calloc(PrinterPlanes, header->cupsWidth * DotRowMax);
-
-  for (i = 1; i < PrinterPlanes + 1; i ++)
-    OutputBuffers[i] = OutputBuffers[0] + i * header->cupsWidth * DotRowMax;
-
-  if (RGB)
-    CMYKBuffer = calloc(PrinterPlanes + 1, header->cupsWidth);
+  BlankByte = ProbeBlank(header);
 
-  CompBuffer = malloc(10 * DotBufferSize * DotRowMax);
+  fprintf(stderr, "DEBUG: BlankByte = %d\n", BlankByte);
 }
 
 
 /*
- * 'EndPage()' - Finish a page of graphics.
+ * 'FreePage()' - Free the color profiles from LoadPage().
  */
 
 void
-EndPage(ppd_file_t         *ppd,	/* I - PPD file */
-        cups_page_header2_t *header)	/* I - Page header */
+FreePage(void)
 {
   int		i;			/* Looping var */
-  int		plane;			/* Current plane */
-  int		subrow;			/* Current subrow */
-  int		subrows;		/* Number of subrows */
-
-  EmitDotRows(ppd, header);
-
- /*
-  * Output the last bands of print data as necessary...
-  */
-   free(DotBuffers[0]);
 
- /*
-  * Output a page eject sequence...
-  */
-
-  putchar(12);
 
- /*
-  * Free memory for the page...
-  */
+  if (!PageKey[0])
+    return;
 
   for (i = 0; i < PrinterPlanes; i ++)
   {
-    cupsDitherDelete(DitherStates[i]);
+    tmcDitherDelete(NativeStates[i]);
+    tmcOrderedDelete(OrderedTables[i]);
     cupsLutDelete(DitherLuts[i]);
-  }
-
-  free(OutputBuffers[0]);
 
-  free(PixelBuffer);
-  free(InputBuffer);
-  free(CompBuffer);
+    NativeStates[i]  = NULL;
+    OrderedTables[i] = NULL;
+    DitherLuts[i]    = NULL;
+  }
 
   cupsCMYKDelete(CMYK);
 
   if (RGB)
-  {
     cupsRGBDelete(RGB);
-    free(CMYKBuffer);
-  }
+
+  PageKey[0] = '\0';
 }
 
 
@@ -455,336 +803,2055 @@ Shutdown(ppd_file_t *ppd)		/* I - PPD file */
   * Reset the printer...
   */
 
-  printf("\033@");
-  printf("\033@");
+  tmcOutputJobEnd();
+  tmcOutputFlush();
 
  /*
-  * Go into remote mode...
+  * Free the page data kept from the last page, unless the daemon keeps it
+  * for the next job...
   */
 
-  cupsWritePrintData("\033(R\010\000\000REMOTE1", 13);
-
- /*
-  * Load defaults...
+  if (!Resident)
+  {
+    FreePage();
+    tmcArenaFree(&Arena);
+  }
+}
+
+
+/*
+ * 'CancelJob()' - Cancel the current job...
+ */
+
+void
+CancelJob(int sig)			/* I - Signal */
+{
+  (void)sig;
+
+  Canceled = 1;
+}
+
+
+/*
+ * 'CutCopy()' - Decide whether to cut after a copy of the page.
+ *
+ * CUPS_CUT_PAGE cuts every copy; the other cut modes only cut after the
+ * last copy of the page.
+ */
+
+int					/* O - 1 to cut, 0 otherwise */
+CutCopy(cups_page_header2_t *header,	/* I - Page header */
+        unsigned            copy)	/* I - Copy number, starting at 1 */
+{
+  unsigned	copies;			/* Number of copies */
+
+
+  copies = header->NumCopies > 1 ? header->NumCopies : 1;
+
+  if (header->CutMedia == CUPS_CUT_NONE)
+    return (0);
+  else if (header->CutMedia == CUPS_CUT_PAGE)
+    return (1);
+  else
+    return (copy == copies);
+}
+
+
+/*
+ * 'ReplayPage()' - Send the remaining copies of the captured page.
+ */
+
+void
+ReplayPage(cups_page_header2_t *header,	/* I - Page header */
+           unsigned            copies)	/* I - Number of copies */
+{
+  unsigned	copy;			/* Current copy */
+  unsigned char	*data;			/* Captured page */
+  size_t	length;			/* Length of captured page */
+  unsigned long	writes,			/* write() calls for copies */
+		bytes;			/* Bytes sent for copies */
+
+
+  if ((data = tmcOutputCaptureEnd(&length)) == NULL)
+  {
+    fputs("ERROR: Unable to save the page for additional copies.\n", stderr);
+    return;
+  }
+
+  for (copy = 2; copy <= copies && !Canceled; copy ++)
+  {
+    if (CutOffset >= 0)
+      data[CutOffset] = CutCopy(header, copy);
+
+    tmcOutputBytes(data, length);
+    tmcOutputFlush();
+  }
+
+  tmcOutputStats(&writes, &bytes);
+  tmcStatsCount(TMC_COUNT_BYTES_OUT, bytes);
+
+  fprintf(stderr,
+          "DEBUG: Copies output = %lu bytes in %lu write calls for %u copies\n",
+          bytes, writes, copy - 2);
+}
+
+
+/*
+ * 'GetOption()' - Get a filter setting from the job options or PPD file.
+ *
+ * A job option "name" overrides the PPD attribute "cupsname".
+ */
+
+const char *				/* O - Value or NULL */
+GetOption(ppd_file_t *ppd,		/* I - PPD file */
+          const char *name)		/* I - Setting name */
+{
+  const char	*value;			/* Option value */
+  char		attrname[PPD_MAX_NAME];	/* PPD attribute name */
+  ppd_attr_t	*attr;			/* Attribute from PPD file */
+
+
+  if ((value = cupsGetOption(name, NumOptions, Options)) != NULL)
+    return (value);
+
+  snprintf(attrname, sizeof(attrname), "cups%s", name);
+
+  if ((attr = ppdFindAttr(ppd, attrname, NULL)) != NULL && attr->value)
+    return (attr->value);
+
+  return (NULL);
+}
+
+
+/*
+ * 'GetIntOption()' - Get an integer filter setting.
+ */
+
+int					/* O - Value */
+GetIntOption(ppd_file_t *ppd,		/* I - PPD file */
+             const char *name,		/* I - Setting name */
+	     int        defval)		/* I - Default value */
+{
+  const char	*value;			/* Option value */
+
+
+  if ((value = GetOption(ppd, name)) == NULL || !*value)
+    return (defval);
+
+  return (atoi(value));
+}
+
+
+/*
+ * 'CompressData()' - Compress a line of graphics.
+ */
+
+void
+CompressData(const unsigned char *line,	/* I - Data to compress */
+             const int           length,/* I - Number of bytes */
+	     int                 type,	/* I - Type of compression */
+	     unsigned char       *comp,	/* I - Compression buffer */
+	     pass_t              *pass)	/* O - Data to send */
+{
+  const unsigned char	*line_ptr,	/* Current byte pointer */
+			*line_end;	/* End-of-line byte pointer */
+  int			count;		/* Count of bytes for output */
+
+
+  switch (type)
+  {
+    case 0 :
+       /*
+	* Do no compression...
+	*/
+
+	line_ptr = (const unsigned char *)line;
+	line_end = (const unsigned char *)line + length;
+	break;
+
+    default :
+       /*
+        * Do TIFF pack-bits encoding...
+        */
+
+	count = tmcPackBits(line, length, comp);
+
+        if (count < length)
+	{
+          line_ptr = (const unsigned char *)comp;
+          line_end = (const unsigned char *)comp + count;
+	}
+	else
+	{
+	  type     = 0;
+	  line_ptr = (const unsigned char *)line;
+	  line_end = (const unsigned char *)line + length;
+	}
+	break;
+  }
+
+  pass->type   = type;
+  pass->data   = line_ptr;
+  pass->length = line_end - line_ptr;
+}
+
+
+/*
+ * 'WriteGraphics()' - Send a compressed pass to the printer.
+ */
+
+void
+WriteGraphics(int          plane,	/* I - Color plane */
+              const pass_t *pass,	/* I - Data to send */
+	      const int    bytes,	/* I - Number of bytes per row */
+	      const int    rows,	/* I - Number of lines to write */
+	      const int    microweave)	/* I - Microweave pass? */
+{
+  tmcOutputPass(tmcOutputColor(PrinterPlanes, plane), microweave,
+                pass->type != 0, BitPlanes, bytes, rows, pass->data,
+		pass->length);
+}
+
+
+/*
+ * 'PackPlane()' - Pack and compress both passes of a plane in a band.
+ */
+
+static void
+PackPlane(void *data,			/* I - Band */
+          int  plane)			/* I - Color plane */
+{
+  band_t	*band = (band_t *)data;	/* Band */
+  unsigned	width = PageHeader->cupsWidth;
+					/* Width of line */
+  unsigned	line_bytes,		/* Bytes per dithered line */
+		half_width;		/* Size of each half of the band */
+  unsigned	rows = band->rows / 2;	/* Lines per pass */
+  unsigned	microweave;		/* Current pass */
+  unsigned char	*dots;			/* Dot buffer for pass */
+  tmc_hash_t	key;			/* Hash of dithered band */
+  unsigned	params[5];		/* Band format for hash */
+  unsigned char	*comp[2];		/* Compression buffers */
+  int		decision;		/* Compression policy decision */
+  const unsigned char *pass_data[2];	/* Data of each pass */
+  int		pass_type[2],		/* Compression type of each pass */
+		pass_length[2];		/* Length of each pass */
+  uint64_t	start;			/* Start time */
+
+
+  Passes[plane][0].data = NULL;
+
+ /*
+  * tmcDitherRGB() and MonoBand() have already packed the dots...
+  */
+
+  line_bytes = FusedRGB || MonoBits ? DotBufferSize : width;
+  half_width = DotRowMax / 2 * line_bytes;
+
+  // Anything to print?
+  if (cupsCheckBytes(band->output[plane], rows * line_bytes) &&
+      cupsCheckBytes(band->output[plane] + half_width, rows * line_bytes))
+  {
+    tmcStatsCount(TMC_COUNT_BLANK_PLANES, 1);
+    return;
+  }
+
+  comp[0] = CompBuffer + 2 * plane * CompBufferSize;
+  comp[1] = comp[0] + CompBufferSize;
+
+  if (BandCache)
+  {
+   /*
+    * Look for the same dithered band in the cache...
+    */
+
+    params[0] = rows;
+    params[1] = line_bytes;
+    params[2] = PageHeader->cupsCompression;
+    params[3] = FusedRGB || MonoBits;
+    params[4] = tmcPackBitsExact();
+
+    tmcHashInit(&key);
+    tmcHashUpdate(&key, params, sizeof(params));
+    tmcHashUpdate(&key, band->output[plane], rows * line_bytes);
+    tmcHashUpdate(&key, band->output[plane] + half_width, rows * line_bytes);
+
+    if (tmcCacheGet(BandCache, &key, comp, pass_type, pass_length,
+                    2 * rows * DotBufferSize))
+    {
+      for (microweave = 0; microweave < 2; microweave ++)
+      {
+        Passes[plane][microweave].type   = pass_type[microweave];
+        Passes[plane][microweave].data   = comp[microweave];
+        Passes[plane][microweave].length = pass_length[microweave];
+      }
+
+      tmcStatsPlane(plane, 2 * rows * DotBufferSize,
+                    pass_length[0] + pass_length[1]);
+      return;
+    }
+  }
+
+  for (microweave = 0; microweave < 2; microweave ++)
+  {
+    if (FusedRGB || MonoBits)
+      dots = band->output[plane] + half_width * microweave;
+    else
+    {
+      dots = DotBuffers[plane] + microweave * DotRowMax / 2 * DotBufferSize;
+
+      start = tmcStatsStart();
+      tmcPackLines2(band->output[plane] + half_width * microweave, width,
+                    rows, dots, DotBufferSize);
+      tmcStatsStop(TMC_STAGE_PACK, start);
+    }
+
+   /*
+    * Don't compress passes that the plane's recent history says won't get
+    * any smaller...
+    */
+
+    if (Adaptive && PageHeader->cupsCompression)
+      decision = tmcAdaptDecide(Adapt + plane, dots, DotBufferSize * rows);
+    else
+      decision = TMC_ADAPT_COMPRESS;
+
+    if (decision == TMC_ADAPT_RAW)
+      tmcStatsCount(TMC_COUNT_COMPRESS_SKIPPED, 1);
+
+    start = tmcStatsStart();
+    CompressData(dots, DotBufferSize * rows,
+                 decision == TMC_ADAPT_RAW ? 0 : PageHeader->cupsCompression,
+                 comp[microweave], &Passes[plane][microweave]);
+    tmcStatsStop(TMC_STAGE_COMPRESS, start);
+
+    if (Adaptive && PageHeader->cupsCompression)
+      tmcAdaptResult(Adapt + plane, decision,
+                     Passes[plane][microweave].type != 0);
+  }
+
+  tmcStatsPlane(plane, 2 * rows * DotBufferSize,
+                Passes[plane][0].length + Passes[plane][1].length);
+
+  if (BandCache)
+  {
+    for (microweave = 0; microweave < 2; microweave ++)
+    {
+      pass_type[microweave]   = Passes[plane][microweave].type;
+      pass_data[microweave]   = Passes[plane][microweave].data;
+      pass_length[microweave] = Passes[plane][microweave].length;
+    }
+
+    tmcCachePut(BandCache, &key, pass_data, pass_type, pass_length);
+  }
+}
+
+
+/*
+ * 'EmitDotRows()' - Output a band of dithered lines.
+ */
+
+void EmitDotRows(ppd_file_t *ppd, cups_page_header2_t *header, band_t *band)
+{
+    unsigned plane;
+    unsigned rows = band->rows / 2;
+    uint64_t start;
+
+    if (!band->rows)
+    {
+        return;
+    }
+
+    /*
+     * Pack and compress the planes at the same time, then send them in
+     * plane order...
+     */
+
+    /*
+     * Blank bands just add to the paper feed...
+     */
+
+    if (band->blank_rows == band->rows)
+        rows = 0;
+
+    if (rows > 0)
+    {
+        tmcWorkersRun(EmitWorkers, DitherPlanes, PackPlane, band);
+
+        /*
+         * Mono pages send the same composite black passes for C, M and Y...
+         */
+
+        for (plane = DitherPlanes; plane < PrinterPlanes; plane++)
+            memcpy(Passes[plane], Passes[0], sizeof(Passes[0]));
+    }
+
+    for (plane = 0; plane < PrinterPlanes && rows > 0; plane++)
+    {
+        unsigned microweave;
+
+         /*
+          * Handle microweaved output...
+          */
+
+        // Anything to print?
+        if (!Passes[plane][0].data)
+            continue;
+
+        for (microweave = 0; microweave < 2; microweave++)
+        {
+            if (OutputFeed > 0)
+            {
+                tmcOutputFeed(OutputFeed);
+                OutputFeed = 0;
+             }
+
+             WriteGraphics(plane, &Passes[plane][microweave], DotBufferSize, rows, microweave);
+        }
+    }
+
+    /*
+     * Send the band; the passes point into the band buffers, which the
+     * reader reuses once this band is done...
+     */
+
+    start = tmcStatsStart();
+    tmcOutputFlush();
+    tmcStatsStop(TMC_STAGE_WRITE, start);
+
+    OutputFeed += band->rows;
+    band->rows = 0;
+    band->blank_rows = 0;
+}
+
+
+/*
+ * 'ProcessLines()' - Read graphics from the page stream and queue them for
+ *                    the dither thread as needed.
+ *
+ * The lines are read straight into the band, up to the end of the band.
+ */
+
+unsigned				/* O - Number of lines read */
+ProcessLines(ppd_file_t          *ppd,	/* I - PPD file */
+             tmc_raster_t        *ras,	/* I - Raster stream */
+             cups_page_header2_t *header,	/* I - Page header */
+             unsigned            count)	/* I - Lines left on page */
+{
+  band_t	*band;			/* Band being filled */
+  unsigned char	*line;			/* Line being read */
+  unsigned	lines,			/* Lines read */
+		row;			/* Current line in band */
+  uint64_t	start;			/* Start time */
+
+
+ /*
+  * Wait for a free band...
+  */
+
+  pthread_mutex_lock(&BandMutex);
+  while (BandsRead - BandsEmitted >= BAND_QUEUE_SIZE)
+    pthread_cond_wait(&BandCond, &BandMutex);
+  pthread_mutex_unlock(&BandMutex);
+
+  band = Bands + BandsRead % BAND_QUEUE_SIZE;
+
+ /*
+  * Read rows of graphics...
+  */
+
+  if (count > BandLimit - band->rows)
+    count = BandLimit - band->rows;
+
+  if (band->rows == 0)
+    band->y = LinesRead;
+
+  line = band->pixels + band->rows * header->cupsBytesPerLine;
+
+  start = tmcStatsStart();
+
+  if ((lines = tmcRasterReadLines(ras, line, count)) == 0)
+    return (0);
+
+  tmcStatsStop(TMC_STAGE_READ, start);
+  tmcStatsCount(TMC_COUNT_BYTES_IN, lines * header->cupsBytesPerLine);
+
+  for (row = band->rows; row < band->rows + lines;
+       row ++, line += header->cupsBytesPerLine)
+  {
+    band->blank[row] = BlankByte >= 0 &&
+                       cupsCheckValue(line, header->cupsBytesPerLine,
+		                      BlankByte);
+    band->blank_rows += band->blank[row];
+
+    if (band->blank[row])
+      tmcStatsCount(TMC_COUNT_BLANK_LINES, 1);
+  }
+
+  band->rows += lines;
+  LinesRead  += lines;
+
+  if (band->rows == BandLimit)
+  {
+    BandLimit = DotRowMax;
+
+    pthread_mutex_lock(&BandMutex);
+    BandsRead ++;
+    pthread_cond_broadcast(&BandCond);
+    pthread_mutex_unlock(&BandMutex);
+  }
+
+  return (lines);
+}
+
+
+/*
+ * 'SeparateLine()' - Separate a line of graphics into printer planes.
+ */
+
+void
+SeparateLine(cups_page_header2_t *header,	/* I - Page header */
+             const unsigned char *pixels,	/* I - Raster line */
+	     short               *input,	/* O - Separated line */
+	     int                 width)		/* I - Number of pixels */
+{
+  int		x,			/* Current pixel */
+		i,			/* Looping var */
+		count;			/* Pixels in this piece */
+  unsigned char	gray[256];		/* 8-bit pixels */
+
+
+ /*
+  * Perform the color separation...
+  */
+
+  switch (header->cupsColorSpace)
+  {
+    case CUPS_CSPACE_W :
+    case CUPS_CSPACE_K :
+        if (header->cupsBitsPerColor == 1)
+	{
+	 /*
+	  * Widen 1-bit lines a piece at a time...
+	  */
+
+	  for (x = 0; x < width; x += count)
+	  {
+	    count = width - x;
+
+	    if (count > (int)sizeof(gray))
+	      count = sizeof(gray);
+
+	    for (i = 0; i < count; i ++)
+	      gray[i] = (pixels[(x + i) / 8] & (128 >> ((x + i) & 7))) ? 255 : 0;
+
+	    SeparateGray(header, gray, input + x * DitherPlanes, count);
+	  }
+	}
+	else
+	  SeparateGray(header, pixels, input, width);
+	break;
+
+    default :
+    case CUPS_CSPACE_RGB :
+        if (RGB)
+	{
+	  cupsRGBDoRGB(RGB, pixels, CMYKBuffer, width);
+	  cupsCMYKDoCMYK(CMYK, CMYKBuffer, input, width);
+	}
+	else
+          cupsCMYKDoRGB(CMYK, pixels, input, width);
+	break;
+
+    case CUPS_CSPACE_CMYK :
+        cupsCMYKDoCMYK(CMYK, pixels, input, width);
+	break;
+  }
+}
+
+
+/*
+ * 'SeparateGray()' - Separate a line of 8-bit gray or black pixels.
+ */
+
+void
+SeparateGray(cups_page_header2_t *header,	/* I - Page header */
+             const unsigned char *pixels,	/* I - 8-bit pixels */
+	     short               *input,	/* O - Separated line */
+	     int                 width)		/* I - Number of pixels */
+{
+  int		i;			/* Looping var */
+
+
+  if (Mono)
+  {
+    for (i = 0; i < width; i ++)
+      input[i] = MonoTable[pixels[i]];
+  }
+  else if (header->cupsColorSpace == CUPS_CSPACE_K)
+    cupsCMYKDoBlack(CMYK, pixels, input, width);
+  else if (RGB)
+  {
+    cupsRGBDoGray(RGB, pixels, CMYKBuffer, width);
+    cupsCMYKDoCMYK(CMYK, CMYKBuffer, input, width);
+  }
+  else
+    cupsCMYKDoGray(CMYK, pixels, input, width);
+}
+
+
+/*
+ * 'ProbeSeparation()' - Build per-component separation tables for an RGB
+ *                       page and check that they match the full separation.
+ *
+ * The fused RGB path looks up each component of a pixel on its own, which
+ * is only the same as SeparateLine() when every printer plane depends on a
+ * single input component (the identity profile).  The tables are built from
+ * ramps of each component and then checked against a grid of colors and a
+ * fixed pseudo-random sample.
+ */
+
+int					/* O - 1 if separable, 0 otherwise */
+ProbeSeparation(cups_page_header2_t *header)	/* I - Page header */
+{
+  int		i, j,			/* Looping vars */
+		count,			/* Number of probe colors */
+		chunk,			/* Colors per separation call */
+		plane,			/* Current color plane */
+		separable;		/* Tables match? */
+  unsigned	seed;			/* Pseudo-random sample state */
+  unsigned char	*colors,		/* Probe colors */
+		*ptr;			/* Pointer into colors */
+  short		*input;			/* Separated probe colors */
+
+
+  if (header->cupsColorSpace != CUPS_CSPACE_RGB ||
+      header->cupsColorOrder != CUPS_ORDER_CHUNKED ||
+      header->cupsBitsPerColor != 8 || header->cupsBitsPerPixel != 24 ||
+      PrinterPlanes != 3)
+    return (0);
+
+ /*
+  * Ramps of each component over white, a 17x17x17 grid and a fixed sample
+  * of other colors...
+  */
+
+  count = 3 * 256 + 17 * 17 * 17 + 4096;
+
+  if ((colors = malloc(3 * count)) == NULL)
+    return (0);
+
+  if ((input = malloc(3 * count * sizeof(short))) == NULL)
+  {
+    free(colors);
+    return (0);
+  }
+
+  memset(colors, 255, 3 * 3 * 256);
+
+  for (plane = 0, ptr = colors; plane < 3; plane ++)
+    for (i = 0; i < 256; i ++, ptr += 3)
+      ptr[plane] = i;
+
+  for (i = 0; i < 17 * 17 * 17; i ++, ptr += 3)
+  {
+    ptr[0] = i % 17 == 16 ? 255 : 16 * (i % 17);
+    ptr[1] = i / 17 % 17 == 16 ? 255 : 16 * (i / 17 % 17);
+    ptr[2] = i / 289 == 16 ? 255 : 16 * (i / 289);
+  }
+
+  for (i = 0, seed = 1; i < 3 * 4096; i ++, ptr ++)
+  {
+    seed   = seed * 1103515245 + 12345;
+    ptr[0] = seed >> 16;
+  }
+
+ /*
+  * Separate the colors in line-sized pieces...
+  */
+
+  for (i = 0; i < count; i += chunk)
+  {
+    chunk = count - i;
+
+    if (chunk > (int)header->cupsWidth)
+      chunk = header->cupsWidth;
+
+    SeparateLine(header, colors + 3 * i, InputBuffer, chunk);
+    memcpy(input + 3 * i, InputBuffer, 3 * chunk * sizeof(short));
+  }
+
+  for (plane = 0; plane < 3; plane ++)
+    for (i = 0; i < 256; i ++)
+      SepTables[plane][i] = input[3 * (plane * 256 + i) + plane];
+
+  for (i = 0, separable = 1; i < count && separable; i ++)
+    for (j = 0; j < 3; j ++)
+      if (input[3 * i + j] != SepTables[j][colors[3 * i + j]])
+      {
+        separable = 0;
+	break;
+      }
+
+  free(colors);
+  free(input);
+
+  return (separable);
+}
+
+
+/*
+ * 'ProbeMono()' - Build the gray separation table and check that a gray or
+ *                 black page can be dithered once for all three planes.
+ *
+ * The TM-C6xx has no black ink, so gray is printed as composite black.
+ * The C, M and Y dots only come out the same when each plane separates
+ * every gray value the same way and uses the same dither lookup table.
+ */
+
+int					/* O - 1 for the mono path, 0 otherwise */
+ProbeMono(cups_page_header2_t *header)	/* I - Page header */
+{
+  int		i,			/* Looping var */
+		chunk,			/* Values per separation call */
+		plane;			/* Current color plane */
+  unsigned char	gray[256];		/* Gray values */
+  short		*input;			/* Separated gray values */
+
+
+  if (!MonoPath || PrinterPlanes != 3 ||
+      (header->cupsColorSpace != CUPS_CSPACE_W &&
+       header->cupsColorSpace != CUPS_CSPACE_K) ||
+      (header->cupsBitsPerColor != 1 && header->cupsBitsPerColor != 8))
+    return (0);
+
+  for (plane = 1; plane < 3; plane ++)
+    if (memcmp(DitherLuts[0], DitherLuts[plane],
+               (CUPS_MAX_LUT + 1) * sizeof(cups_lut_t)))
+      return (0);
+
+  if ((input = malloc(3 * 256 * sizeof(short))) == NULL)
+    return (0);
+
+  for (i = 0; i < 256; i ++)
+    gray[i] = i;
+
+  for (i = 0; i < 256; i += chunk)
+  {
+    chunk = 256 - i;
+
+    if (chunk > (int)header->cupsWidth)
+      chunk = header->cupsWidth;
+
+    SeparateGray(header, gray + i, InputBuffer, chunk);
+    memcpy(input + 3 * i, InputBuffer, 3 * chunk * sizeof(short));
+  }
+
+  for (i = 0; i < 256; i ++)
+  {
+    if (input[3 * i] != input[3 * i + 1] || input[3 * i] != input[3 * i + 2])
+      break;
+
+    MonoTable[i] = input[3 * i];
+  }
+
+  free(input);
+
+  return (i == 256);
+}
+
+
+/*
+ * 'ProbeBlank()' - Find the byte value of a blank line and check that it
+ *                  separates to no ink.
+ */
+
+int					/* O - Byte value or -1 */
+ProbeBlank(cups_page_header2_t *header)	/* I - Page header */
+{
+  int		i,			/* Looping var */
+		count,			/* Number of separated values */
+		white;			/* Blank byte value */
+  unsigned char	*line;			/* Blank line */
+
+
+  if (header->cupsColorSpace == CUPS_CSPACE_K ||
+      header->cupsColorSpace == CUPS_CSPACE_CMYK)
+    white = 0;
+  else
+    white = 255;
+
+  if ((line = malloc(header->cupsBytesPerLine)) == NULL)
+    return (-1);
+
+  memset(line, white, header->cupsBytesPerLine);
+
+  SeparateLine(header, line, InputBuffer, header->cupsWidth);
+
+  free(line);
+
+  for (i = 0, count = DitherPlanes * header->cupsWidth; i < count; i ++)
+    if (InputBuffer[i])
+      return (-1);
+
+  return (white);
+}
+
+
+/*
+ * 'DitherLine()' - Separate and dither a line of graphics in a band.
+ */
+
+void
+DitherLine(cups_page_header2_t *header,	/* I - Page header */
+           band_t              *band,	/* I - Band */
+           const unsigned      row)	/* I - Line in band */
+{
+  int		plane;			/* Current color plane */
+  const short	*input;			/* Separated line */
+  uint64_t	start;			/* Start time */
+
+
+ /*
+  * Blank lines still go through cupsDitherLine() to keep its state in
+  * step, but skip the separation...
+  */
+
+  if (band->blank[row])
+    input = BlankInput;
+  else
+  {
+    start = tmcStatsStart();
+    SeparateLine(header, band->pixels + row * header->cupsBytesPerLine,
+                 InputBuffer, header->cupsWidth);
+    tmcStatsStop(TMC_STAGE_SEPARATE, start);
+
+    input = InputBuffer;
+  }
+
+  start = tmcStatsStart();
+
+ /*
+  * Dither the pixels; even lines go in the first half of the band and odd
+  * lines in the second (microweave) half...
+  */
+
+  unsigned int base = (row & 1) * DotRowMax / 2;
+  unsigned int index = row / 2;
+  for (plane = 0; plane < DitherPlanes; plane ++)
+  {
+    cupsDitherLine(DitherStates[plane], DitherLuts[plane], input + plane,
+                   DitherPlanes, &band->output[plane][(base + index) * header->cupsWidth]);
+  }
+
+  tmcStatsStop(TMC_STAGE_DITHER, start);
+}
+
+
+/*
+ * 'DitherPlane()' - Dither one plane of a separated band.
+ */
+
+static void
+DitherPlane(void *data,			/* I - Band */
+            int  plane)			/* I - Color plane */
+{
+  band_t	*band = (band_t *)data;	/* Band */
+  unsigned	width = PageHeader->cupsWidth;
+					/* Width of line */
+  unsigned	row;			/* Current line */
+  unsigned char	*dots;			/* Dithered line */
+
+
+  for (row = 0; row < band->rows; row ++)
+  {
+    dots = band->output[plane] + ((row & 1) * DotRowMax / 2 + row / 2) * width;
+
+    if (band->blank[row])
+    {
+      tmcDitherSkip(NativeStates[plane], 1);
+      memset(dots, 0, width);
+    }
+    else
+      tmcDitherLine(NativeStates[plane], DitherLuts[plane],
+                    InputBuffer + row * width * DitherPlanes + plane,
+                    DitherPlanes, dots);
+  }
+}
+
+
+/*
+ * 'DitherRow()' - Dither one line of one plane as part of a wavefront.
+ */
+
+static void
+DitherRow(void *data,			/* I - Band */
+          int  item)			/* I - Line * DitherPlanes + plane */
+{
+  band_t	*band = (band_t *)data;	/* Band */
+  unsigned	width = PageHeader->cupsWidth;
+					/* Width of line */
+  unsigned	row = item / DitherPlanes,
+					/* Current line */
+		plane = item % DitherPlanes;
+					/* Current color plane */
+
+
+  tmcDitherRow(NativeStates[plane], row, DitherLuts[plane],
+               band->blank[row] ? NULL :
+	           InputBuffer + row * width * DitherPlanes + plane,
+	       DitherPlanes,
+	       band->output[plane] +
+	           ((row & 1) * DotRowMax / 2 + row / 2) * width);
+}
+
+
+/*
+ * 'StartWavefront()' - Start a wavefront for each plane of a band.
+ *
+ * Once there are more threads than planes to go around, the lines of a
+ * plane are dithered at the same time too, each one a few pixels behind
+ * the line above it.
+ */
+
+static int				/* O - 1 if started, 0 otherwise */
+StartWavefront(band_t   *band,		/* I - Band */
+               unsigned planes)		/* I - Planes dithered separately */
+{
+  unsigned	plane;			/* Current color plane */
+
+
+  if (DitherThreads <= (int)planes || band->rows < 2)
+    return (0);
+
+  for (plane = 0; plane < DitherPlanes; plane ++)
+    if (tmcDitherBegin(NativeStates[plane], band->rows))
+      return (0);
+
+  return (1);
+}
+
+
+/*
+ * 'SeparateRows()' - Separate the non-blank lines in part of a band.
+ *
+ * The separated lines go in InputBuffer at the same position as in the
+ * band.
+ */
+
+void
+SeparateRows(cups_page_header2_t *header,	/* I - Page header */
+             band_t              *band,	/* I - Band */
+	     unsigned            first,	/* I - First line */
+	     unsigned            last)	/* I - Line after last */
+{
+  unsigned	row,			/* Current line */
+		end;			/* End of run of lines */
+  int		contiguous;		/* Can lines be separated together? */
+
+
+ /*
+  * Without a separate RGB profile (which uses a one-line buffer) and with
+  * no padding at the end of each line, a run of lines in the band is just
+  * a longer line...
+  */
+
+  contiguous = !RGB && header->cupsColorOrder == CUPS_ORDER_CHUNKED &&
+               header->cupsBytesPerLine * 8 ==
+	           header->cupsWidth * header->cupsBitsPerPixel;
+
+  for (row = first; row < last; row = end)
+  {
+    end = row + 1;
+
+    if (band->blank[row])
+      continue;
+
+    if (contiguous)
+      while (end < last && !band->blank[end])
+        end ++;
+
+    SeparateLine(header, band->pixels + row * header->cupsBytesPerLine,
+                 InputBuffer + row * header->cupsWidth * DitherPlanes,
+		 (end - row) * header->cupsWidth);
+  }
+}
+
+
+/*
+ * 'DitherBand()' - Separate a band and then dither its planes in parallel.
+ */
+
+void
+DitherBand(cups_page_header2_t *header,	/* I - Page header */
+           band_t              *band)	/* I - Band */
+{
+  unsigned	plane;			/* Current color plane */
+  uint64_t	start;			/* Start time */
+
+
+  start = tmcStatsStart();
+  SeparateRows(header, band, 0, band->rows);
+  tmcStatsStop(TMC_STAGE_SEPARATE, start);
+
+  start = tmcStatsStart();
+
+  if (StartWavefront(band, DitherPlanes))
+  {
+    tmcWorkersRun(DitherWorkers, DitherPlanes * band->rows, DitherRow, band);
+
+    for (plane = 0; plane < DitherPlanes; plane ++)
+      tmcDitherEnd(NativeStates[plane], band->rows);
+  }
+  else
+    tmcWorkersRun(DitherWorkers, DitherPlanes, DitherPlane, band);
+
+  tmcStatsStop(TMC_STAGE_DITHER, start);
+}
+
+
+/*
+ * 'OrderedRows()' - Separate and dither one group of lines in a band.
+ */
+
+static void
+OrderedRows(void *data,			/* I - Band */
+            int  item)			/* I - Group of lines */
+{
+  band_t	*band = (band_t *)data;	/* Band */
+  unsigned	width = PageHeader->cupsWidth;
+					/* Width of line */
+  unsigned	row,			/* Current line */
+		first,			/* First line in group */
+		last;			/* Line after last */
+  unsigned	plane;			/* Current color plane */
+  unsigned char	*dots;			/* Dithered line */
+  uint64_t	start;			/* Start time */
+
+
+  first = item * BAND_ROWS_TASK;
+  last  = first + BAND_ROWS_TASK < band->rows ? first + BAND_ROWS_TASK :
+                                                band->rows;
+
+  if (!RGB)
+  {
+    start = tmcStatsStart();
+    SeparateRows(PageHeader, band, first, last);
+    tmcStatsStop(TMC_STAGE_SEPARATE, start);
+  }
+
+  start = tmcStatsStart();
+
+  for (row = first; row < last; row ++)
+    for (plane = 0; plane < DitherPlanes; plane ++)
+    {
+      dots = band->output[plane] +
+             ((row & 1) * DotRowMax / 2 + row / 2) * width;
+
+      if (band->blank[row])
+        memset(dots, 0, width);
+      else
+        tmcOrderedLine(OrderedTables[plane],
+	               InputBuffer + row * width * DitherPlanes + plane,
+		       DitherPlanes, width, band->y + row, dots);
+    }
+
+  tmcStatsStop(TMC_STAGE_DITHER, start);
+}
+
+
+/*
+ * 'OrderedBand()' - Separate and dither groups of lines in parallel.
+ *
+ * Ordered dithering keeps no state from line to line, so the band is split
+ * into groups of lines that are separated and dithered at the same time.
+ * The CMYK separation only reads its tables, but a separate RGB profile
+ * converts through a shared line buffer, so those bands are separated
+ * first.
+ */
+
+void
+OrderedBand(cups_page_header2_t *header,	/* I - Page header */
+            band_t              *band)	/* I - Band */
+{
+  uint64_t	start;			/* Start time */
+
+
+  if (RGB)
+  {
+    start = tmcStatsStart();
+    SeparateRows(header, band, 0, band->rows);
+    tmcStatsStop(TMC_STAGE_SEPARATE, start);
+  }
+
+  tmcWorkersRun(DitherWorkers,
+                (band->rows + BAND_ROWS_TASK - 1) / BAND_ROWS_TASK,
+		OrderedRows, band);
+}
+
+
+/*
+ * 'FuseRow()' - Separate, dither and pack one RGB line of a wavefront.
+ */
+
+static void
+FuseRow(void *data,			/* I - Band */
+        int  row)			/* I - Line in band */
+{
+  band_t	*band = (band_t *)data;	/* Band */
+  unsigned	plane;			/* Current color plane */
+  unsigned char	*dots[3];		/* Packed lines */
+
+
+  for (plane = 0; plane < 3; plane ++)
+    dots[plane] = band->output[plane] +
+                  ((row & 1) * DotRowMax / 2 + row / 2) * DotBufferSize;
+
+  tmcDitherRGBRow(NativeStates, row, DitherLuts, SepTables,
+                  band->blank[row] ? NULL :
+		      band->pixels + row * PageHeader->cupsBytesPerLine,
+		  dots);
+}
+
+
+/*
+ * 'FuseBand()' - Separate, dither and pack an RGB band in one pass.
+ */
+
+void
+FuseBand(cups_page_header2_t *header,	/* I - Page header */
+         band_t              *band)	/* I - Band */
+{
+  unsigned	row;			/* Current line */
+  unsigned	plane;			/* Current color plane */
+  unsigned char	*dots[3];		/* Packed lines */
+  uint64_t	start;			/* Start time */
+
+
+  start = tmcStatsStart();
+
+  if (StartWavefront(band, 1))
+  {
+    tmcWorkersRun(DitherWorkers, band->rows, FuseRow, band);
+
+    for (plane = 0; plane < 3; plane ++)
+      tmcDitherEnd(NativeStates[plane], band->rows);
+
+    tmcStatsStop(TMC_STAGE_FUSED, start);
+    return;
+  }
+
+  for (row = 0; row < band->rows; row ++)
+  {
+    for (plane = 0; plane < 3; plane ++)
+      dots[plane] = band->output[plane] +
+                    ((row & 1) * DotRowMax / 2 + row / 2) * DotBufferSize;
+
+    if (band->blank[row])
+    {
+      for (plane = 0; plane < 3; plane ++)
+      {
+        tmcDitherSkip(NativeStates[plane], 1);
+        memset(dots[plane], 0, DotBufferSize);
+      }
+    }
+    else
+      tmcDitherRGB(NativeStates, DitherLuts, SepTables,
+                   band->pixels + row * header->cupsBytesPerLine, dots);
+  }
+
+  tmcStatsStop(TMC_STAGE_FUSED, start);
+}
+
+
+/*
+ * 'MonoBand()' - Pack a band of 1-bit gray or black lines.
+ *
+ * Each byte of 8 pixels becomes two bytes of 2-bit dots through a table,
+ * with no separation or dithering.
+ */
+
+void
+MonoBand(cups_page_header2_t *header,	/* I - Page header */
+         band_t              *band)	/* I - Band */
+{
+  unsigned	row,			/* Current line */
+		x,			/* Current byte */
+		bytes;			/* Bytes of pixels in line */
+  const unsigned char *pixels;		/* Raster line */
+  unsigned char	*dots;			/* Packed line */
+  uint64_t	start;			/* Start time */
+
+
+  start = tmcStatsStart();
+
+  bytes = (header->cupsWidth + 7) / 8;
+
+  for (row = 0; row < band->rows; row ++)
+  {
+    dots = band->output[0] +
+           ((row & 1) * DotRowMax / 2 + row / 2) * DotBufferSize;
+
+    if (band->blank[row])
+    {
+      memset(dots, 0, DotBufferSize);
+      continue;
+    }
+
+    pixels = band->pixels + row * header->cupsBytesPerLine;
+
+    for (x = 0; x < bytes; x ++)
+    {
+      dots[2 * x] = MonoDots[pixels[x]] >> 8;
+
+      if (2 * x + 1 < DotBufferSize)
+        dots[2 * x + 1] = MonoDots[pixels[x]];
+    }
+
+   /*
+    * Clear the dots of any padding bits after the last pixel...
+    */
+
+    if (header->cupsWidth & 3)
+      dots[DotBufferSize - 1] &= (0xff00 >> (2 * (header->cupsWidth & 3))) &
+                                 255;
+  }
+
+  tmcStatsStop(TMC_STAGE_PACK, start);
+}
+
+
+/*
+ * 'DitherBands()' - Separate and dither bands as the reader queues them.
+ */
+
+static void *				/* O - Thread status */
+DitherBands(void *data)			/* I - Unused */
+{
+  band_t	*band;			/* Current band */
+  unsigned	row;			/* Current line */
+  unsigned	plane;			/* Current color plane */
+
+
+  (void)data;
+
+  pthread_mutex_lock(&BandMutex);
+
+  for (;;)
+  {
+    while (BandsDithered == BandsRead && !PipelineDone)
+      pthread_cond_wait(&BandCond, &BandMutex);
+
+    if (BandsDithered == BandsRead)
+      break;
+
+    band = Bands + BandsDithered % BAND_QUEUE_SIZE;
+
+    pthread_mutex_unlock(&BandMutex);
+
+    if (MonoBits)
+    {
+     /*
+      * 1-bit lines are already dithered, blank bands are only fed past...
+      */
+
+      if (band->blank_rows < band->rows)
+        MonoBand(PageHeader, band);
+    }
+    else if (DitherMode == DITHER_NATIVE && band->blank_rows == band->rows)
+    {
+     /*
+      * Nothing to dither, just advance the error state...
+      */
+
+      for (plane = 0; plane < DitherPlanes; plane ++)
+        tmcDitherSkip(NativeStates[plane], band->rows);
+    }
+    else if (DitherMode == DITHER_ORDERED)
+    {
+     /*
+      * Blank bands are only fed past, so there is nothing to dither...
+      */
+
+      if (band->blank_rows < band->rows)
+        OrderedBand(PageHeader, band);
+    }
+    else if (FusedRGB)
+      FuseBand(PageHeader, band);
+    else if (DitherMode == DITHER_NATIVE)
+      DitherBand(PageHeader, band);
+    else
+    {
+      for (row = 0; row < band->rows; row ++)
+        DitherLine(PageHeader, band, row);
+    }
+
+    pthread_mutex_lock(&BandMutex);
+    BandsDithered ++;
+    pthread_cond_broadcast(&BandCond);
+  }
+
+  pthread_mutex_unlock(&BandMutex);
+
+  return (NULL);
+}
+
+
+/*
+ * 'EmitBands()' - Pack, compress and write bands as they are dithered.
+ */
+
+static void *				/* O - Thread status */
+EmitBands(void *data)			/* I - Unused */
+{
+  band_t	*band;			/* Current band */
+
+
+  (void)data;
+
+  pthread_mutex_lock(&BandMutex);
+
+  for (;;)
+  {
+    while (BandsEmitted == BandsDithered && !PipelineDone)
+      pthread_cond_wait(&BandCond, &BandMutex);
+
+    if (BandsEmitted == BandsDithered)
+      break;
+
+    band = Bands + BandsEmitted % BAND_QUEUE_SIZE;
+
+    pthread_mutex_unlock(&BandMutex);
+
+    EmitDotRows(PagePPD, PageHeader, band);
+
+    pthread_mutex_lock(&BandMutex);
+    BandsEmitted ++;
+    pthread_cond_broadcast(&BandCond);
+  }
+
+  pthread_mutex_unlock(&BandMutex);
+
+  return (NULL);
+}
+
+
+/*
+ * 'StartPipeline()' - Start the dither and emit threads.
+ */
+
+void
+StartPipeline(ppd_file_t *ppd)		/* I - PPD file */
+{
+  const char	*mode;			/* Dithering mode or encoder name */
+  int		threads;		/* Threads per stage */
+  int		height,			/* Lines per band */
+		first;			/* Lines in first band */
+  int		cache_size;		/* Band cache size in MiB */
+  const char	*cache_dir;		/* Band cache directory */
+  int		plane;			/* Current plane */
+
+
+ /*
+  * The native dither mode handles each plane independently, so the planes
+  * can be dithered at the same time, and the ordered modes keep no state
+  * at all, so groups of lines can; packing and compression are always
+  * per-plane...
+  */
+
+  if ((mode = GetOption(ppd, "TMCDither")) == NULL)
+    DitherMode = DITHER_CUPS;
+  else if (!strcmp(mode, "native"))
+    DitherMode = DITHER_NATIVE;
+  else if (!strcmp(mode, "ordered"))
+  {
+    DitherMode    = DITHER_ORDERED;
+    OrderedMatrix = TMC_ORDERED_BAYER;
+  }
+  else if (!strcmp(mode, "bluenoise"))
+  {
+    DitherMode    = DITHER_ORDERED;
+    OrderedMatrix = TMC_ORDERED_BLUENOISE;
+  }
+  else
+    DitherMode = DITHER_CUPS;
+
+  tmcOrderedInit();
+
+  tmcPackBitsInit();
+
+  if ((mode = GetOption(ppd, "TMCPackBits")) != NULL &&
+      strcmp(mode, "auto") && tmcPackBitsSelect(mode))
+    fprintf(stderr, "DEBUG: PackBits encoder \"%s\" is not available.\n",
+            mode);
+
+  fprintf(stderr, "DEBUG: PackBits = %s\n", tmcPackBitsName());
+
+  tmcPackInit();
+
+  fprintf(stderr, "DEBUG: Pack = %s\n", tmcPackName());
+
+  threads = GetIntOption(ppd, "TMCThreads", 1);
+
+  if (threads < 1)
+    threads = 1;
+  else if (threads > 7)
+    threads = 7;
+
+  fprintf(stderr, "DEBUG: DitherMode = %s\n",
+          DitherMode == DITHER_NATIVE ? "native" :
+	  DitherMode == DITHER_CUPS ? "cups" :
+	  OrderedMatrix == TMC_ORDERED_BAYER ? "ordered" : "bluenoise");
+
+  if (DitherMode == DITHER_ORDERED)
+    fprintf(stderr, "DEBUG: Ordered = %s\n", tmcOrderedName());
+
+  fprintf(stderr, "DEBUG: Threads = %d\n", threads);
+
+  MonoPath = GetIntOption(ppd, "TMCMono", 1);
+
+  fprintf(stderr, "DEBUG: MonoPath = %d\n", MonoPath);
+
+ /*
+  * Bands hold an even number of lines, split between the two microweave
+  * passes; smaller bands reach the printer sooner but send more commands...
   */
 
-  cupsWritePrintData("LD\000\000", 4);
+  height = GetIntOption(ppd, "TMCBandHeight", BAND_ROWS_MAX) & ~1;
+
+  if (height < 2)
+    height = 2;
+  else if (height > BAND_ROWS_MAX)
+    height = BAND_ROWS_MAX;
+
+  first = GetIntOption(ppd, "TMCFirstBand", 0) & ~1;
+
+  if (first < 2 || first >= height)
+    first = 0;
+
+  BandHeight      = height;
+  FirstBandHeight = first;
+
+  fprintf(stderr, "DEBUG: BandHeight = %u, FirstBand = %u\n", BandHeight,
+          FirstBandHeight);
+
+  DitherThreads = DitherMode == DITHER_CUPS ? 1 : threads;
+
+  if (threads > 1)
+  {
+    if (DitherMode != DITHER_CUPS)
+      DitherWorkers = tmcWorkersNew(threads - 1);
+
+    EmitWorkers = tmcWorkersNew(threads - 1);
+  }
 
  /*
-  * Exit remote mode...
+  * Keep compressed bands for repeated artwork; the size is in MiB...
   */
 
- cupsWritePrintData("\033\000\000\000", 4);
+  if ((cache_size = GetIntOption(ppd, "TMCBandCache", 32)) > 0)
+  {
+    cache_dir = GetOption(ppd, "TMCBandCacheDir");
+    BandCache = tmcCacheNew((size_t)cache_size * 1048576, cache_dir);
+
+    fprintf(stderr, "DEBUG: BandCache = %d MiB, directory \"%s\"\n",
+            cache_size, cache_dir && *cache_dir ? cache_dir : "");
+  }
+
+  Adaptive = GetIntOption(ppd, "TMCAdaptive", 1);
+
+  for (plane = 0; plane < 7; plane ++)
+    tmcAdaptReset(Adapt + plane);
+
+  fprintf(stderr, "DEBUG: Adaptive = %d\n", Adaptive);
+
+  BandsRead     = 0;
+  BandsDithered = 0;
+  BandsEmitted  = 0;
+  PipelineDone  = 0;
+
+  pthread_create(&DitherThread, NULL, DitherBands, NULL);
+  pthread_create(&EmitThread, NULL, EmitBands, NULL);
 }
 
 
 /*
- * 'CancelJob()' - Cancel the current job...
+ * 'FlushBands()' - Queue any partial band and wait for all bands to be
+ *                  written.
  */
 
 void
-CancelJob(int sig)			/* I - Signal */
+FlushBands(void)
 {
-  (void)sig;
+  pthread_mutex_lock(&BandMutex);
 
-  Canceled = 1;
+  while (BandsEmitted != BandsRead)
+    pthread_cond_wait(&BandCond, &BandMutex);
+
+  if (Bands[BandsRead % BAND_QUEUE_SIZE].rows > 0)
+  {
+    BandsRead ++;
+    pthread_cond_broadcast(&BandCond);
+
+    while (BandsEmitted != BandsRead)
+      pthread_cond_wait(&BandCond, &BandMutex);
+  }
+
+  pthread_mutex_unlock(&BandMutex);
+}
+
+
+/*
+ * 'StopPipeline()' - Stop the dither and emit threads.
+ */
+
+void
+StopPipeline(void)
+{
+  tmc_cache_stats_t	stats;		/* Band cache counters */
+  tmc_adapt_stats_t	adapt;		/* Compression policy counters */
+  int			plane;		/* Current plane */
+
+
+  pthread_mutex_lock(&BandMutex);
+  PipelineDone = 1;
+  pthread_cond_broadcast(&BandCond);
+  pthread_mutex_unlock(&BandMutex);
+
+  pthread_join(DitherThread, NULL);
+  pthread_join(EmitThread, NULL);
+
+  tmcWorkersDelete(DitherWorkers);
+  tmcWorkersDelete(EmitWorkers);
+
+  DitherWorkers = NULL;
+  EmitWorkers   = NULL;
+
+  if (BandCache)
+  {
+    tmcCacheStats(BandCache, &stats);
+
+    fprintf(stderr,
+            "DEBUG: Band cache = %lu hits (%lu from disk), %lu misses, "
+	    "%llu bytes not packed or compressed\n", stats.hits,
+	    stats.disk_hits, stats.misses, stats.bytes_saved);
+
+    tmcCacheDelete(BandCache);
+    BandCache = NULL;
+  }
+
+  if (Adaptive)
+  {
+    memset(&adapt, 0, sizeof(adapt));
+
+    for (plane = 0; plane < 7; plane ++)
+    {
+      adapt.compressed += Adapt[plane].stats.compressed;
+      adapt.raw        += Adapt[plane].stats.raw;
+      adapt.probes     += Adapt[plane].stats.probes;
+      adapt.probe_hits += Adapt[plane].stats.probe_hits;
+      adapt.checks     += Adapt[plane].stats.checks;
+      adapt.check_hits += Adapt[plane].stats.check_hits;
+    }
+
+    fprintf(stderr,
+            "DEBUG: Adaptive compression = %lu passes compressed, %lu raw, "
+	    "%lu of %lu probes compressed, %lu of %lu raw checks right\n",
+	    adapt.compressed, adapt.raw, adapt.probe_hits, adapt.probes,
+	    adapt.check_hits, adapt.checks);
+  }
+}
+
+
+/*
+ * 'DaemonPath()' - Get the daemon socket path for this queue.
+ *
+ * The scheduler gives each job a private TMPDIR; without one there is no
+ * safe place for the socket, so there is no daemon.
+ */
+
+static const char *			/* O - Socket path or NULL */
+DaemonPath(char   *path,		/* I - Path buffer */
+           size_t pathsize)		/* I - Size of path buffer */
+{
+  const char	*tmpdir,		/* Temporary directory */
+		*printer;		/* Queue name */
+
+
+  if ((tmpdir = getenv("TMPDIR")) == NULL || !*tmpdir)
+    return (NULL);
+
+  if ((printer = getenv("PRINTER")) == NULL || !*printer)
+    printer = "default";
+
+  snprintf(path, pathsize, "%s/tmc6xx-%s.sock", tmpdir, printer);
+
+  return (path);
+}
+
+
+/*
+ * 'SubmitJob()' - Hand the job to a running daemon.
+ *
+ * The daemon prints straight to our stdout and logs to our stderr, so this
+ * process just waits for the exit status.  If this process is killed to
+ * cancel the job, the daemon sees the connection close and cancels too.
+ */
+
+int					/* O - Exit status, -1 for no daemon */
+SubmitJob(int  argc,			/* I - Number of command-line args */
+          char *argv[])			/* I - Command-line arguments */
+{
+  char		path[1024],		/* Socket path */
+		ppdenv[1024],		/* PPD=... */
+		statsenv[256];		/* TMC6XX_STATS=... */
+  const char	*args[7],		/* Job arguments */
+		*sockpath,		/* Socket path */
+		*value;			/* Environment value */
+  int		sock,			/* Daemon connection */
+		fds[TMC_DAEMON_FDS],	/* Raster, printer and log */
+		i,			/* Looping var */
+		status;			/* Exit status */
+
+
+  if ((sockpath = DaemonPath(path, sizeof(path))) == NULL ||
+      (sock = tmcDaemonConnect(sockpath)) < 0)
+    return (-1);
+
+  if (argc == 7)
+  {
+    if ((fds[0] = open(argv[6], O_RDONLY)) == -1)
+    {
+      close(sock);
+      return (-1);
+    }
+  }
+  else
+    fds[0] = 0;
+
+  fds[1] = 1;
+  fds[2] = 2;
+
+  for (i = 0; i < 5; i ++)
+    args[i] = argv[i + 1];
+
+  value = getenv("PPD");
+  snprintf(ppdenv, sizeof(ppdenv), "PPD=%s", value ? value : "");
+  value = getenv("TMC6XX_STATS");
+  snprintf(statsenv, sizeof(statsenv), "TMC6XX_STATS=%s", value ? value : "");
+
+  args[5] = ppdenv;
+  args[6] = statsenv;
+
+  if (tmcDaemonSend(sock, 7, args, fds))
+    status = -1;
+  else if ((status = tmcDaemonWait(sock)) < 0)
+  {
+    _cupsLangPrintFilter(stderr, "ERROR",
+                         _("The rendering daemon stopped during the job."));
+    status = 1;
+  }
+
+  if (fds[0] != 0)
+    close(fds[0]);
+
+  close(sock);
+
+  return (status);
+}
+
+
+/*
+ * 'WatchClient()' - Cancel the daemon's job when its filter goes away.
+ */
+
+static void *				/* O - Unused */
+WatchClient(void *data)			/* I - Connection and wakeup pipe */
+{
+  int		*fds = (int *)data;	/* Descriptors */
+  struct pollfd	pfds[2];		/* Poll data */
+
+
+  pfds[0].fd     = fds[0];
+  pfds[0].events = POLLIN;
+  pfds[1].fd     = fds[1];
+  pfds[1].events = POLLIN;
+
+  while (poll(pfds, 2, -1) < 0)
+    if (errno != EINTR)
+      return (NULL);
+
+ /*
+  * The filter sends nothing after the job, so anything to read on the
+  * connection means it has closed...
+  */
+
+  if (pfds[0].revents && !pfds[1].revents)
+    Canceled = 1;
+
+  return (NULL);
+}
+
+
+/*
+ * 'ServeJob()' - Print one job for a filter process.
+ */
+
+static int				/* O - 1 to keep running, 0 to exit */
+ServeJob(int        sock,		/* I - Connection */
+         ppd_file_t **ppd,		/* IO - PPD file */
+	 char       *ppdpath,		/* IO - Path of PPD file */
+	 size_t     ppdsize,		/* I - Size of path buffer */
+	 struct stat *ppdinfo)		/* IO - PPD file information */
+{
+  int		num_args;		/* Number of job arguments */
+  char		**args;			/* Job arguments */
+  int		fds[TMC_DAEMON_FDS],	/* Raster, printer and log */
+		wake[2],		/* Wakeup pipe for watcher */
+		watch[2],		/* Descriptors for watcher */
+		null,			/* /dev/null */
+		keep,			/* Keep running? */
+		status;			/* Exit status */
+  struct stat	info;			/* PPD file information */
+  pthread_t	watcher;		/* Connection watcher */
+
+
+  if (tmcDaemonReceive(sock, &num_args, &args, fds))
+    return (1);
+
+  if (num_args != 7 || strncmp(args[5], "PPD=", 4) ||
+      strncmp(args[6], "TMC6XX_STATS=", 13) || pipe(wake))
+  {
+    free(args);
+    close(fds[0]);
+    close(fds[1]);
+    close(fds[2]);
+    return (1);
+  }
+
+ /*
+  * Log to the job's stderr and print to its stdout...
+  */
+
+  dup2(fds[2], 2);
+  tmcOutputInit(fds[1]);
+
+  setenv("PPD", args[5] + 4, 1);
+  setenv("TMC6XX_STATS", args[6] + 13, 1);
+
+ /*
+  * Keep the PPD file, and the page data loaded from it, until the file
+  * changes...
+  */
+
+  if (!*ppd || strcmp(ppdpath, args[5] + 4) || stat(ppdpath, &info) ||
+      info.st_mtime != ppdinfo->st_mtime || info.st_ino != ppdinfo->st_ino)
+  {
+    if (*ppd)
+    {
+      FreePage();
+      ppdClose(*ppd);
+    }
+
+    strncpy(ppdpath, args[5] + 4, ppdsize - 1);
+    ppdpath[ppdsize - 1] = '\0';
+
+    if ((*ppd = ppdOpenFile(ppdpath)) != NULL && stat(ppdpath, ppdinfo))
+      memset(ppdinfo, 0, sizeof(struct stat));
+  }
+  else
+    fputs("DEBUG: Reusing PPD file from previous job.\n", stderr);
+
+  NumOptions = cupsParseOptions(args[4], 0, &Options);
+
+  if (*ppd)
+  {
+    ppdMarkDefaults(*ppd);
+    cupsMarkOptions(*ppd, NumOptions, Options);
+
+    watch[0] = sock;
+    watch[1] = wake[0];
+    Canceled = 0;
+
+   /*
+    * cupsDitherLine() uses rand(), so start each job from the same seed
+    * as a new process would...
+    */
+
+    srand(1);
+
+    pthread_create(&watcher, NULL, WatchClient, watch);
+
+    status = PrintJob(*ppd, fds[0]);
+    keep   = GetIntOption(*ppd, "TMCDaemon", 0) > 0;
+
+    write(wake[1], "", 1);
+    pthread_join(watcher, NULL);
+  }
+  else
+  {
+    _cupsLangPrintFilter(stderr, "ERROR",
+                         _("The PPD file could not be opened."));
+    status = 1;
+    keep   = 0;
+  }
+
+  cupsFreeOptions(NumOptions, Options);
+  NumOptions = 0;
+  Options    = NULL;
+
+ /*
+  * Let go of the job's descriptors before answering, so the filter's log
+  * and output pipes close when it exits...
+  */
+
+  tmcOutputInit(1);
+
+  if ((null = open("/dev/null", O_WRONLY)) >= 0)
+  {
+    dup2(null, 2);
+    close(null);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  close(fds[2]);
+  close(wake[0]);
+  close(wake[1]);
+  free(args);
+
+  tmcDaemonReply(sock, status);
+
+  return (keep);
 }
 
 
 /*
- * 'CompressData()' - Compress a line of graphics.
+ * 'StartDaemon()' - Start a daemon to print the next jobs for this queue.
+ *
+ * The daemon is a detached copy of this process that keeps the PPD file,
+ * color profiles, lookup tables and page buffers between jobs, and exits
+ * after "idle" seconds without a job.  The current job has already been
+ * printed.
  */
 
 void
-CompressData(ppd_file_t          *ppd,	/* I - PPD file information */
-             const unsigned char *line,	/* I - Data to compress */
-             const int           length,/* I - Number of bytes */
-	     int                 plane,	/* I - Color plane */
-	     int                 type,	/* I - Type of compression */
-	     const int           rows,	/* I - Number of lines to write */
-	     const int           offset, /* I - Head offset */
-	     const int           microweave)
-{
-  register const unsigned char *line_ptr,
-					/* Current byte pointer */
-        	*line_end,		/* End-of-line byte pointer */
-        	*start;			/* Start of compression sequence */
-  register unsigned char *comp_ptr;	/* Pointer into compression buffer */
-  register int  count;			/* Count of bytes for output */
-  register int	bytes;			/* Number of bytes per row */
-  static int	ctable[7][7] =		/* Colors */
-		{
-		  {  0,  0,  0,  0,  0,  0,  0 },	/* K */
-		  {  0, 16,  0,  0,  0,  0,  0 },	/* Kk */
-		  {  2,  1,  4,  0,  0,  0,  0 },	/* CMY */
-		  {  2,  1,  4,  0,  0,  0,  0 },	/* CMYK */
-		  {  0,  0,  0,  0,  0,  0,  0 },
-		  {  2, 18,  1, 17,  4,  0,  0 },	/* CcMmYK */
-		  {  2, 18,  1, 17,  4,  0, 16 },	/* CcMmYKk */
-		};
+StartDaemon(ppd_file_t *ppd,		/* I - PPD file */
+            int        idle)		/* I - Seconds to wait for a job */
+{
+  char		path[1024],		/* Socket path */
+		ppdpath[1024];		/* Path of PPD file */
+  struct stat	ppdinfo;		/* PPD file information */
+  const char	*value;			/* PPD environment variable */
+  pid_t		pid;			/* Child process */
+  int		fd,			/* Looping var */
+		listener,		/* Listening socket */
+		sock;			/* Job connection */
 
 
-  switch (type)
+  if (!DaemonPath(path, sizeof(path)))
   {
-    case 0 :
-       /*
-	* Do no compression...
-	*/
-
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	break;
-
-    default :
-       /*
-        * Do TIFF pack-bits encoding...
-        */
-
-	line_ptr = (const unsigned char *)line;
-	line_end = (const unsigned char *)line + length;
-	comp_ptr = CompBuffer;
-
-	while (line_ptr < line_end && (comp_ptr - CompBuffer) < length)
-	{
-	  if ((line_ptr + 1) >= line_end)
-	  {
-	   /*
-	    * Single byte on the end...
-	    */
-
-	    *comp_ptr++ = 0x00;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else if (line_ptr[0] == line_ptr[1])
-	  {
-	   /*
-	    * Repeated sequence...
-	    */
-
-	    line_ptr ++;
-	    count = 2;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] == line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = 257 - count;
-	    *comp_ptr++ = *line_ptr++;
-	  }
-	  else
-	  {
-	   /*
-	    * Non-repeated sequence...
-	    */
-
-	    start    = line_ptr;
-	    line_ptr ++;
-	    count    = 1;
-
-	    while (line_ptr < (line_end - 1) &&
-        	   line_ptr[0] != line_ptr[1] &&
-        	   count < 127)
-	    {
-              line_ptr ++;
-              count ++;
-	    }
-
-	    *comp_ptr++ = count - 1;
-
-	    memcpy(comp_ptr, start, count);
-	    comp_ptr += count;
-	  }
-	}
-
-        if ((comp_ptr - CompBuffer) < length)
-	{
-          line_ptr = (const unsigned char *)CompBuffer;
-          line_end = (const unsigned char *)comp_ptr;
-	}
-	else
-	{
-	  type     = 0;
-	  line_ptr = (const unsigned char *)line;
-	  line_end = (const unsigned char *)line + length;
-	}
-	break;
+    fputs("DEBUG: TMPDIR not set, not starting a resident process.\n",
+          stderr);
+    return;
   }
 
-  if (microweave || offset)
+  if ((pid = fork()) < 0)
+    return;
+  else if (pid > 0)
   {
-    cupsWritePrintData("\033($\004\000", 5);
-    putchar(offset & 255);
-    putchar((offset >> 8) & 255);
-    putchar((offset >> 16) & 255);
-    putchar((offset >> 24) & 255);
+    waitpid(pid, NULL, 0);
+    return;
   }
 
  /*
-  * Send the graphics...
+  * Detach from the job: a second fork so the filter doesn't wait for us,
+  * a new session, and no descriptors the scheduler is waiting on...
   */
 
-  bytes = length / rows;
-
-   /*
-    * Send graphics with ESC i command.
-    */
+  if (fork() != 0)
+    _exit(0);
 
-    printf("\033i");
-    putchar(ctable[PrinterPlanes - 1][plane] | (microweave ? 64 : 0));
-    putchar(type != 0);
-    putchar(BitPlanes);
-    putchar(bytes & 255);
-    putchar(bytes >> 8);
-    putchar(rows & 255);
-    putchar(rows >> 8);
+  setsid();
 
-  cupsWritePrintData(line_ptr, line_end - line_ptr);
+  for (fd = 0; fd < 1024; fd ++)
+    close(fd);
 
- /*
-  * Position the print head...
-  */
-  if (microweave)
-    putchar(0x0d);
+  open("/dev/null", O_RDONLY);
+  open("/dev/null", O_WRONLY);
+  open("/dev/null", O_WRONLY);
 
-}
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGTERM, SIG_DFL);
 
-void EmitDotRows(ppd_file_t *ppd, cups_page_header2_t *header)
-{
-    unsigned plane;
-    unsigned input_width = DotRowMax * header->cupsWidth;
-  unsigned rows = DotRowCount / 2;
+  if ((listener = tmcDaemonListen(path)) < 0)
+    _exit(0);
 
-    if (!DotRowCount)
-    {
-        return;
-    }
+  value = getenv("PPD");
+  strncpy(ppdpath, value ? value : "", sizeof(ppdpath) - 1);
+  ppdpath[sizeof(ppdpath) - 1] = '\0';
 
-    for (plane = 0; plane < PrinterPlanes; plane++)
-    {
-        unsigned microweave;
+  if (stat(ppdpath, &ppdinfo))
+    memset(&ppdinfo, 0, sizeof(ppdinfo));
 
-         /*
-          * Handle microweaved output...
-          */
+  Resident = 1;
 
-        // Anything to print?
-        if (cupsCheckBytes(OutputBuffers[plane], input_width))
-            continue;
+  for (;;)
+  {
+    if ((sock = tmcDaemonAccept(listener, idle)) < 0)
+    {
+      if (errno == ETIMEDOUT)
+        break;
 
-        for (microweave = 0; microweave < 2; microweave++)
-        {
-            int row;
+      continue;
+    }
 
-            for (row = 0; row < rows; row++)
-            {
-                cupsPackHorizontal2(&OutputBuffers[plane][input_width / 2 * microweave + row * header->cupsWidth], &DotBuffers[plane][row * DotBufferSize], header->cupsWidth, 1);
-            }
+    fd = ServeJob(sock, &ppd, ppdpath, sizeof(ppdpath), &ppdinfo);
 
-            if (OutputFeed > 0)
-            {
-                cupsWritePrintData("\033(v\004\000", 5);
-                putchar(OutputFeed & 255);
-                putchar((OutputFeed >> 8) & 255);
-                putchar((OutputFeed >> 16) & 255);
-                putchar((OutputFeed >> 24) & 255);
-                OutputFeed = 0;
-             }
+    close(sock);
 
-             CompressData(ppd, DotBuffers[plane], DotBufferSize * rows, plane, header->cupsCompression, rows, 0, microweave);
-        }
+    if (!fd)
+      break;
+  }
 
-        fflush(stdout);
-    }
+  unlink(path);
 
-    OutputFeed += DotRowCount;
-    DotRowCount = 0;
+  _exit(0);
 }
 
 
 /*
- * 'ProcessLine()' - Read graphics from the page stream and output as needed.
+ * 'PrintJob()' - Print the pages of a raster stream.
  */
 
-void
-ProcessLine(ppd_file_t         *ppd,	/* I - PPD file */
-            cups_raster_t      *ras,	/* I - Raster stream */
-            cups_page_header2_t *header,	/* I - Page header */
-            const int          y)	/* I - Current scanline */
+int					/* O - Exit status */
+PrintJob(ppd_file_t *ppd,		/* I - PPD file */
+         int        fd)			/* I - Raster file descriptor */
 {
-  int		plane,			/* Current color plane */
-		width,			/* Width of line */
-		offset,			/* Offset to current line */
-		pass;			/* Pass number */
+  tmc_raster_t		*ras;		/* Raster stream for printing */
+  cups_page_header2_t	header;		/* Page header from file */
+  int			page;		/* Current page */
+  unsigned		copies;		/* Number of copies of page */
+  unsigned		y,		/* Current line */
+			lines,		/* Lines read */
+			progress;	/* Line of next progress message */
+
 
+  tmcStatsInit(GetIntOption(ppd, "TMCStats", 0));
+
+  if ((ras = tmcRasterOpen(fd)) != NULL)
+    fprintf(stderr, "DEBUG: Raster stream is %s.\n",
+            tmcRasterMapped(ras) ? "mapped" : "read");
 
  /*
-  * Read a row of graphics...
+  * Initialize the print device...
   */
 
-  if (!cupsRasterReadPixels(ras, PixelBuffer, header->cupsBytesPerLine))
-    return;
+  Setup(ppd);
+
+  StartPipeline(ppd);
 
  /*
-  * Perform the color separation...
+  * Process pages as needed...
   */
 
-  width    = header->cupsWidth;
+  page = 0;
 
-  switch (header->cupsColorSpace)
+  while (ras && tmcRasterReadHeader(ras, &header))
   {
-    case CUPS_CSPACE_W :
-        if (RGB)
-	{
-	  cupsRGBDoGray(RGB, PixelBuffer, CMYKBuffer, width);
-	  cupsCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
-	}
-	else
-          cupsCMYKDoGray(CMYK, PixelBuffer, InputBuffer, width);
-	break;
+   /*
+    * Write a status message with the page number and number of copies.
+    */
 
-    case CUPS_CSPACE_K :
-        cupsCMYKDoBlack(CMYK, PixelBuffer, InputBuffer, width);
-	break;
+    if (Canceled)
+      break;
 
-    default :
-    case CUPS_CSPACE_RGB :
-        if (RGB)
-	{
-	  cupsRGBDoRGB(RGB, PixelBuffer, CMYKBuffer, width);
-	  cupsCMYKDoCMYK(CMYK, CMYKBuffer, InputBuffer, width);
-	}
-	else
-          cupsCMYKDoRGB(CMYK, PixelBuffer, InputBuffer, width);
-	break;
+    if (!strcmp(header.MediaClass, "PwgRaster") &&
+        !PwgPage(ppd, ras, &header))
+      continue;
 
-    case CUPS_CSPACE_CMYK :
-        cupsCMYKDoCMYK(CMYK, PixelBuffer, InputBuffer, width);
+    page ++;
+
+    copies = header.NumCopies > 1 ? header.NumCopies : 1;
+
+    fprintf(stderr, "PAGE: %d %u\n", page, copies);
+    _cupsLangPrintFilter(stderr, "INFO", _("Starting page %d."), page);
+
+   /*
+    * The filter does the copies itself (cupsManualCopies is False), so
+    * keep the finished page and send it again for each extra copy...
+    */
+
+    if (copies > 1)
+      tmcOutputCaptureStart();
+
+    StartPage(ppd, &header);
+
+    for (y = 0, progress = 0; y < header.cupsHeight; y += lines)
+    {
+     /*
+      * Let the user know how far we have progressed...
+      */
+
+      if (Canceled)
 	break;
-  }
 
- /*
-  * Dither the pixels...
-  */
+      if (y >= progress)
+      {
+        _cupsLangPrintFilter(stderr, "INFO",
+	                     _("Printing page %d, %d%% complete."),
+			     page, 100 * y / header.cupsHeight);
+        fprintf(stderr, "ATTR: job-media-progress=%d\n",
+		100 * y / header.cupsHeight);
 
-  unsigned int base = (DotRowCount & 1) * DotRowMax / 2;
-  unsigned int index = DotRowCount / 2;
-  for (plane = 0; plane < PrinterPlanes; plane ++)
-  {
-    cupsDitherLine(DitherStates[plane], DitherLuts[plane], InputBuffer + plane,
-                   PrinterPlanes, &OutputBuffers[plane][(base + index) * header->cupsWidth]);
+        progress = (y | 127) + 1;
+      }
+
+     /*
+      * Read and write lines of graphics or whitespace, up to the end of
+      * the current band...
+      */
+
+      if ((lines = ProcessLines(ppd, ras, &header,
+                                header.cupsHeight - y)) == 0)
+        break;
+    }
+
+   /*
+    * Eject the page...
+    */
+
+    _cupsLangPrintFilter(stderr, "INFO", _("Finished page %d."), page);
+
+    EndPage(ppd, &header);
+
+    if (copies > 1)
+      ReplayPage(&header, copies);
+
+    tmcStatsEndPage(stderr, page);
+
+    if (Canceled)
+      break;
   }
 
-  DotRowCount++;
+  StopPipeline();
+
+  tmcStatsReport(stderr);
+
+  Shutdown(ppd);
+
+  tmcRasterClose(ras);
 
-  if (DotRowCount == DotRowMax)
+  if (page == 0)
   {
-    EmitDotRows(ppd, header);
+    _cupsLangPrintFilter(stderr, "ERROR", _("No pages were found."));
+    return (1);
+  }
+  else
+  {
+    _cupsLangPrintFilter(stderr, "INFO", _("Ready to print."));
+    return (0);
   }
-
 }
 
 
@@ -797,13 +2864,11 @@ main(int  argc,				/* I - Number of command-line arguments */
      char *argv[])			/* I - Command-line arguments */
 {
   int			fd;		/* File descriptor */
-  cups_raster_t		*ras;		/* Raster stream for printing */
-  cups_page_header2_t	header;		/* Page header from file */
-  int			page;		/* Current page */
-  int			y;		/* Current line */
   ppd_file_t		*ppd;		/* PPD file */
   int			num_options;	/* Number of options */
   cups_option_t		*options;	/* Options */
+  int			status,		/* Exit status */
+			idle;		/* Seconds a daemon waits for jobs */
 #if defined(HAVE_SIGACTION) && !defined(HAVE_SIGSET)
   struct sigaction action;		/* Actions for POSIX signals */
 #endif /* HAVE_SIGACTION && !HAVE_SIGSET */
@@ -827,8 +2892,19 @@ main(int  argc,				/* I - Number of command-line arguments */
     return (1);
   }
 
+ /*
+  * A daemon left by an earlier job (TMCDaemon) prints the job with the PPD
+  * file and page data it already has loaded...
+  */
+
+  if ((status = SubmitJob(argc, argv)) >= 0)
+    return (status);
+
   num_options = cupsParseOptions(argv[5], 0, &options);
 
+  NumOptions = num_options;
+  Options    = options;
+
  /*
   * Open the PPD file...
   */
@@ -868,8 +2944,6 @@ main(int  argc,				/* I - Number of command-line arguments */
   else
     fd = 0;
 
-  ras = cupsRasterOpen(fd, CUPS_RASTER_READ);
-
  /*
   * Register a signal handler to eject the current page if the
   * job is cancelled.
@@ -889,90 +2963,21 @@ main(int  argc,				/* I - Number of command-line arguments */
   signal(SIGTERM, CancelJob);
 #endif /* HAVE_SIGSET */
 
- /*
-  * Initialize the print device...
-  */
+  status = PrintJob(ppd, fd);
 
-  Setup(ppd);
+  if (fd != 0)
+    close(fd);
 
  /*
-  * Process pages as needed...
+  * Leave a daemon to print the next jobs for this queue...
   */
 
-  page = 0;
-
-  while (cupsRasterReadHeader2(ras, &header))
-  {
-   /*
-    * Write a status message with the page number and number of copies.
-    */
-
-    if (Canceled)
-      break;
-
-    page ++;
-
-    fprintf(stderr, "PAGE: %d 1\n", page);
-    _cupsLangPrintFilter(stderr, "INFO", _("Starting page %d."), page);
-
-    StartPage(ppd, &header);
-
-    for (y = 0; y < header.cupsHeight; y ++)
-    {
-     /*
-      * Let the user know how far we have progressed...
-      */
-
-      if (Canceled)
-	break;
-
-      if ((y & 127) == 0)
-      {
-        _cupsLangPrintFilter(stderr, "INFO",
-	                     _("Printing page %d, %d%% complete."),
-			     page, 100 * y / header.cupsHeight);
-        fprintf(stderr, "ATTR: job-media-progress=%d\n",
-		100 * y / header.cupsHeight);
-      }
-
-     /*
-      * Read and write a line of graphics or whitespace...
-      */
-
-      ProcessLine(ppd, ras, &header, y);
-    }
-
-   /*
-    * Eject the page...
-    */
-
-    _cupsLangPrintFilter(stderr, "INFO", _("Finished page %d."), page);
-
-    EndPage(ppd, &header);
-
-    if (Canceled)
-      break;
-  }
-
-  Shutdown(ppd);
+  if (status == 0 && (idle = GetIntOption(ppd, "TMCDaemon", 0)) > 0)
+    StartDaemon(ppd, idle);
 
   cupsFreeOptions(num_options, options);
 
-  cupsRasterClose(ras);
-
-  if (fd != 0)
-    close(fd);
-
-  if (page == 0)
-  {
-    _cupsLangPrintFilter(stderr, "ERROR", _("No pages were found."));
-    return (1);
-  }
-  else
-  {
-    _cupsLangPrintFilter(stderr, "INFO", _("Ready to print."));
-    return (0);
-  }
+  return (status);
 }
 
 
@@ -0,0 +1,225 @@
+/*
+ * Stage timing and throughput counters for the TM-C6xx filter.
+ *
+ * Setting TMC6XX_STATS in the environment or the cupsTMCStats option makes
+ * the filter time each stage and count the bytes in and out of it.  Each
+ * page gets a summary in the job log, and the totals are reported as one
+ * JSON record when the job ends, for the benchmark harness.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Globals...
+ */
+
+int		tmcStatsEnabled = 0;	/* Collect stage times and counters? */
+tmc_stats_t	tmcStatsPage;		/* Current page */
+
+
+/*
+ * Local globals...
+ */
+
+static tmc_stats_t	job_stats;	/* Totals for the job */
+static int		job_pages = 0;	/* Pages in job */
+static uint64_t		job_start = 0,	/* Start of job */
+			page_start = 0;	/* Start of current page */
+static const char * const stage_names[TMC_STAGE_MAX] =
+{					/* Stage names */
+  "read",
+  "separate",
+  "dither",
+  "fused",
+  "pack",
+  "compress",
+  "write"
+};
+static const char * const count_names[TMC_COUNT_MAX] =
+{					/* Counter names */
+  "bytes_in",
+  "bytes_out",
+  "blank_lines",
+  "blank_planes",
+  "compress_skipped"
+};
+
+
+/*
+ * Local functions...
+ */
+
+static double	ratio(uint64_t raw, uint64_t compressed);
+static void	write_json(FILE *fp, const char *prefix, const tmc_stats_t *s,
+		           uint64_t elapsed);
+
+
+/*
+ * 'tmcStatsEndPage()' - Report the current page and add it to the job.
+ */
+
+void
+tmcStatsEndPage(FILE *fp,		/* I - Output file */
+                int  page)		/* I - Page number */
+{
+  int		i;			/* Looping var */
+  uint64_t	now,			/* Current time */
+		raw = 0,		/* Packed bytes */
+		compressed = 0;		/* Compressed bytes */
+  char		prefix[64];		/* Page number for JSON */
+
+
+  if (!tmcStatsEnabled)
+    return;
+
+  now = tmcStatsStart();
+
+  for (i = 0; i < TMC_STATS_PLANES; i ++)
+  {
+    raw        += tmcStatsPage.raw[i];
+    compressed += tmcStatsPage.compressed[i];
+  }
+
+  fprintf(fp,
+          "DEBUG: Page %d stats = %.3fs, %llu bytes in, %llu bytes out, "
+	  "%.2f compression, %llu blank lines, %llu blank plane bands\n",
+	  page, (now - page_start) / 1e9,
+	  (unsigned long long)tmcStatsPage.counts[TMC_COUNT_BYTES_IN],
+	  (unsigned long long)tmcStatsPage.counts[TMC_COUNT_BYTES_OUT],
+	  ratio(raw, compressed),
+	  (unsigned long long)tmcStatsPage.counts[TMC_COUNT_BLANK_LINES],
+	  (unsigned long long)tmcStatsPage.counts[TMC_COUNT_BLANK_PLANES]);
+
+  snprintf(prefix, sizeof(prefix), "\"page\":%d,", page);
+
+  fputs("ATTR: tmc6xx-page-stats='", fp);
+  write_json(fp, prefix, &tmcStatsPage, now - page_start);
+  fputs("'\n", fp);
+
+ /*
+  * Add the page to the job totals...
+  */
+
+  for (i = 0; i < TMC_STAGE_MAX; i ++)
+    job_stats.times[i] += tmcStatsPage.times[i];
+
+  for (i = 0; i < TMC_COUNT_MAX; i ++)
+    job_stats.counts[i] += tmcStatsPage.counts[i];
+
+  for (i = 0; i < TMC_STATS_PLANES; i ++)
+  {
+    job_stats.raw[i]        += tmcStatsPage.raw[i];
+    job_stats.compressed[i] += tmcStatsPage.compressed[i];
+  }
+
+  job_pages ++;
+
+  memset(&tmcStatsPage, 0, sizeof(tmcStatsPage));
+  page_start = now;
+}
+
+
+/*
+ * 'tmcStatsInit()' - Turn stage timing on if requested.
+ *
+ * The TMC6XX_STATS environment variable turns timing on for any job;
+ * otherwise the "enabled" argument (from cupsTMCStats) decides.
+ */
+
+void
+tmcStatsInit(int enabled)		/* I - Collect stats for this job? */
+{
+  const char	*value;			/* Environment value */
+
+
+  if ((value = getenv("TMC6XX_STATS")) != NULL && *value)
+    enabled = strcmp(value, "0") != 0;
+
+  tmcStatsEnabled = enabled;
+
+  memset(&tmcStatsPage, 0, sizeof(tmcStatsPage));
+  memset(&job_stats, 0, sizeof(job_stats));
+  job_pages  = 0;
+  job_start  = tmcStatsStart();
+  page_start = job_start;
+}
+
+
+/*
+ * 'tmcStatsReport()' - Report the job totals as a JSON record.
+ */
+
+void
+tmcStatsReport(FILE *fp)		/* I - Output file */
+{
+  char	prefix[64];			/* Page count for JSON */
+
+
+  if (!tmcStatsEnabled)
+    return;
+
+  snprintf(prefix, sizeof(prefix), "\"pages\":%d,", job_pages);
+
+  fputs("DEBUG: tmc6xx-stats ", fp);
+  write_json(fp, prefix, &job_stats, tmcStatsStart() - job_start);
+  putc('\n', fp);
+}
+
+
+/*
+ * 'ratio()' - Return a compression ratio.
+ */
+
+static double				/* O - Packed bytes per compressed byte */
+ratio(uint64_t raw,			/* I - Packed bytes */
+      uint64_t compressed)		/* I - Compressed bytes */
+{
+  return (compressed ? (double)raw / compressed : 0.0);
+}
+
+
+/*
+ * 'write_json()' - Write times and counters as a JSON object.
+ */
+
+static void
+write_json(FILE              *fp,	/* I - Output file */
+           const char        *prefix,	/* I - Leading members */
+           const tmc_stats_t *s,	/* I - Times and counters */
+	   uint64_t          elapsed)	/* I - Elapsed nanoseconds */
+{
+  int	i;				/* Looping var */
+
+
+  fprintf(fp, "{%s\"seconds\":%.6f", prefix, elapsed / 1e9);
+
+  for (i = 0; i < TMC_COUNT_MAX; i ++)
+    fprintf(fp, ",\"%s\":%llu", count_names[i],
+            (unsigned long long)s->counts[i]);
+
+  fputs(",\"stages\":{", fp);
+
+  for (i = 0; i < TMC_STAGE_MAX; i ++)
+    fprintf(fp, "%s\"%s\":%.6f", i ? "," : "", stage_names[i],
+            s->times[i] / 1e9);
+
+  fputs("},\"planes\":[", fp);
+
+  for (i = 0; i < TMC_STATS_PLANES && (s->raw[i] || i < 3); i ++)
+    fprintf(fp, "%s{\"raw\":%llu,\"compressed\":%llu,\"ratio\":%.3f}",
+            i ? "," : "", (unsigned long long)s->raw[i],
+	    (unsigned long long)s->compressed[i],
+	    ratio(s->raw[i], s->compressed[i]));
+
+  fputs("]}", fp);
+}
@@ -0,0 +1,161 @@
+/*
+ * Stage timing and throughput counters for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_STATS_H_
+#  define _TMC6XX_STATS_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stdio.h>
+#  include <stdint.h>
+#  include <time.h>
+
+
+/*
+ * Constants...
+ */
+
+#  define TMC_STATS_PLANES	7	/* Most planes counted */
+
+
+/*
+ * Stages...
+ */
+
+enum
+{
+  TMC_STAGE_READ,			/* cupsRasterReadPixels() */
+  TMC_STAGE_SEPARATE,			/* SeparateLine() */
+  TMC_STAGE_DITHER,			/* cupsDitherLine()/tmcDitherLine() */
+  TMC_STAGE_FUSED,			/* tmcDitherRGB() */
+  TMC_STAGE_PACK,			/* tmcPackLines2() */
+  TMC_STAGE_COMPRESS,			/* CompressData() */
+  TMC_STAGE_WRITE,			/* tmcOutputFlush() */
+  TMC_STAGE_MAX
+};
+
+
+/*
+ * Counters...
+ */
+
+enum
+{
+  TMC_COUNT_BYTES_IN,			/* Raster bytes read */
+  TMC_COUNT_BYTES_OUT,			/* Bytes sent to the printer */
+  TMC_COUNT_BLANK_LINES,		/* Raster lines not separated */
+  TMC_COUNT_BLANK_PLANES,		/* Plane bands not compressed or sent */
+  TMC_COUNT_COMPRESS_SKIPPED,		/* Passes sent raw without PackBits */
+  TMC_COUNT_MAX
+};
+
+
+/*
+ * Types...
+ */
+
+typedef struct tmc_stats_s		/**** Times and counters ****/
+{
+  uint64_t	times[TMC_STAGE_MAX];	/* Nanoseconds in each stage */
+  uint64_t	counts[TMC_COUNT_MAX];	/* Counters */
+  uint64_t	raw[TMC_STATS_PLANES],	/* Packed bytes for each plane */
+		compressed[TMC_STATS_PLANES];
+					/* Compressed bytes for each plane */
+} tmc_stats_t;
+
+
+/*
+ * Globals...
+ */
+
+extern int		tmcStatsEnabled;/* Collect stage times and counters? */
+extern tmc_stats_t	tmcStatsPage;	/* Current page */
+
+
+/*
+ * Prototypes...
+ */
+
+extern void	tmcStatsEndPage(FILE *fp, int page);
+extern void	tmcStatsInit(int enabled);
+extern void	tmcStatsReport(FILE *fp);
+
+
+/*
+ * 'tmcStatsStart()' - Start timing a stage.
+ */
+
+static inline uint64_t			/* O - Start time or 0 */
+tmcStatsStart(void)
+{
+  struct timespec	ts;		/* Current time */
+
+
+  if (!tmcStatsEnabled)
+    return (0);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+
+/*
+ * 'tmcStatsStop()' - Add the time since tmcStatsStart() to a stage.
+ *
+ * Stages can run on several threads at once, so the times add up the time
+ * spent by every thread.
+ */
+
+static inline void
+tmcStatsStop(int      stage,		/* I - Stage */
+             uint64_t start)		/* I - Start time */
+{
+  if (!tmcStatsEnabled)
+    return;
+
+  __atomic_fetch_add(tmcStatsPage.times + stage, tmcStatsStart() - start,
+                     __ATOMIC_RELAXED);
+}
+
+
+/*
+ * 'tmcStatsCount()' - Add to a counter.
+ */
+
+static inline void
+tmcStatsCount(int      counter,		/* I - Counter */
+              uint64_t value)		/* I - Value to add */
+{
+  if (!tmcStatsEnabled)
+    return;
+
+  __atomic_fetch_add(tmcStatsPage.counts + counter, value, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * 'tmcStatsPlane()' - Add the bytes before and after compression for a
+ *                     plane.
+ */
+
+static inline void
+tmcStatsPlane(int      plane,		/* I - Color plane */
+              uint64_t raw,		/* I - Packed bytes */
+	      uint64_t compressed)	/* I - Compressed bytes */
+{
+  if (!tmcStatsEnabled || plane >= TMC_STATS_PLANES)
+    return;
+
+  __atomic_fetch_add(tmcStatsPage.raw + plane, raw, __ATOMIC_RELAXED);
+  __atomic_fetch_add(tmcStatsPage.compressed + plane, compressed,
+                     __ATOMIC_RELAXED);
+}
+
+#endif /* !_TMC6XX_STATS_H_ */
@@ -35,6 +35,11 @@ import datetime
 
 from PIL import Image
 
+try:
+    import tmc6xx   # native renderer, built with "make python"
+except ImportError:
+    tmc6xx = None
+
 DPI_X = 360
 DPI_Y = 180
 
@@ -86,6 +91,14 @@ class EpsonTMC600(object):
 
         self.image = image.convert(mode="RGB").resize(new_size)
 
+        if tmc6xx is not None:
+            self.job = tmc6xx.Job(self.fd)
+            self.job.start_page(new_size[0], new_size[1],
+                                top=int(self.mm2in(BED_Y_MARGIN_TOP) * DPI_Y),
+                                bottom=int(self.mm2in(BED_Y_MARGIN_BOTTOM) * DPI_Y),
+                                cut=auto_cutter)
+            return
+
         # Do any start-of-day initialization here
         self.send("Leave packet mode", b'\000\000\000')
         self.send_esc(b'\001', b'@EJL 1284.4\n@EJL     \n')
@@ -243,6 +256,11 @@ class EpsonTMC600(object):
     def render(self):
         h_dots, v_dots = self.image.size
 
+        if tmc6xx is not None:
+            self.job.write_band(self.image.tobytes(), v_dots)
+            self.job.end_page()
+            return
+
         dotplanes = self._fsdither(self.image)
 
         # Got to the top margin
@@ -270,6 +288,10 @@ class EpsonTMC600(object):
         pass
 
     def finish(self):
+        if tmc6xx is not None:
+            self.job.close()
+            return
+
         self.send_esc(b'@')
         self.send_esc(b'@')
         self.send_escp(b'R', b'\000' + b'REMOTE1')
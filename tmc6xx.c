@@ -0,0 +1,490 @@
+/*
+ * Streaming ESC/P-R rendering API for the TM-C6xx (libtmc6xx).
+ *
+ * This drives the same code as the CUPS filter - the default CMY
+ * separation and dither tables from libcupsfilters, tmcDitherRGB(), the
+ * PackBits encoders, the adaptive compression policy and the job, page and
+ * graphics commands in output.c - for programs that have pixels rather
+ * than a CUPS raster stream:
+ *
+ *   job = tmcJobNew(write_cb, ctx);
+ *   tmcJobStartPage(job, width, height, top, bottom, cut);
+ *   tmcJobWriteBand(job, TMC_FORMAT_RGB, pixels, stride, lines);
+ *   ...
+ *   tmcJobEndPage(job);
+ *   tmcJobEnd(job);
+ *   tmcJobDelete(job);
+ *
+ * Pages are 360x180 dpi with 2-bit dots, as the filter prints with
+ * TMCDither=native; for the same pixels the dots are identical.  The output
+ * buffer in output.c is shared by the whole process, so only one job can
+ * be open at a time.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "tmc6xx.h"
+#include "adapt.h"
+#include "dither.h"
+#include "output.h"
+#include "packbits.h"
+#include <cupsfilters/driver.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants...
+ */
+
+#define JOB_XDPI	360		/* Horizontal resolution */
+#define JOB_YDPI	180		/* Vertical resolution */
+#define JOB_BAND	180		/* Lines per band */
+#define JOB_PLANES	3		/* C, M and Y */
+
+
+/*
+ * Types...
+ */
+
+struct tmc_job_s			/**** Print job ****/
+{
+  int		started,		/* Has the job been started? */
+		in_page;		/* Is a page open? */
+  unsigned	width,			/* Width of page in pixels */
+		bytes,			/* Bytes per packed line */
+		rows,			/* Lines in current band */
+		blank_rows,		/* Blank lines in current band */
+		feed;			/* Lines to feed before next graphics */
+  short		sep[JOB_PLANES][256];	/* Separation of each RGB component */
+  cups_lut_t	*luts[JOB_PLANES];	/* Dither lookup tables */
+  tmc_dither_t	*dither[JOB_PLANES];	/* Error diffusion states */
+  tmc_adapt_t	adapt[JOB_PLANES];	/* Compression policy per plane */
+  unsigned char	*dots,			/* Packed dots of band, per plane */
+		*comp,			/* Compression buffers, per pass */
+		*line;			/* RGB line for CMY input */
+};
+
+
+/*
+ * Local globals...
+ */
+
+static int	job_open = 0;		/* Is a job using the output? */
+
+
+/*
+ * Local functions...
+ */
+
+static void	emit_band(tmc_job_t *job);
+static void	free_page(tmc_job_t *job);
+static int	load_separation(tmc_job_t *job);
+
+
+/*
+ * 'tmcJobDelete()' - Free a job.
+ *
+ * A job that was not ended is dropped without resetting the printer.
+ */
+
+void
+tmcJobDelete(tmc_job_t *job)		/* I - Job */
+{
+  int	plane;				/* Current plane */
+
+
+  if (!job)
+    return;
+
+  free_page(job);
+
+  for (plane = 0; plane < JOB_PLANES; plane ++)
+    cupsLutDelete(job->luts[plane]);
+
+  free(job);
+
+  job_open = 0;
+}
+
+
+/*
+ * 'tmcJobEnd()' - End a job, resetting the printer.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcJobEnd(tmc_job_t *job)		/* I - Job */
+{
+  if (job->in_page && tmcJobEndPage(job))
+    return (-1);
+
+  if (!job->started)
+    tmcOutputJobStart();
+
+  tmcOutputJobEnd();
+
+  job->started = 0;
+
+  return (tmcOutputFlush());
+}
+
+
+/*
+ * 'tmcJobEndPage()' - Send the rest of a page and eject it.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcJobEndPage(tmc_job_t *job)		/* I - Job */
+{
+  if (!job->in_page)
+    return (-1);
+
+  emit_band(job);
+
+  tmcOutputByte(12);
+
+  job->in_page = 0;
+
+  return (tmcOutputFlush());
+}
+
+
+/*
+ * 'tmcJobNew()' - Create a job that writes to a callback.
+ */
+
+tmc_job_t *				/* O - Job or NULL */
+tmcJobNew(tmc_job_cb_t cb,		/* I - Write callback */
+          void         *ctx)		/* I - Callback data */
+{
+  tmc_job_t	*job;			/* New job */
+  int		plane;			/* Current plane */
+  static const float default_lut[] =	/* Default dithering lookup table */
+		{
+		  0.0,
+		  0.25,
+		  0.5,
+		  0.75,
+		};
+
+
+  if (job_open || !cb)
+    return (NULL);
+
+  if ((job = calloc(1, sizeof(tmc_job_t))) == NULL)
+    return (NULL);
+
+  for (plane = 0; plane < JOB_PLANES; plane ++)
+    if ((job->luts[plane] = cupsLutNew(sizeof(default_lut) /
+                                       sizeof(default_lut[0]),
+				       default_lut)) == NULL)
+    {
+      tmcJobDelete(job);
+      return (NULL);
+    }
+
+  if (!load_separation(job))
+  {
+    tmcJobDelete(job);
+    return (NULL);
+  }
+
+  tmcPackBitsInit();
+  tmcOutputInitCB(cb, ctx);
+
+  job_open = 1;
+
+  return (job);
+}
+
+
+/*
+ * 'tmcJobStartPage()' - Start a page.
+ *
+ * "height" is the number of lines that will be written and "top" and
+ * "bottom" the margins around them, all at 180 dpi.  "cut" turns the auto
+ * cutter on or off for the page.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcJobStartPage(tmc_job_t *job,		/* I - Job */
+                unsigned  width,	/* I - Width in pixels (360 dpi) */
+		unsigned  height,	/* I - Height in lines */
+		unsigned  top,		/* I - Top margin in lines */
+		unsigned  bottom,	/* I - Bottom margin in lines */
+		int       cut)		/* I - Cut the page? */
+{
+  int	plane;				/* Current plane */
+
+
+  if (job->in_page || width == 0)
+    return (-1);
+
+  if (width != job->width)
+  {
+   /*
+    * (Re)allocate the page buffers...
+    */
+
+    free_page(job);
+
+    job->width = width;
+    job->bytes = (width * 2 + 7) / 8;
+
+    for (plane = 0; plane < JOB_PLANES; plane ++)
+      if ((job->dither[plane] = tmcDitherNew(width)) == NULL)
+        break;
+
+    if (plane < JOB_PLANES ||
+        (job->dots = malloc(JOB_PLANES * JOB_BAND * job->bytes)) == NULL ||
+        (job->comp = malloc(2 * JOB_PLANES * JOB_BAND * job->bytes)) == NULL ||
+        (job->line = malloc(3 * width)) == NULL)
+    {
+      free_page(job);
+      return (-1);
+    }
+  }
+
+  for (plane = 0; plane < JOB_PLANES; plane ++)
+  {
+    tmcDitherReset(job->dither[plane]);
+    tmcAdaptReset(job->adapt + plane);
+  }
+
+  if (!job->started)
+  {
+    tmcOutputJobStart();
+    job->started = 1;
+  }
+
+  tmcOutputPageStart(cut ? 1 : 0, 1, JOB_XDPI, JOB_YDPI,
+                     top + height + bottom, top);
+
+  job->rows       = 0;
+  job->blank_rows = 0;
+  job->feed       = 0;
+  job->in_page    = 1;
+
+  return (0);
+}
+
+
+/*
+ * 'tmcJobWriteBand()' - Separate, dither and send lines of a page.
+ *
+ * Any number of lines can be written at a time; they are sent to the
+ * printer a band at a time.
+ */
+
+int					/* O - 0 on success, -1 on error */
+tmcJobWriteBand(
+    tmc_job_t           *job,		/* I - Job */
+    int                 format,		/* I - TMC_FORMAT_RGB or TMC_FORMAT_CMY */
+    const unsigned char *pixels,	/* I - Lines of pixels */
+    size_t              stride,		/* I - Bytes from one line to the next */
+    unsigned            lines)		/* I - Number of lines */
+{
+  unsigned		i,		/* Looping var */
+			plane;		/* Current plane */
+  const unsigned char	*rgb;		/* RGB line */
+  unsigned char		*dots[JOB_PLANES];
+					/* Packed lines */
+
+
+  if (!job->in_page || (format != TMC_FORMAT_RGB && format != TMC_FORMAT_CMY))
+    return (-1);
+
+  for (; lines > 0; lines --, pixels += stride)
+  {
+    if (format == TMC_FORMAT_CMY)
+    {
+      for (i = 0; i < 3 * job->width; i ++)
+        job->line[i] = 255 - pixels[i];
+
+      rgb = job->line;
+    }
+    else
+      rgb = pixels;
+
+    for (plane = 0; plane < JOB_PLANES; plane ++)
+      dots[plane] = job->dots + plane * JOB_BAND * job->bytes +
+                    ((job->rows & 1) * JOB_BAND / 2 + job->rows / 2) *
+		    job->bytes;
+
+   /*
+    * White lines skip the dither, like the filter's blank lines...
+    */
+
+    if (cupsCheckValue(rgb, 3 * job->width, 255))
+    {
+      for (plane = 0; plane < JOB_PLANES; plane ++)
+      {
+        tmcDitherSkip(job->dither[plane], 1);
+        memset(dots[plane], 0, job->bytes);
+      }
+
+      job->blank_rows ++;
+    }
+    else
+      tmcDitherRGB(job->dither, job->luts, job->sep, rgb, dots);
+
+    if (++ job->rows == JOB_BAND)
+    {
+      emit_band(job);
+
+      if (tmcOutputFlush())
+        return (-1);
+    }
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'emit_band()' - Compress and queue the current band.
+ *
+ * This follows EmitDotRows() and PackPlane() in the filter; the band must
+ * be flushed before the buffers are reused.
+ */
+
+static void
+emit_band(tmc_job_t *job)		/* I - Job */
+{
+  unsigned		plane,		/* Current plane */
+			microweave,	/* Current pass */
+			rows = job->rows / 2,
+					/* Lines per pass */
+			length = rows * job->bytes;
+					/* Bytes per pass */
+  const unsigned char	*dots[2];	/* Dots of each pass */
+  const unsigned char	*data;		/* Data to send */
+  unsigned char		*comp;		/* Compression buffer for pass */
+  int			count,		/* Bytes to send */
+			decision;	/* Compression policy decision */
+
+
+  if (!job->rows)
+    return;
+
+  if (job->blank_rows == job->rows)
+    rows = 0;
+
+  for (plane = 0; plane < JOB_PLANES && rows > 0; plane ++)
+  {
+    dots[0] = job->dots + plane * JOB_BAND * job->bytes;
+    dots[1] = dots[0] + JOB_BAND / 2 * job->bytes;
+
+    if (cupsCheckBytes(dots[0], length) && cupsCheckBytes(dots[1], length))
+      continue;
+
+    for (microweave = 0; microweave < 2; microweave ++)
+    {
+      if (job->feed > 0)
+      {
+        tmcOutputFeed(job->feed);
+	job->feed = 0;
+      }
+
+      comp     = job->comp + (2 * plane + microweave) * JOB_BAND * job->bytes;
+      decision = tmcAdaptDecide(job->adapt + plane, dots[microweave], length);
+
+      if (decision != TMC_ADAPT_RAW &&
+          (count = tmcPackBits(dots[microweave], length, comp)) <
+	      (int)length)
+	data = comp;
+      else
+      {
+        data  = dots[microweave];
+	count = length;
+      }
+
+      tmcAdaptResult(job->adapt + plane, decision, data == comp);
+
+     /*
+      * The passes are queued by reference until the caller flushes the
+      * band...
+      */
+
+      tmcOutputPass(tmcOutputColor(JOB_PLANES, plane), microweave,
+                    data == comp, 2, job->bytes, rows, data, count);
+    }
+  }
+
+  job->feed       += job->rows;
+  job->rows       = 0;
+  job->blank_rows = 0;
+}
+
+
+/*
+ * 'free_page()' - Free the page buffers.
+ */
+
+static void
+free_page(tmc_job_t *job)		/* I - Job */
+{
+  int	plane;				/* Current plane */
+
+
+  for (plane = 0; plane < JOB_PLANES; plane ++)
+  {
+    tmcDitherDelete(job->dither[plane]);
+    job->dither[plane] = NULL;
+  }
+
+  free(job->dots);
+  free(job->comp);
+  free(job->line);
+
+  job->dots  = NULL;
+  job->comp  = NULL;
+  job->line  = NULL;
+  job->width = 0;
+}
+
+
+/*
+ * 'load_separation()' - Build the separation tables from the default CMY
+ *                       separation.
+ *
+ * The default separation treats the components independently, so a ramp
+ * of each component gives the whole table (see ProbeSeparation() in the
+ * filter).
+ */
+
+static int				/* O - 1 on success, 0 on error */
+load_separation(tmc_job_t *job)		/* I - Job */
+{
+  cups_cmyk_t	*cmyk;			/* Default CMY separation */
+  unsigned char	colors[3 * 256];	/* Ramp of one component */
+  short		input[3 * 256];		/* Separated ramp */
+  int		i,			/* Looping var */
+		plane;			/* Current plane */
+
+
+  if ((cmyk = cupsCMYKNew(JOB_PLANES)) == NULL)
+    return (0);
+
+  for (plane = 0; plane < JOB_PLANES; plane ++)
+  {
+    memset(colors, 255, sizeof(colors));
+
+    for (i = 0; i < 256; i ++)
+      colors[3 * i + plane] = i;
+
+    cupsCMYKDoRGB(cmyk, colors, input, 256);
+
+    for (i = 0; i < 256; i ++)
+      job->sep[plane][i] = input[3 * i + plane];
+  }
+
+  cupsCMYKDelete(cmyk);
+
+  return (1);
+}
@@ -0,0 +1,54 @@
+/*
+ * Streaming ESC/P-R rendering API for the TM-C6xx (libtmc6xx).
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_TMC6XX_H_
+#  define _TMC6XX_TMC6XX_H_
+
+/*
+ * Include necessary headers...
+ */
+
+#  include <stddef.h>
+
+
+/*
+ * Pixel formats for tmcJobWriteBand()...
+ */
+
+enum
+{
+  TMC_FORMAT_RGB,			/* 8-bit RGB, 255 is white */
+  TMC_FORMAT_CMY			/* 8-bit CMY, 0 is no ink */
+};
+
+
+/*
+ * Types...
+ */
+
+typedef int (*tmc_job_cb_t)(void *ctx, const void *data, size_t length);
+					/**** Write callback, 0 on success ****/
+
+typedef struct tmc_job_s tmc_job_t;	/**** Print job ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern void		tmcJobDelete(tmc_job_t *job);
+extern int		tmcJobEnd(tmc_job_t *job);
+extern int		tmcJobEndPage(tmc_job_t *job);
+extern tmc_job_t	*tmcJobNew(tmc_job_cb_t cb, void *ctx);
+extern int		tmcJobStartPage(tmc_job_t *job, unsigned width,
+			                unsigned height, unsigned top,
+					unsigned bottom, int cut);
+extern int		tmcJobWriteBand(tmc_job_t *job, int format,
+			                const unsigned char *pixels,
+					size_t stride, unsigned lines);
+
+#endif /* !_TMC6XX_TMC6XX_H_ */
@@ -0,0 +1,368 @@
+/*
+ * CPython bindings for libtmc6xx.
+ *
+ *   import tmc6xx
+ *
+ *   job = tmc6xx.Job(fileobj)
+ *   job.start_page(width, height, top=0, bottom=0, cut=False)
+ *   job.write_band(pixels, lines, format=tmc6xx.RGB)
+ *   job.end_page()
+ *   job.close()
+ *
+ * "pixels" is any bytes-like object holding "lines" lines of width * 3
+ * bytes, such as PIL's Image.tobytes() for an RGB image.  The printer data
+ * goes to fileobj.write() as each band is finished, so write_band() keeps
+ * the GIL.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include "tmc6xx.h"
+
+
+/*
+ * Types...
+ */
+
+typedef struct job_object_s		/**** tmc6xx.Job object ****/
+{
+  PyObject_HEAD
+  tmc_job_t	*job;			/* Print job */
+  PyObject	*file;			/* Output file object */
+  int		error;			/* Did a write raise an exception? */
+} job_object_t;
+
+
+/*
+ * Local functions...
+ */
+
+static int	job_check(job_object_t *self, int status);
+static PyObject	*job_close(job_object_t *self, PyObject *args);
+static void	job_dealloc(job_object_t *self);
+static PyObject	*job_end_page(job_object_t *self, PyObject *args);
+static int	job_init(job_object_t *self, PyObject *args, PyObject *kwds);
+static PyObject	*job_start_page(job_object_t *self, PyObject *args,
+		                PyObject *kwds);
+static PyObject	*job_write_band(job_object_t *self, PyObject *args,
+		                PyObject *kwds);
+static int	job_write_cb(void *ctx, const void *data, size_t length);
+
+
+/*
+ * Local globals...
+ */
+
+static PyMethodDef job_methods[] =	/* tmc6xx.Job methods */
+{
+  { "start_page", (PyCFunction)job_start_page, METH_VARARGS | METH_KEYWORDS,
+    "start_page(width, height, top=0, bottom=0, cut=False)\n\n"
+    "Start a page of width x height pixels at 360x180 dpi, with top and\n"
+    "bottom margins in lines." },
+  { "write_band", (PyCFunction)job_write_band, METH_VARARGS | METH_KEYWORDS,
+    "write_band(pixels, lines, format=RGB)\n\n"
+    "Dither and send lines of 8-bit RGB or CMY pixels." },
+  { "end_page", (PyCFunction)job_end_page, METH_NOARGS,
+    "end_page()\n\nSend the rest of the page and eject it." },
+  { "close", (PyCFunction)job_close, METH_NOARGS,
+    "close()\n\nEnd the job and reset the printer." },
+  { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject job_type =		/* tmc6xx.Job type */
+{
+  PyVarObject_HEAD_INIT(NULL, 0)
+  .tp_name      = "tmc6xx.Job",
+  .tp_doc       = "Job(file)\n\nAn EPSON TM-C6xx print job writing to file.",
+  .tp_basicsize = sizeof(job_object_t),
+  .tp_flags     = Py_TPFLAGS_DEFAULT,
+  .tp_new       = PyType_GenericNew,
+  .tp_init      = (initproc)job_init,
+  .tp_dealloc   = (destructor)job_dealloc,
+  .tp_methods   = job_methods,
+};
+
+static struct PyModuleDef tmc6xx_module =
+{					/* tmc6xx module */
+  PyModuleDef_HEAD_INIT,
+  .m_name = "tmc6xx",
+  .m_doc  = "Native ESC/P-R rendering for the EPSON TM-C6xx label printers.",
+  .m_size = -1,
+};
+
+
+/*
+ * 'PyInit_tmc6xx()' - Initialize the module.
+ */
+
+PyMODINIT_FUNC				/* O - Module */
+PyInit_tmc6xx(void)
+{
+  PyObject	*module;		/* Module */
+
+
+  if (PyType_Ready(&job_type) < 0)
+    return (NULL);
+
+  if ((module = PyModule_Create(&tmc6xx_module)) == NULL)
+    return (NULL);
+
+  Py_INCREF(&job_type);
+
+  if (PyModule_AddObject(module, "Job", (PyObject *)&job_type) < 0 ||
+      PyModule_AddIntConstant(module, "RGB", TMC_FORMAT_RGB) < 0 ||
+      PyModule_AddIntConstant(module, "CMY", TMC_FORMAT_CMY) < 0)
+  {
+    Py_DECREF(&job_type);
+    Py_DECREF(module);
+    return (NULL);
+  }
+
+  return (module);
+}
+
+
+/*
+ * 'job_check()' - Turn a libtmc6xx status into a Python exception.
+ */
+
+static int				/* O - 0 on success, -1 with exception */
+job_check(job_object_t *self,		/* I - Job object */
+          int          status)		/* I - Status from libtmc6xx */
+{
+  if (self->error)
+  {
+    self->error = 0;
+    return (-1);
+  }
+
+  if (status)
+  {
+    PyErr_SetString(PyExc_ValueError, "tmc6xx: invalid job state or data");
+    return (-1);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'job_close()' - End the job.
+ */
+
+static PyObject *			/* O - None */
+job_close(job_object_t *self,		/* I - Job object */
+          PyObject     *args)		/* I - Unused */
+{
+  int	status;				/* libtmc6xx status */
+
+
+  (void)args;
+
+  if (!self->job)
+    Py_RETURN_NONE;
+
+  status = tmcJobEnd(self->job);
+
+  tmcJobDelete(self->job);
+  self->job = NULL;
+
+  if (job_check(self, status))
+    return (NULL);
+
+  Py_RETURN_NONE;
+}
+
+
+/*
+ * 'job_dealloc()' - Free a job object.
+ */
+
+static void
+job_dealloc(job_object_t *self)		/* I - Job object */
+{
+  tmcJobDelete(self->job);
+  Py_XDECREF(self->file);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+
+/*
+ * 'job_end_page()' - End the current page.
+ */
+
+static PyObject *			/* O - None */
+job_end_page(job_object_t *self,	/* I - Job object */
+             PyObject     *args)	/* I - Unused */
+{
+  (void)args;
+
+  if (!self->job)
+  {
+    PyErr_SetString(PyExc_ValueError, "tmc6xx: job is closed");
+    return (NULL);
+  }
+
+  if (job_check(self, tmcJobEndPage(self->job)))
+    return (NULL);
+
+  Py_RETURN_NONE;
+}
+
+
+/*
+ * 'job_init()' - Start a job writing to a file object.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+job_init(job_object_t *self,		/* I - Job object */
+         PyObject     *args,		/* I - Arguments */
+	 PyObject     *kwds)		/* I - Keyword arguments */
+{
+  static char	*kwlist[] = { "file", NULL };
+  PyObject	*file;			/* Output file object */
+
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &file))
+    return (-1);
+
+  if (self->job)
+  {
+    PyErr_SetString(PyExc_RuntimeError, "tmc6xx: job already started");
+    return (-1);
+  }
+
+  Py_INCREF(file);
+  Py_XDECREF(self->file);
+  self->file = file;
+
+  if ((self->job = tmcJobNew(job_write_cb, self)) == NULL)
+  {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "tmc6xx: another job is open or out of memory");
+    return (-1);
+  }
+
+  return (0);
+}
+
+
+/*
+ * 'job_start_page()' - Start a page.
+ */
+
+static PyObject *			/* O - None */
+job_start_page(job_object_t *self,	/* I - Job object */
+               PyObject     *args,	/* I - Arguments */
+	       PyObject     *kwds)	/* I - Keyword arguments */
+{
+  static char	*kwlist[] = { "width", "height", "top", "bottom", "cut",
+			      NULL };
+  unsigned	width,			/* Width in pixels */
+		height,			/* Height in lines */
+		top = 0,		/* Top margin */
+		bottom = 0;		/* Bottom margin */
+  int		cut = 0;		/* Cut the page? */
+
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "II|IIp", kwlist, &width,
+                                   &height, &top, &bottom, &cut))
+    return (NULL);
+
+  if (!self->job)
+  {
+    PyErr_SetString(PyExc_ValueError, "tmc6xx: job is closed");
+    return (NULL);
+  }
+
+  if (job_check(self, tmcJobStartPage(self->job, width, height, top, bottom,
+                                      cut)))
+    return (NULL);
+
+  Py_RETURN_NONE;
+}
+
+
+/*
+ * 'job_write_band()' - Dither and send lines of pixels.
+ */
+
+static PyObject *			/* O - None */
+job_write_band(job_object_t *self,	/* I - Job object */
+               PyObject     *args,	/* I - Arguments */
+	       PyObject     *kwds)	/* I - Keyword arguments */
+{
+  static char	*kwlist[] = { "pixels", "lines", "format", NULL };
+  Py_buffer	pixels;			/* Pixel data */
+  unsigned	lines;			/* Number of lines */
+  int		format = TMC_FORMAT_RGB,/* Pixel format */
+		status;			/* libtmc6xx status */
+
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "y*I|i", kwlist, &pixels,
+                                   &lines, &format))
+    return (NULL);
+
+  if (!self->job)
+  {
+    PyBuffer_Release(&pixels);
+    PyErr_SetString(PyExc_ValueError, "tmc6xx: job is closed");
+    return (NULL);
+  }
+
+  if (lines == 0 || pixels.len % lines)
+  {
+    PyBuffer_Release(&pixels);
+    PyErr_SetString(PyExc_ValueError,
+                    "tmc6xx: pixels is not a whole number of lines");
+    return (NULL);
+  }
+
+  status = tmcJobWriteBand(self->job, format, pixels.buf,
+                           (size_t)pixels.len / lines, lines);
+
+  PyBuffer_Release(&pixels);
+
+  if (job_check(self, status))
+    return (NULL);
+
+  Py_RETURN_NONE;
+}
+
+
+/*
+ * 'job_write_cb()' - Send printer data to the file object.
+ */
+
+static int				/* O - 0 on success, -1 on error */
+job_write_cb(void       *ctx,		/* I - Job object */
+             const void *data,		/* I - Bytes */
+	     size_t     length)		/* I - Number of bytes */
+{
+  job_object_t	*self = (job_object_t *)ctx;
+					/* Job object */
+  PyObject	*result;		/* Result of write() */
+
+
+  if (self->error)
+    return (-1);
+
+  if ((result = PyObject_CallMethod(self->file, "write", "y#",
+                                    (const char *)data,
+				    (Py_ssize_t)length)) == NULL)
+  {
+    self->error = 1;
+    return (-1);
+  }
+
+  Py_DECREF(result);
+
+  return (0);
+}
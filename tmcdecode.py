@@ -0,0 +1,416 @@
+#!/usr/bin/env python3
+#
+# ESC/P-R stream decoder and print-time model for the TM-C6xx.
+#
+# Usage:
+#
+#   tmcdecode.py [options] file.prn [other.prn]
+#
+# Decodes the stream written by rastertotmc6xx or tmc600.py back into the
+# 2-bit dot planes of each page, so that two driver versions can be compared
+# pixel for pixel, and estimates how long the printer takes to print it:
+#
+#   tmcdecode.py job.prn                    page, band and byte summary
+#   tmcdecode.py -o pages job.prn           also write one PGM per plane
+#   tmcdecode.py old.prn new.prn            compare the dots of two streams
+#
+# The timing model is deliberately simple.  The printer prints each band
+# once its data has arrived and the previous band has finished; a band takes
+# one head pass per microweave pass that has ink, plus the paper feed up to
+# it, and every page adds the cut.  All of the speeds are options, so the
+# model can be fitted to a stopwatch on real hardware.
+#
+# Licensed under the LGPL2, with no additional restrictions, as per the
+# CUPS LICENSE.txt
+#
+
+from __future__ import print_function
+
+import argparse
+import os
+import struct
+import sys
+
+# Color codes from the ESC i command (without the microweave bit 0x40)
+PLANE_NAMES = {
+    0: "K",
+    1: "M",
+    2: "C",
+    4: "Y",
+    16: "k",
+    17: "m",
+    18: "c",
+}
+
+MICROWEAVE = 0x40
+
+
+class DecodeError(Exception):
+    pass
+
+
+class Band(object):
+    """One group of ESC i blocks between paper feeds."""
+
+    def __init__(self, y):
+        self.y = y              # Line of the band on the page
+        self.passes = set()     # Microweave passes with ink (0 or 0x40)
+        self.rows = 0           # Most lines in the band
+        self.payload = 0        # Bytes of ESC i data as sent
+        self.bytes = 0          # Bytes of stream up to the end of the band
+
+
+class Page(object):
+    """The dot planes and bands of one page."""
+
+    def __init__(self):
+        self.planes = {}        # Color code -> {line: bytearray of levels}
+        self.width = 0          # Widest line in dots
+        self.height = 0         # Lines from the top of the page
+        self.bands = []         # Band list
+        self.bytes = 0          # Bytes of stream for the page
+        self.length = 0         # Page length in lines
+        self.cut = False        # Cutter enabled?
+        self.resolution = 180   # Lines per inch
+
+    def set_line(self, color, y, x, levels):
+        plane = self.planes.setdefault(color, {})
+        line = plane.get(y)
+
+        if line is None:
+            line = plane[y] = bytearray()
+
+        if len(line) < x + len(levels):
+            line.extend(bytes(x + len(levels) - len(line)))
+
+        line[x:x + len(levels)] = levels
+
+        self.width = max(self.width, len(line))
+        self.height = max(self.height, y + 1)
+
+
+def unpack_bits(data, pos, length):
+    """Decode PackBits data until length bytes come out."""
+
+    out = bytearray()
+
+    while len(out) < length:
+        if pos >= len(data):
+            raise DecodeError("PackBits data runs past the end of the stream")
+
+        count = data[pos]
+        pos += 1
+
+        if count < 128:
+            out += data[pos:pos + count + 1]
+            pos += count + 1
+        elif count > 128:
+            out += data[pos:pos + 1] * (257 - count)
+            pos += 1
+
+    if len(out) > length:
+        raise DecodeError("PackBits data overruns the ESC i block")
+
+    return bytes(out), pos
+
+
+def unpack_dots(line, bits, width):
+    """Split packed dots into one level per byte."""
+
+    if bits == 1:
+        levels = bytearray((b >> s) & 1 for b in line for s in (7, 6, 5, 4, 3, 2, 1, 0))
+    elif bits == 2:
+        levels = bytearray((b >> s) & 3 for b in line for s in (6, 4, 2, 0))
+    else:
+        raise DecodeError("unsupported %d bits per dot" % bits)
+
+    return levels[:width] if width else levels
+
+
+def decode(data):
+    """Decode a stream into a list of pages."""
+
+    pages = []
+    page = Page()
+    band = None
+    pos = 0
+    y = 0           # Current line
+    x = 0           # Current head offset in dots
+    resolution = 180
+    units = (8, 1440)   # Page unit and base divisors
+    length = 0
+    page_start = 0
+    cut = False
+
+    def end_band():
+        if band is not None and band.passes:
+            band.bytes = pos - page_start
+            page.bands.append(band)
+
+    while pos < len(data):
+        c = data[pos]
+
+        if c == 0x1b:
+            cmd = data[pos + 1:pos + 2]
+
+            if cmd == b'@':
+                pos += 2
+            elif cmd == b'\x01':
+                # Exit packet mode ("@EJL 1284.4\n@EJL     \n")
+                end = data.find(b'\n', data.find(b'\n', pos) + 1)
+
+                if end < 0:
+                    raise DecodeError("unterminated EJL at %d" % pos)
+
+                pos = end + 1
+            elif cmd == b'\x19':
+                pos += 3
+            elif cmd == b'\x00':
+                pos += 4
+            elif cmd == b'(':
+                name = data[pos + 2:pos + 3]
+                (length,) = struct.unpack_from("<H", data, pos + 3)
+                arg = data[pos + 5:pos + 5 + length]
+                pos += 5 + length
+
+                if name == b'R':
+                    # REMOTE1 commands up to ESC NUL NUL NUL
+                    while data[pos:pos + 1] != b'\x1b':
+                        rname = data[pos:pos + 2]
+                        (rlen,) = struct.unpack_from("<H", data, pos + 2)
+                        rarg = data[pos + 4:pos + 4 + rlen]
+
+                        if rname == b'AC' and rlen >= 1:
+                            cut = rarg[-1] != 0
+
+                        pos += 4 + rlen
+                elif name == b'U':
+                    # Feeds are in vertical units and offsets in horizontal
+                    # units, which are the line and dot pitch
+                    pageunit, vertical, _, base = struct.unpack("<BBBH", arg)
+                    resolution = base // vertical
+                    units = (pageunit, base)
+                elif name == b'C':
+                    length = struct.unpack("<L", arg)[0] * units[0] * resolution // units[1]
+                elif name == b'v':
+                    end_band()
+                    band = None
+                    y += struct.unpack("<L", arg)[0]
+                elif name == b'$':
+                    x = struct.unpack("<L", arg)[0]
+                elif name in (b'c', b'd', b'G', b'K', b'S', b'D', b'e', b'm'):
+                    pass
+                else:
+                    print("warning: unknown ESC ( %r at %d" % (name, pos), file=sys.stderr)
+            elif cmd == b'i':
+                color, comp, bits, width, rows = struct.unpack_from("<BBBHH", data, pos + 2)
+                pos += 9
+                start = pos
+
+                if comp:
+                    block, pos = unpack_bits(data, pos, width * rows)
+                else:
+                    block = data[pos:pos + width * rows]
+                    pos += width * rows
+
+                if band is None:
+                    band = Band(y)
+
+                weave = color & MICROWEAVE
+                band.payload += pos - start
+                band.rows = max(band.rows, 2 * rows)
+
+                for r in range(rows):
+                    line = block[r * width:(r + 1) * width]
+
+                    if any(line):
+                        band.passes.add(weave)
+                        page.set_line(color & ~MICROWEAVE, y + 2 * r + (1 if weave else 0), x,
+                                      unpack_dots(line, bits, 0))
+            else:
+                raise DecodeError("unknown ESC %r at %d" % (cmd, pos))
+        elif c == 0x0d:
+            x = 0
+            pos += 1
+        elif c == 0x0c:
+            pos += 1
+            end_band()
+            band = None
+            page.bytes = pos - page_start
+            page.cut = cut
+            page.resolution = resolution
+            page.length = length
+            pages.append(page)
+            page = Page()
+            page_start = pos
+            y = 0
+        elif c == 0x00:
+            pos += 1
+        else:
+            raise DecodeError("unexpected byte 0x%02x at %d" % (c, pos))
+
+    return pages
+
+
+def decode_file(filename):
+    """Decode a file, reporting errors."""
+
+    try:
+        with open(filename, "rb") as fp:
+            return decode(fp.read())
+    except (DecodeError, struct.error) as e:
+        print("%s: %s" % (filename, e), file=sys.stderr)
+    except IOError as e:
+        print("%s: %s" % (filename, e.strerror), file=sys.stderr)
+
+    return None
+
+
+def write_pgm(filename, page, color):
+    """Write a plane as a PGM image, ink dark on white."""
+
+    plane = page.planes.get(color, {})
+    width = page.width
+    shades = bytes(255 - 85 * level for level in range(4)) + bytes(252)
+
+    with open(filename, "wb") as fp:
+        fp.write(b"P5\n%d %d\n255\n" % (width, page.height))
+
+        blank = bytes([255]) * width
+
+        for y in range(page.height):
+            line = plane.get(y)
+
+            if line is None:
+                fp.write(blank)
+            else:
+                fp.write(bytes(line).translate(shades) + blank[len(line):])
+
+
+def simulate(page, args):
+    """Estimate the print time of a page."""
+
+    clock = 0.0     # Printer time
+    passes = 0      # Head passes
+    fed = 0         # Lines fed so far
+    inch = float(page.resolution) * args.feed_speed
+                    # Lines fed per second
+
+    for band in page.bands:
+        # A band starts once its data has arrived and the last one is done
+        clock = max(clock, band.bytes / args.link_speed)
+        clock += (band.y - fed) / inch + len(band.passes) * args.pass_time
+        passes += len(band.passes)
+        fed = band.y
+
+    # Eject and cut once the rest of the page has arrived
+    clock = max(clock, page.bytes / args.link_speed)
+    clock += max(max(page.length, page.height) - fed, 0) / inch
+
+    if page.cut:
+        clock += args.cut_time
+
+    return clock, passes
+
+
+def compare(a, b):
+    """Compare the dots of two decoded streams."""
+
+    if len(a) != len(b):
+        print("page count differs: %d != %d" % (len(a), len(b)))
+        return 1
+
+    errors = 0
+
+    for number, (pa, pb) in enumerate(zip(a, b), 1):
+        for color in sorted(set(pa.planes) | set(pb.planes)):
+            la = pa.planes.get(color, {})
+            lb = pb.planes.get(color, {})
+            bad = 0
+            first = None
+
+            for y in sorted(set(la) | set(lb)):
+                da = bytes(la.get(y, b'')).rstrip(b'\0')
+                db = bytes(lb.get(y, b'')).rstrip(b'\0')
+
+                if da != db:
+                    n = max(len(da), len(db))
+                    da = da.ljust(n, b'\0')
+                    db = db.ljust(n, b'\0')
+                    diff = sum(1 for p, q in zip(da, db) if p != q)
+
+                    if first is None:
+                        first = (next(i for i in range(n) if da[i] != db[i]), y)
+
+                    bad += diff
+
+            if bad:
+                print("page %d plane %s: %d dots differ, first at x=%d y=%d" %
+                      (number, PLANE_NAMES.get(color, str(color)), bad, first[0], first[1]))
+                errors += 1
+
+    if not errors:
+        print("%d pages, dots identical" % len(a))
+
+    return 1 if errors else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a TM-C6xx ESC/P-R stream.")
+    parser.add_argument("file", help="stream to decode")
+    parser.add_argument("other", nargs="?", help="second stream to compare dots with")
+    parser.add_argument("-o", "--output", metavar="DIR",
+                        help="write each plane of each page as DIR/page-N-PLANE.pgm")
+    parser.add_argument("--link-speed", type=float, default=1000000.0, metavar="BYTES/S",
+                        help="host to printer throughput (default 1000000, USB 1.1)")
+    parser.add_argument("--pass-time", type=float, default=0.3, metavar="S",
+                        help="seconds per head pass (default 0.3)")
+    parser.add_argument("--feed-speed", type=float, default=4.0, metavar="IN/S",
+                        help="paper feed speed (default 4.0)")
+    parser.add_argument("--cut-time", type=float, default=0.5, metavar="S",
+                        help="seconds per cut (default 0.5)")
+    args = parser.parse_args()
+
+    pages = decode_file(args.file)
+
+    if pages is None:
+        return 2
+
+    if args.other:
+        other = decode_file(args.other)
+
+        return 2 if other is None else compare(pages, other)
+
+    total = 0.0
+
+    for number, page in enumerate(pages, 1):
+        seconds, passes = simulate(page, args)
+        total += seconds
+
+        print("page %d: %dx%d dots, planes %s, %d bands, %d head passes, "
+              "%d bytes (%d of graphics), %.2fs" %
+              (number, page.width, page.height,
+               "".join(PLANE_NAMES.get(c, "?") for c in sorted(page.planes)),
+               len(page.bands), passes, page.bytes,
+               sum(b.payload for b in page.bands), seconds))
+
+        if args.output:
+            if not os.path.isdir(args.output):
+                os.makedirs(args.output)
+
+            for color in sorted(page.planes):
+                write_pgm(os.path.join(args.output, "page-%d-%s.pgm" %
+                                       (number, PLANE_NAMES.get(color, str(color)))),
+                          page, color)
+
+    if pages:
+        print("%d pages in %.2fs, %.1f labels/minute" %
+              (len(pages), total, 60.0 * len(pages) / total if total else 0.0))
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
+
+#  vim: set shiftwidth=4 expandtab: #
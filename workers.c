@@ -0,0 +1,205 @@
+/*
+ * Persistent worker threads for the TM-C6xx filter.
+ *
+ * The threads are started once per job and then wait for work; each call
+ * to tmcWorkersRun() hands out the items 0 to num_items-1 to the workers
+ * and the calling thread, and returns once every item is done.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+/*
+ * Include necessary headers...
+ */
+
+#include "workers.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+
+/*
+ * Types...
+ */
+
+struct tmc_workers_s			/**** Worker thread pool ****/
+{
+  pthread_mutex_t	mutex;		/* Pool lock */
+  pthread_cond_t	start,		/* Work available */
+			done;		/* Work finished */
+  int			count;		/* Number of threads */
+  pthread_t		*threads;	/* Threads */
+  unsigned		generation;	/* Current batch of work */
+  int			stop;		/* Stop the threads? */
+  tmc_work_cb_t		cb;		/* Work callback */
+  void			*data;		/* Callback data */
+  int			num_items,	/* Number of items in batch */
+			next_item,	/* Next item to hand out */
+			busy;		/* Number of busy threads */
+};
+
+
+/*
+ * Local functions...
+ */
+
+static void	*tmc_worker(void *data);
+
+
+/*
+ * 'tmcWorkersNew()' - Start a pool of worker threads.
+ */
+
+tmc_workers_t *				/* O - Worker pool or NULL */
+tmcWorkersNew(int count)		/* I - Number of threads */
+{
+  tmc_workers_t	*workers;		/* Worker pool */
+
+
+  if ((workers = calloc(1, sizeof(tmc_workers_t))) == NULL)
+    return (NULL);
+
+  if (count > 0 &&
+      (workers->threads = calloc(count, sizeof(pthread_t))) == NULL)
+  {
+    free(workers);
+    return (NULL);
+  }
+
+  pthread_mutex_init(&workers->mutex, NULL);
+  pthread_cond_init(&workers->start, NULL);
+  pthread_cond_init(&workers->done, NULL);
+
+  for (workers->count = 0; workers->count < count; workers->count ++)
+    if (pthread_create(workers->threads + workers->count, NULL, tmc_worker,
+                       workers))
+      break;
+
+  return (workers);
+}
+
+
+/*
+ * 'tmcWorkersDelete()' - Stop and free a pool of worker threads.
+ */
+
+void
+tmcWorkersDelete(tmc_workers_t *workers)/* I - Worker pool */
+{
+  int	i;				/* Looping var */
+
+
+  if (!workers)
+    return;
+
+  pthread_mutex_lock(&workers->mutex);
+  workers->stop = 1;
+  pthread_cond_broadcast(&workers->start);
+  pthread_mutex_unlock(&workers->mutex);
+
+  for (i = 0; i < workers->count; i ++)
+    pthread_join(workers->threads[i], NULL);
+
+  pthread_mutex_destroy(&workers->mutex);
+  pthread_cond_destroy(&workers->start);
+  pthread_cond_destroy(&workers->done);
+
+  free(workers->threads);
+  free(workers);
+}
+
+
+/*
+ * 'tmcWorkersRun()' - Run a batch of work items and wait for them to finish.
+ *
+ * A NULL pool runs the items in order on the calling thread.
+ */
+
+void
+tmcWorkersRun(tmc_workers_t *workers,	/* I - Worker pool */
+              int           num_items,	/* I - Number of items */
+              tmc_work_cb_t cb,		/* I - Work callback */
+              void          *data)	/* I - Callback data */
+{
+  int	item;				/* Current item */
+
+
+  if (!workers || workers->count == 0 || num_items < 2)
+  {
+    for (item = 0; item < num_items; item ++)
+      (*cb)(data, item);
+
+    return;
+  }
+
+  pthread_mutex_lock(&workers->mutex);
+
+  workers->cb        = cb;
+  workers->data      = data;
+  workers->num_items = num_items;
+  workers->next_item = 0;
+  workers->generation ++;
+
+  pthread_cond_broadcast(&workers->start);
+
+  while (workers->next_item < workers->num_items)
+  {
+    item = workers->next_item ++;
+
+    pthread_mutex_unlock(&workers->mutex);
+    (*cb)(data, item);
+    pthread_mutex_lock(&workers->mutex);
+  }
+
+  while (workers->busy > 0)
+    pthread_cond_wait(&workers->done, &workers->mutex);
+
+  pthread_mutex_unlock(&workers->mutex);
+}
+
+
+/*
+ * 'tmc_worker()' - Run work items as they are handed out.
+ */
+
+static void *				/* O - Thread status */
+tmc_worker(void *data)			/* I - Worker pool */
+{
+  tmc_workers_t	*workers = (tmc_workers_t *)data;
+					/* Worker pool */
+  unsigned	generation;		/* Last batch seen */
+  int		item;			/* Current item */
+
+
+  pthread_mutex_lock(&workers->mutex);
+
+  generation = workers->generation;
+
+  for (;;)
+  {
+    while (workers->generation == generation && !workers->stop)
+      pthread_cond_wait(&workers->start, &workers->mutex);
+
+    if (workers->stop)
+      break;
+
+    generation = workers->generation;
+    workers->busy ++;
+
+    while (workers->next_item < workers->num_items)
+    {
+      item = workers->next_item ++;
+
+      pthread_mutex_unlock(&workers->mutex);
+      (*workers->cb)(workers->data, item);
+      pthread_mutex_lock(&workers->mutex);
+    }
+
+    if (-- workers->busy == 0)
+      pthread_cond_broadcast(&workers->done);
+  }
+
+  pthread_mutex_unlock(&workers->mutex);
+
+  return (NULL);
+}
@@ -0,0 +1,31 @@
+/*
+ * Persistent worker threads for the TM-C6xx filter.
+ *
+ * Licensed under the LGPL2, with no additional restrictions, as per the
+ * CUPS LICENSE.txt
+ */
+
+#ifndef _TMC6XX_WORKERS_H_
+#  define _TMC6XX_WORKERS_H_
+
+/*
+ * Types...
+ */
+
+typedef void (*tmc_work_cb_t)(void *data, int item);
+					/**** Work item callback ****/
+
+typedef struct tmc_workers_s tmc_workers_t;
+					/**** Worker thread pool ****/
+
+
+/*
+ * Prototypes...
+ */
+
+extern tmc_workers_t	*tmcWorkersNew(int count);
+extern void		tmcWorkersDelete(tmc_workers_t *workers);
+extern void		tmcWorkersRun(tmc_workers_t *workers, int num_items,
+			              tmc_work_cb_t cb, void *data);
+
+#endif /* !_TMC6XX_WORKERS_H_ */